@@ -0,0 +1,253 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/stat.h>
+
+#include "access_log.h"
+#include "logger.h"
+
+//一条格式化以后的记录的最大长度：文本格式中每个字符串字节最多转义成4个字节
+static const int MAX_ENTRY_SIZE = 4 * (access_log::METHOD_LEN + access_log::URL_LEN + access_log::VERSION_LEN
+                                       + access_log::REFERER_LEN + access_log::AGENT_LEN) + 256;
+//日志线程一次从队列中取出的记录数
+static const int POP_BATCH = 64;
+static const char BINARY_MAGIC[4] = {'A', 'C', 'L', '1'};
+
+access_log::access_log(const char* path, FORMAT format, long rotate_bytes):
+            m_path(path), m_format(format), m_rotate_bytes(rotate_bytes), m_fd(-1), m_file_size(0),
+            m_queue(NULL), m_stop(false), m_batch(NULL), m_batch_len(0), m_batch_records(0), m_second(-1),
+            m_written(0), m_dropped(0), m_rotations(0){
+    //轮转时要按路径改名，相对路径先换成绝对路径，之后进程改变工作目录也不受影响
+    if(path[0] != '/'){
+        char cwd[PATH_MAX];
+        if(getcwd(cwd, sizeof(cwd))){
+            m_path = std::string(cwd) + "/" + path;
+        }
+    }
+    if(!open_file()){
+        throw std::exception();
+    }
+    m_queue = new mpmc_queue<record>(QUEUE_SIZE);
+    m_batch = new char[BATCH_SIZE];
+    if(pthread_create(&m_thread, NULL, worker, this) != 0){
+        delete m_queue;
+        delete [] m_batch;
+        close(m_fd);
+        throw std::exception();
+    }
+}
+
+access_log::~access_log(){
+    m_stop = true;
+    pthread_join(m_thread, NULL);
+    close(m_fd);
+    delete m_queue;
+    delete [] m_batch;
+}
+
+int access_log::parse_format(const char* name){
+    if(strcmp(name, "text") == 0){
+        return FORMAT_TEXT;
+    }
+    if(strcmp(name, "binary") == 0){
+        return FORMAT_BINARY;
+    }
+    return -1;
+}
+
+bool access_log::append(const record& entry){
+    if(!m_queue->push(entry)){
+        m_dropped++;
+        return false;
+    }
+    return true;
+}
+
+bool access_log::open_file(){
+    m_fd = open(m_path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(m_fd < 0){
+        return false;
+    }
+    struct stat st;
+    m_file_size = fstat(m_fd, &st) == 0 ? st.st_size : 0;
+    //二进制格式的新文件先写魔数
+    if(m_format == FORMAT_BINARY && m_file_size == 0){
+        if(::write(m_fd, BINARY_MAGIC, sizeof(BINARY_MAGIC)) == (int)sizeof(BINARY_MAGIC)){
+            m_file_size = sizeof(BINARY_MAGIC);
+        }
+    }
+    return true;
+}
+
+//path.4改名成path.5，……，path改名成path.1，再重新打开path，最老的文件被覆盖掉
+void access_log::rotate(){
+    close(m_fd);
+    for(int i = KEEP_FILES - 1; i >= 1; --i){
+        rename((m_path + "." + std::to_string(i)).c_str(), (m_path + "." + std::to_string(i + 1)).c_str());
+    }
+    rename(m_path.c_str(), (m_path + ".1").c_str());
+    m_rotations++;
+    if(!open_file()){
+        LOG_ERROR("access log reopen failed, errno is : %d", errno);
+    }
+}
+
+void access_log::flush(){
+    if(m_batch_len == 0){
+        return;
+    }
+    if(m_rotate_bytes > 0 && m_file_size > 0 && m_file_size + m_batch_len > m_rotate_bytes){
+        rotate();
+    }
+    //上一次轮转后没能重新打开文件的话再试一次
+    if(m_fd < 0){
+        open_file();
+    }
+    int done = 0;
+    while(m_fd >= 0 && done < m_batch_len){
+        int ret = ::write(m_fd, m_batch + done, m_batch_len - done);
+        if(ret < 0 && errno == EINTR){
+            continue;
+        }
+        if(ret <= 0){
+            break;
+        }
+        done += ret;
+    }
+    m_file_size += done;
+    if(done == m_batch_len){
+        m_written += m_batch_records;
+    }else{
+        //磁盘满了或者文件出错，这一批丢掉，下一批再试
+        m_dropped += m_batch_records;
+    }
+    m_batch_len = 0;
+    m_batch_records = 0;
+}
+
+//把字符串按combined格式的习惯转义：双引号、反斜杠和不可打印字符写成\xHH
+static int escape(char* out, const char* text, int len){
+    static const char hex[] = "0123456789ABCDEF";
+    if(len == 0){
+        out[0] = '-';
+        return 1;
+    }
+    int n = 0;
+    for(int i = 0; i < len; ++i){
+        unsigned char c = text[i];
+        if(c < 0x20 || c >= 0x7f || c == '"' || c == '\\'){
+            out[n++] = '\\';
+            out[n++] = 'x';
+            out[n++] = hex[c >> 4];
+            out[n++] = hex[c & 0xf];
+        }else{
+            out[n++] = c;
+        }
+    }
+    return n;
+}
+
+//127.0.0.1 - - [16/Oct/2026:23:18:53 +0800] "GET /index.html HTTP/1.1" 200 1234 "-" "curl/8.0" 153 keep-alive
+int access_log::format_text(const record& entry, char* out){
+    long long second = entry.time_us / 1000000;
+    if(second != m_second){
+        time_t t = second;
+        struct tm tm;
+        localtime_r(&t, &tm);
+        strftime(m_second_text, sizeof(m_second_text), "%d/%b/%Y:%H:%M:%S %z", &tm);
+        m_second = second;
+    }
+    struct in_addr addr;
+    addr.s_addr = entry.addr;
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &addr, ip, sizeof(ip));
+    int n = sprintf(out, "%s - - [%s] \"", ip, m_second_text);
+    n += escape(out + n, entry.method, entry.method_len);
+    out[n++] = ' ';
+    n += escape(out + n, entry.url, entry.url_len);
+    out[n++] = ' ';
+    n += escape(out + n, entry.version, entry.version_len);
+    n += sprintf(out + n, "\" %d %lld \"", entry.status, entry.bytes);
+    n += escape(out + n, entry.referer, entry.referer_len);
+    memcpy(out + n, "\" \"", 3);
+    n += 3;
+    n += escape(out + n, entry.agent, entry.agent_len);
+    n += sprintf(out + n, "\" %u %s\n", entry.latency_us, entry.keep_alive ? "keep-alive" : "close");
+    return n;
+}
+
+template<typename T>
+static inline int put(char* out, T value){
+    memcpy(out, &value, sizeof(value));
+    return sizeof(value);
+}
+
+int access_log::format_binary(const record& entry, char* out){
+    int n = sizeof(unsigned int);
+    n += put(out + n, entry.time_us);
+    n += put(out + n, entry.latency_us);
+    n += put(out + n, entry.addr);
+    n += put(out + n, entry.port);
+    n += put(out + n, entry.status);
+    n += put(out + n, entry.bytes);
+    n += put(out + n, (unsigned char)entry.keep_alive);
+    n += put(out + n, entry.method_len);
+    n += put(out + n, entry.url_len);
+    n += put(out + n, entry.version_len);
+    n += put(out + n, entry.referer_len);
+    n += put(out + n, entry.agent_len);
+    memcpy(out + n, entry.method, entry.method_len);
+    n += entry.method_len;
+    memcpy(out + n, entry.url, entry.url_len);
+    n += entry.url_len;
+    memcpy(out + n, entry.version, entry.version_len);
+    n += entry.version_len;
+    memcpy(out + n, entry.referer, entry.referer_len);
+    n += entry.referer_len;
+    memcpy(out + n, entry.agent, entry.agent_len);
+    n += entry.agent_len;
+    put(out, (unsigned int)n);
+    return n;
+}
+
+void* access_log::worker(void* arg){
+    access_log* log = (access_log*)arg;
+    log->run();
+    return log;
+}
+
+void access_log::run(){
+    record* entries = new record[POP_BATCH];
+    struct timespec interval;
+    interval.tv_sec = FLUSH_INTERVAL_MS / 1000;
+    interval.tv_nsec = (FLUSH_INTERVAL_MS % 1000) * 1000000L;
+    while(true){
+        int n = m_queue->pop_batch(entries, POP_BATCH);
+        if(n == 0){
+            //队列空了，攒下的写出去，然后睡一个间隔；请求处理线程不负责唤醒日志线程
+            flush();
+            if(m_stop){
+                break;
+            }
+            nanosleep(&interval, NULL);
+            continue;
+        }
+        for(int i = 0; i < n; ++i){
+            if(m_batch_len + MAX_ENTRY_SIZE > BATCH_SIZE){
+                flush();
+            }
+            if(m_format == FORMAT_BINARY){
+                m_batch_len += format_binary(entries[i], m_batch + m_batch_len);
+            }else{
+                m_batch_len += format_text(entries[i], m_batch + m_batch_len);
+            }
+            m_batch_records++;
+        }
+    }
+    delete [] entries;
+}
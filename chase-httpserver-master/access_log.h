@@ -0,0 +1,109 @@
+// 访问日志：每个响应发完（或者中途断开）时记录一条：收到请求的时间、客户端地址、请求行、状态码、发送的字节数、
+// Referer、User-Agent、处理耗时和是否keep-alive。反应堆线程只把记录放进一个无锁的有界队列，
+// 由访问日志自己的线程批量取出、格式化后一次write写到文件，文件超过设定的大小时按序号轮转。
+// 支持两种格式：
+//   text    Apache/nginx的combined格式，行尾加上耗时（微秒）和keep-alive/close
+//   binary  紧凑的二进制格式，文件开头是4字节魔数"ACL1"，每条记录是一个固定的头部加上几段字符串：
+//           u32 记录总长度  i64 收到请求的Unix时间（微秒）  u32 耗时（微秒）  u32 IPv4地址（网络字节序）
+//           u16 端口  u16 状态码  i64 发送的字节数  u8 keep-alive  u8 方法长度  u16 URL长度
+//           u8 版本长度  u8 Referer长度  u16 User-Agent长度，然后依次是方法、URL、版本、Referer、User-Agent，
+//           整数都是主机字节序
+// note：队列满了或者写盘失败（比如磁盘满了）时丢弃记录并计数，请求处理线程永远不会因为访问日志而阻塞
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <pthread.h>
+#include <atomic>
+#include <string>
+
+#include "mpmc_queue.h"
+
+class access_log
+{
+public:
+    enum FORMAT {FORMAT_TEXT = 0, FORMAT_BINARY};
+    //队列中最多积压的记录数
+    static const int QUEUE_SIZE = 8192;
+    //一次write的最大字节数，以及队列空时日志线程多久检查一次
+    static const int BATCH_SIZE = 64 * 1024;
+    static const int FLUSH_INTERVAL_MS = 100;
+    //轮转时保留的旧文件个数：path.1是最近的一个
+    static const int KEEP_FILES = 5;
+    //各段字符串的最大长度，超出的部分被截掉
+    static const int METHOD_LEN = 16;
+    static const int URL_LEN = 256;
+    static const int VERSION_LEN = 16;
+    static const int REFERER_LEN = 128;
+    static const int AGENT_LEN = 128;
+
+    //一条访问记录，字符串不以'\0'结尾，长度单独记录
+    struct record
+    {
+        long long time_us;
+        unsigned int latency_us;
+        unsigned int addr;
+        unsigned short port;
+        unsigned short status;
+        long long bytes;
+        bool keep_alive;
+        unsigned char method_len;
+        unsigned short url_len;
+        unsigned char version_len;
+        unsigned char referer_len;
+        unsigned short agent_len;
+        char method[METHOD_LEN];
+        char url[URL_LEN];
+        char version[VERSION_LEN];
+        char referer[REFERER_LEN];
+        char agent[AGENT_LEN];
+    };
+
+    //打开path并启动日志线程，rotate_bytes是单个文件的大小上限，0表示不轮转。打不开文件时抛出异常
+    access_log(const char* path, FORMAT format, long rotate_bytes);
+    //把队列中剩下的记录写完再退出
+    ~access_log();
+
+    //在反应堆线程中调用，队列满时丢弃并返回false
+    bool append(const record& entry);
+    //按格式名（text、binary）取格式，不认识的名字返回-1
+    static int parse_format(const char* name);
+
+    long written() const { return m_written; }
+    long dropped() const { return m_dropped; }
+    long rotations() const { return m_rotations; }
+
+private:
+    static void* worker(void* arg);
+    void run();
+    //格式化一条记录追加到批量缓冲区，返回写入的字节数
+    int format_text(const record& entry, char* out);
+    int format_binary(const record& entry, char* out);
+    //把批量缓冲区写到文件，必要时先轮转，写失败时丢弃这一批
+    void flush();
+    bool open_file();
+    void rotate();
+
+private:
+    std::string m_path;
+    FORMAT m_format;
+    long m_rotate_bytes;
+    int m_fd;
+    long m_file_size;
+    mpmc_queue<record>* m_queue;
+    pthread_t m_thread;
+    std::atomic<bool> m_stop;
+
+    //只在日志线程中使用
+    char* m_batch;
+    int m_batch_len;
+    int m_batch_records;
+    //combined格式的时间每秒才重新格式化一次
+    long long m_second;
+    char m_second_text[32];
+
+    std::atomic<long> m_written;
+    std::atomic<long> m_dropped;
+    std::atomic<long> m_rotations;
+};
+
+#endif
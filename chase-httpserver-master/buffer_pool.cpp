@@ -0,0 +1,63 @@
+#include <stdlib.h>
+
+#include "buffer_pool.h"
+
+buffer_pool::buffer_pool(size_t block_size, int slab_blocks, bool shared):
+            m_slab_blocks(slab_blocks > 0 ? slab_blocks : 1), m_free(NULL), m_in_use(0), m_capacity(0), m_shared(shared){
+    //块按指针大小对齐，并且至少能放下空闲链表的指针
+    m_block_size = (block_size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+    if(m_block_size < sizeof(free_block)){
+        m_block_size = sizeof(free_block);
+    }
+}
+
+buffer_pool::~buffer_pool(){
+    for(size_t i = 0; i < m_slabs.size(); ++i){
+        free(m_slabs[i]);
+    }
+}
+
+bool buffer_pool::grow(){
+    char* slab = (char*)malloc(m_block_size * m_slab_blocks);
+    if(!slab){
+        return false;
+    }
+    m_slabs.push_back(slab);
+    m_capacity.store(m_capacity.load(std::memory_order_relaxed) + m_slab_blocks, std::memory_order_relaxed);
+    //倒着串起来，取块时按地址顺序取出
+    for(int i = m_slab_blocks - 1; i >= 0; --i){
+        free_block* block = (free_block*)(slab + i * m_block_size);
+        block->next = m_free;
+        m_free = block;
+    }
+    return true;
+}
+
+char* buffer_pool::get(){
+    if(m_shared){
+        m_lock.lock();
+    }
+    free_block* block = NULL;
+    if(m_free || grow()){
+        block = m_free;
+        m_free = block->next;
+        m_in_use.store(m_in_use.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    if(m_shared){
+        m_lock.unlock();
+    }
+    return (char*)block;
+}
+
+void buffer_pool::put(char* block){
+    if(m_shared){
+        m_lock.lock();
+    }
+    free_block* node = (free_block*)block;
+    node->next = m_free;
+    m_free = node;
+    m_in_use.store(m_in_use.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+    if(m_shared){
+        m_lock.unlock();
+    }
+}
@@ -0,0 +1,50 @@
+// 缓冲区池：按固定大小的块分配连接的读写缓冲区。内存按slab（一次若干块）向系统申请，空闲块串在单链表上，
+// 取块和还块都是O(1)。连接只在有请求要处理的时候持有一块，keep-alive空闲的连接把块还回来，
+// 所以占用的内存随活跃连接数变化，而不是随最大连接数变化。
+// note：连接缓冲区的池不加锁，每个反应堆一个，只在反应堆线程中使用；链式缓冲区额外的段来自一个加锁的共享池。
+// slab在池销毁前不还给系统，池的大小停留在使用量的峰值
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <cstddef>
+#include <vector>
+#include <atomic>
+
+#include "locker.h"
+
+class buffer_pool
+{
+public:
+    //block_size是每块的字节数，slab_blocks是每次向系统申请的块数，shared为true时取块和还块加锁
+    buffer_pool(size_t block_size, int slab_blocks, bool shared = false);
+    ~buffer_pool();
+
+    //取一块，内存不足时返回NULL
+    char* get();
+    void put(char* block);
+
+    //正在使用的块数和池中总块数，可以在其他线程中读取（统计页面）
+    int in_use() const { return m_in_use.load(std::memory_order_relaxed); }
+    int capacity() const { return m_capacity.load(std::memory_order_relaxed); }
+
+private:
+    //空闲块的开头存放下一个空闲块的地址
+    struct free_block
+    {
+        free_block* next;
+    };
+    bool grow();
+
+private:
+    size_t m_block_size;
+    int m_slab_blocks;
+    std::vector<char*> m_slabs;
+    free_block* m_free;
+    //修改只发生在池的使用线程中或者锁内，用原子变量只是为了让其他线程读到完整的值
+    std::atomic<int> m_in_use;
+    std::atomic<int> m_capacity;
+    bool m_shared;
+    locker m_lock;
+};
+
+#endif
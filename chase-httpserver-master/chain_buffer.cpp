@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chain_buffer.h"
+#include "buffer_pool.h"
+
+//所有连接共用的段池，工作线程填写响应时取段，反应堆线程发送完以后还段，所以要加锁
+static buffer_pool s_segments(chain_buffer::SEGMENT_SIZE, 64, true);
+
+chain_buffer::chain_buffer(): m_count(0), m_size(0){
+}
+
+chain_buffer::~chain_buffer(){
+    clear();
+}
+
+void chain_buffer::reset(char* first, int first_size){
+    clear();
+    if(!first){
+        m_count = 0;
+        return;
+    }
+    m_data[0] = first;
+    m_cap[0] = first_size;
+    m_len[0] = 0;
+    m_count = 1;
+}
+
+void chain_buffer::clear(){
+    //第一段属于使用者，后面的段是共享段池中的段或者单独分配的大段
+    for(int i = 1; i < m_count; ++i){
+        if(m_cap[i] == SEGMENT_SIZE){
+            s_segments.put(m_data[i]);
+        }else{
+            free(m_data[i]);
+        }
+    }
+    if(m_count > 1){
+        m_count = 1;
+    }
+    if(m_count > 0){
+        m_len[0] = 0;
+    }
+    m_size = 0;
+}
+
+char* chain_buffer::reserve(int len){
+    if(m_count == 0){
+        return NULL;
+    }
+    int last = m_count - 1;
+    if(m_cap[last] - m_len[last] >= len){
+        return m_data[last] + m_len[last];
+    }
+    if(m_count == MAX_SEGMENTS){
+        return NULL;
+    }
+    char* segment;
+    int cap;
+    if(len <= SEGMENT_SIZE){
+        segment = s_segments.get();
+        cap = SEGMENT_SIZE;
+    }else{
+        segment = (char*)malloc(len);
+        cap = len;
+    }
+    if(!segment){
+        return NULL;
+    }
+    m_data[m_count] = segment;
+    m_cap[m_count] = cap;
+    m_len[m_count] = 0;
+    m_count++;
+    return segment;
+}
+
+bool chain_buffer::append_format(const char* format, va_list args){
+    if(m_count == 0){
+        return false;
+    }
+    //先试着直接写进最后一段，放不下再按算出来的长度要一段新的重新格式化
+    va_list again;
+    va_copy(again, args);
+    int last = m_count - 1;
+    int room = m_cap[last] - m_len[last];
+    int len = vsnprintf(m_data[last] + m_len[last], room, format, args);
+    if(len < 0){
+        va_end(again);
+        return false;
+    }
+    if(len < room){
+        m_len[last] += len;
+        m_size += len;
+        va_end(again);
+        return true;
+    }
+    //vsnprintf要多写一个'\0'
+    char* dest = reserve(len + 1);
+    if(!dest){
+        va_end(again);
+        return false;
+    }
+    vsnprintf(dest, len + 1, format, again);
+    va_end(again);
+    m_len[m_count - 1] += len;
+    m_size += len;
+    return true;
+}
+
+bool chain_buffer::append(const char* data, int len){
+    char* dest = reserve(len);
+    if(!dest){
+        return false;
+    }
+    memcpy(dest, data, len);
+    m_len[m_count - 1] += len;
+    m_size += len;
+    return true;
+}
+
+int chain_buffer::export_iov(struct iovec* iov) const{
+    int n = 0;
+    for(int i = 0; i < m_count; ++i){
+        if(m_len[i] > 0){
+            iov[n].iov_base = m_data[i];
+            iov[n].iov_len = m_len[i];
+            n++;
+        }
+    }
+    return n;
+}
@@ -0,0 +1,47 @@
+// 链式缓冲区：由若干段内存串起来的输出缓冲区。第一段由使用者提供（连接从缓冲区池中取得的写缓冲区），
+// 写满以后从共享的段池中取固定大小的新段接在后面，单次写入比一段还大时单独分配一段刚好放得下的大段。
+// 写进去的数据不再搬动，发送时把各段导出成iovec交给writev/sendmsg。
+// note：典型的响应头第一段就放得下，不会用到共享的段池；段数有上限，超过上限的写入返回false
+#ifndef CHAIN_BUFFER_H
+#define CHAIN_BUFFER_H
+
+#include <stdarg.h>
+#include <sys/uio.h>
+
+class chain_buffer
+{
+public:
+    //共享段池中每段的大小，以及一个缓冲区最多的段数
+    static const int SEGMENT_SIZE = 2048;
+    static const int MAX_SEGMENTS = 8;
+
+    chain_buffer();
+    ~chain_buffer();
+
+    //用first作为第一段，原有的数据和额外的段都丢掉；first为NULL时缓冲区不能写
+    void reset(char* first, int first_size);
+    //清空数据并归还额外的段，保留第一段
+    void clear();
+
+    //按printf格式追加，放不下时返回false
+    bool append_format(const char* format, va_list args);
+    bool append(const char* data, int len);
+
+    int size() const { return m_size; }
+    int segments() const { return m_count; }
+    //把有数据的段依次导出到iov中，iov至少要有MAX_SEGMENTS项，返回导出的项数
+    int export_iov(struct iovec* iov) const;
+
+private:
+    //保证最后一段有len字节的连续空间，必要时接上新段，返回写入位置
+    char* reserve(int len);
+
+private:
+    char* m_data[MAX_SEGMENTS];
+    int m_len[MAX_SEGMENTS];
+    int m_cap[MAX_SEGMENTS];
+    int m_count;
+    int m_size;
+};
+
+#endif
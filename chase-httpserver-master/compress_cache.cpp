@@ -0,0 +1,133 @@
+#include <unistd.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "compress_cache.h"
+
+compress_cache::compress_cache(long budget): m_budget(budget), m_used(0), m_hits(0), m_misses(0), m_bytes(0){
+}
+
+compress_cache::~compress_cache(){
+    m_lock.lock();
+    while(!m_lru.empty()){
+        drop(m_lru.begin());
+    }
+    m_lock.unlock();
+}
+
+bool compress_cache::compressible(const char* mime){
+    if(strncmp(mime, "text/", 5) == 0){
+        return true;
+    }
+    return strstr(mime, "javascript") || strstr(mime, "json") || strstr(mime, "xml");
+}
+
+bool compress_cache::gzip(const char* data, size_t len, std::string& out){
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    //windowBits加16表示输出带gzip头和尾的格式
+    if(deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK){
+        return false;
+    }
+    out.resize(deflateBound(&zs, len));
+    zs.next_in = (Bytef*)data;
+    zs.avail_in = len;
+    zs.next_out = (Bytef*)&out[0];
+    zs.avail_out = out.size();
+    int ret = deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return ret == Z_STREAM_END;
+}
+
+bool compress_cache::same_file(const compressed_object* object, const struct stat& st){
+    return object->ino == st.st_ino && object->dev == st.st_dev && object->size == st.st_size
+        && object->mtim.tv_sec == st.st_mtim.tv_sec && object->mtim.tv_nsec == st.st_mtim.tv_nsec;
+}
+
+compressed_object* compress_cache::acquire(const char* path, file_entry* entry){
+    if(m_budget <= 0 || entry->fd == -1 || entry->st.st_size < MIN_SIZE || entry->st.st_size > MAX_SIZE){
+        return NULL;
+    }
+    std::string key(path);
+    m_lock.lock();
+    auto found = m_index.find(key);
+    if(found != m_index.end()){
+        compressed_object* object = *found->second;
+        if(same_file(object, entry->st)){
+            //命中的条目移到LRU表头
+            m_lru.splice(m_lru.begin(), m_lru, found->second);
+            object->refs++;
+            m_lock.unlock();
+            m_hits++;
+            return object;
+        }
+        //文件已经变了，丢掉旧的压缩结果，正在发送它的连接不受影响
+        drop(found->second);
+    }
+    m_lock.unlock();
+
+    //读盘和压缩都不持有锁
+    m_misses++;
+    std::string raw;
+    raw.resize(entry->st.st_size);
+    off_t len = 0;
+    while(len < entry->st.st_size){
+        int ret = pread(entry->fd, &raw[len], entry->st.st_size - len, len);
+        if(ret <= 0){
+            return NULL;
+        }
+        len += ret;
+    }
+    compressed_object* object = new compressed_object;
+    object->refs = 1;
+    object->dev = entry->st.st_dev;
+    object->ino = entry->st.st_ino;
+    object->size = entry->st.st_size;
+    object->mtim = entry->st.st_mtim;
+    object->path = key;
+    if(!gzip(raw.data(), raw.size(), object->body) || object->body.size() >= raw.size()){
+        object->body.clear();
+    }
+    object->body.shrink_to_fit();
+
+    m_lock.lock();
+    found = m_index.find(key);
+    if(found != m_index.end()){
+        //其他线程同时压缩了同一个文件，保留和当前文件一致的那一个
+        if(same_file(*found->second, entry->st)){
+            m_lock.unlock();
+            return object;
+        }
+        drop(found->second);
+    }
+    //缓存持有一个引用，调用者持有一个引用
+    object->refs++;
+    m_lru.push_front(object);
+    m_index[key] = m_lru.begin();
+    m_used += object->body.size();
+    while(m_used > m_budget && m_lru.size() > 1){
+        auto last = m_lru.end();
+        --last;
+        drop(last);
+    }
+    m_bytes = m_used;
+    m_lock.unlock();
+    return object;
+}
+
+void compress_cache::release(compressed_object* object){
+    if(--object->refs > 0){
+        return;
+    }
+    delete object;
+}
+
+void compress_cache::drop(std::list<compressed_object*>::iterator it){
+    compressed_object* object = *it;
+    m_used -= object->body.size();
+    m_bytes = m_used;
+    m_index.erase(object->path);
+    m_lru.erase(it);
+    release(object);
+}
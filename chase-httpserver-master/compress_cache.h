@@ -0,0 +1,74 @@
+// 压缩缓存：可压缩类型（html、css、js、json、svg等）的文件在第一次被支持gzip的客户端请求时压缩一次，
+// 压缩结果缓存在内存中，之后的请求直接发送压缩好的内容。缓存按LRU淘汰，总内存不超过设定的预算。
+// note：和热点对象缓存一样，条目记录了压缩时文件的inode、大小和修改时间，和文件缓存中的stat不一致就重新压缩；
+// 压缩后没有变小的文件也会留下一个空条目，避免每次请求都白白压缩一遍
+#ifndef COMPRESS_CACHE_H
+#define COMPRESS_CACHE_H
+
+#include <sys/stat.h>
+#include <atomic>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+#include "locker.h"
+#include "file_cache.h"
+
+//缓存中的一个压缩结果
+struct compressed_object
+{
+    std::atomic<int> refs;      //引用计数，缓存本身持有一个
+    std::string body;           //gzip格式的文件内容，为空表示不值得压缩
+    //压缩时文件的身份，用来判断结果是否还有效
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtim;
+    std::string path;
+};
+
+class compress_cache
+{
+public:
+    //内容编码，也用作file_entry::variants中预压缩文件是否存在的标志位
+    enum CONTENT_ENCODING {ENCODING_GZIP = 1, ENCODING_BR = 2};
+    //太小的文件压缩得不偿失，太大的文件不在请求路径上压缩
+    static const int MIN_SIZE = 256;
+    static const int MAX_SIZE = 1024 * 1024;
+
+    //budget是缓存占用内存的上限，单位字节，为0时不做即时压缩
+    compress_cache(long budget);
+    ~compress_cache();
+
+    //获取entry对应文件的压缩结果，必要时从entry->fd读入并压缩。调用者用完后必须release。
+    //缓存关闭、文件大小不合适或读盘失败时返回NULL
+    compressed_object* acquire(const char* path, file_entry* entry);
+    void release(compressed_object* object);
+
+    //MIME类型是否值得压缩，图片、音视频和压缩包本身已经压缩过了
+    static bool compressible(const char* mime);
+    //把data压缩成gzip格式放到out中
+    static bool gzip(const char* data, size_t len, std::string& out);
+
+    long hits() const { return m_hits; }
+    long misses() const { return m_misses; }
+    long bytes() const { return m_bytes; }
+
+private:
+    static bool same_file(const compressed_object* object, const struct stat& st);
+    //把条目从缓存中摘下并释放缓存持有的引用，调用者必须持有锁
+    void drop(std::list<compressed_object*>::iterator it);
+
+private:
+    long m_budget;
+    locker m_lock;
+    long m_used;
+    //LRU链表，表头是最近使用的
+    std::list<compressed_object*> m_lru;
+    std::unordered_map<std::string, std::list<compressed_object*>::iterator> m_index;
+    std::atomic<long> m_hits;
+    std::atomic<long> m_misses;
+    std::atomic<long> m_bytes;
+};
+
+#endif
@@ -0,0 +1,96 @@
+#include "dir_cache.h"
+#include "compress_cache.h"
+
+dir_cache::dir_cache(int capacity, bool (*build)(const char* path, std::string& html)):
+            m_capacity(capacity), m_build(build), m_hits(0), m_misses(0){
+}
+
+dir_cache::~dir_cache(){
+    m_lock.lock();
+    while(!m_lru.empty()){
+        drop(m_lru.begin());
+    }
+    m_lock.unlock();
+}
+
+bool dir_cache::same_dir(const dir_listing* listing, const struct stat& st){
+    return listing->ino == st.st_ino && listing->dev == st.st_dev
+        && listing->mtim.tv_sec == st.st_mtim.tv_sec && listing->mtim.tv_nsec == st.st_mtim.tv_nsec;
+}
+
+dir_listing* dir_cache::acquire(const char* path, const struct stat& st){
+    std::string key(path);
+    if(m_capacity > 0){
+        m_lock.lock();
+        auto found = m_index.find(key);
+        if(found != m_index.end()){
+            dir_listing* listing = *found->second;
+            if(same_dir(listing, st)){
+                //命中的页面移到LRU表头
+                m_lru.splice(m_lru.begin(), m_lru, found->second);
+                listing->refs++;
+                m_lock.unlock();
+                m_hits++;
+                return listing;
+            }
+            //目录已经变了，丢掉旧页面，正在发送它的连接不受影响
+            drop(found->second);
+        }
+        m_lock.unlock();
+    }
+
+    m_misses++;
+    dir_listing* listing = new dir_listing;
+    listing->refs = 1;
+    listing->dev = st.st_dev;
+    listing->ino = st.st_ino;
+    listing->mtim = st.st_mtim;
+    listing->path = key;
+    if(!m_build(path, listing->html)){
+        delete listing;
+        return NULL;
+    }
+    if(listing->html.empty() || !compress_cache::gzip(listing->html.data(), listing->html.size(), listing->gzip)
+       || listing->gzip.size() >= listing->html.size()){
+        listing->gzip.clear();
+    }
+    if(m_capacity <= 0){
+        return listing;
+    }
+
+    m_lock.lock();
+    auto found = m_index.find(key);
+    if(found != m_index.end()){
+        //其他线程同时生成了同一个目录的页面，保留目录状态和当前一致的那一个
+        if(same_dir(*found->second, st)){
+            m_lock.unlock();
+            return listing;
+        }
+        drop(found->second);
+    }
+    //缓存持有一个引用，调用者持有一个引用
+    listing->refs++;
+    m_lru.push_front(listing);
+    m_index[key] = m_lru.begin();
+    while((int)m_lru.size() > m_capacity){
+        auto last = m_lru.end();
+        --last;
+        drop(last);
+    }
+    m_lock.unlock();
+    return listing;
+}
+
+void dir_cache::release(dir_listing* listing){
+    if(--listing->refs > 0){
+        return;
+    }
+    delete listing;
+}
+
+void dir_cache::drop(std::list<dir_listing*>::iterator it){
+    dir_listing* listing = *it;
+    m_index.erase(listing->path);
+    m_lru.erase(it);
+    release(listing);
+}
@@ -0,0 +1,65 @@
+// 目录列表缓存：缓存每个目录渲染好的HTML页面。目录的修改时间（纳秒精度）和inode没变就直接使用缓存的页面，
+// 热门目录的一次访问只是一次哈希查找；目录下增删改名文件都会更新目录的修改时间，页面随之重新生成。
+// 目录的stat来自文件缓存，所以在TTL或inotify模式下连校验用的stat都不需要。
+// 页面生成时同时压缩一份gzip版本，支持gzip的客户端直接发送压缩版本。
+// 目录项超过MAX_ENTRIES的目录不渲染页面，缓存中只留一个html为空的条目，连接看到它就改用流式目录列表，
+// 大目录重复访问时也不用每次先数一遍目录项。
+// note：页面带引用计数，连接在发送页面期间页面不会被释放
+#ifndef DIR_CACHE_H
+#define DIR_CACHE_H
+
+#include <sys/stat.h>
+#include <atomic>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+#include "locker.h"
+
+//缓存中的一个目录页面
+struct dir_listing
+{
+    std::atomic<int> refs;      //引用计数，缓存本身持有一个
+    std::string html;           //渲染好的HTML页面，为空表示目录太大，不缓存页面
+    std::string gzip;           //gzip压缩后的页面，为空表示压缩后没有变小
+    //生成页面时目录的身份和修改时间，用来判断页面是否还有效
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtim;
+    std::string path;
+};
+
+class dir_cache
+{
+public:
+    //缓存页面的目录最多的目录项数
+    static const int MAX_ENTRIES = 4096;
+
+    //capacity是最多缓存的目录数，为0时不缓存；build负责扫描目录并渲染页面，目录项太多时让html为空并返回true
+    dir_cache(int capacity, bool (*build)(const char* path, std::string& html));
+    ~dir_cache();
+
+    //获取path目录的页面，st是目录当前的状态。调用者用完后必须release，失败返回NULL
+    dir_listing* acquire(const char* path, const struct stat& st);
+    void release(dir_listing* listing);
+
+    long hits() const { return m_hits; }
+    long misses() const { return m_misses; }
+
+private:
+    static bool same_dir(const dir_listing* listing, const struct stat& st);
+    //把页面从缓存中摘下并释放缓存持有的引用，调用者必须持有锁
+    void drop(std::list<dir_listing*>::iterator it);
+
+private:
+    int m_capacity;
+    bool (*m_build)(const char* path, std::string& html);
+    locker m_lock;
+    //LRU链表，表头是最近使用的
+    std::list<dir_listing*> m_lru;
+    std::unordered_map<std::string, std::list<dir_listing*>::iterator> m_index;
+    std::atomic<long> m_hits;
+    std::atomic<long> m_misses;
+};
+
+#endif
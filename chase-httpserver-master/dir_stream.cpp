@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "dir_stream.h"
+#include "http_conn.h"
+
+//分块编码的块长度先占一个8位十六进制数的位置，块生成完再填上；块长度前面可以有多余的0
+static const char CHUNK_HEAD[] = "00000000\r\n";
+static const int CHUNK_HEAD_LEN = sizeof(CHUNK_HEAD) - 1;
+
+//HTML中的名字要转义&、<、>和双引号
+static void append_html(std::string& out, const char* text){
+    for(const char* p = text; *p; ++p){
+        switch(*p){
+            case '&': out += "&amp;"; break;
+            case '<': out += "&lt;"; break;
+            case '>': out += "&gt;"; break;
+            case '"': out += "&quot;"; break;
+            default: out += *p;
+        }
+    }
+}
+
+//JSON字符串要转义双引号、反斜杠和控制字符，其他字节原样输出
+static void append_json(std::string& out, const char* text){
+    static const char hex[] = "0123456789abcdef";
+    for(const unsigned char* p = (const unsigned char*)text; *p; ++p){
+        if(*p == '"' || *p == '\\'){
+            out += '\\';
+            out += *p;
+        }else if(*p < 0x20){
+            out += "\\u00";
+            out += hex[*p >> 4];
+            out += hex[*p & 0xf];
+        }else{
+            out += *p;
+        }
+    }
+}
+
+dir_stream::dir_stream(): m_state(HEAD), m_format(FORMAT_HTML), m_dirfd(-1), m_offset(0), m_limit(0), m_index(0),
+            m_emitted(0), m_more(false), m_dents(NULL), m_dents_len(0), m_dents_pos(0), m_eof(false){
+}
+
+dir_stream::~dir_stream(){
+    if(m_dirfd != -1){
+        close(m_dirfd);
+    }
+    delete [] m_dents;
+}
+
+bool dir_stream::open(const char* path, const char* url, FORMAT format, long offset, long limit){
+    m_dirfd = ::open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(m_dirfd < 0){
+        return false;
+    }
+    m_dents = new char[DENTS_SIZE];
+    m_url = url;
+    m_format = format;
+    m_offset = offset > 0 ? offset : 0;
+    m_limit = limit > 0 ? limit : 0;
+    return true;
+}
+
+bool dir_stream::parse_query(const char* query, FORMAT* format, long* offset, long* limit){
+    *format = FORMAT_HTML;
+    *offset = 0;
+    *limit = 0;
+    if(!query){
+        return false;
+    }
+    bool found = false;
+    const char* p = query;
+    while(*p){
+        const char* end = p + strcspn(p, "&");
+        if(strncmp(p, "format=", 7) == 0){
+            found = true;
+            if(end - p == 11 && strncmp(p + 7, "json", 4) == 0){
+                *format = FORMAT_JSON;
+            }
+        }else if(strncmp(p, "offset=", 7) == 0){
+            found = true;
+            *offset = strtol(p + 7, NULL, 10);
+        }else if(strncmp(p, "limit=", 6) == 0){
+            found = true;
+            *limit = strtol(p + 6, NULL, 10);
+        }
+        p = *end ? end + 1 : end;
+    }
+    return found;
+}
+
+struct linux_dirent64* dir_stream::next_entry(){
+    while(true){
+        if(m_dents_pos >= m_dents_len){
+            if(m_eof){
+                return NULL;
+            }
+            int nread = syscall(SYS_getdents64, m_dirfd, m_dents, DENTS_SIZE);
+            if(nread <= 0){
+                //出错时响应头已经发出去了，只能把已经读到的部分当作整个目录
+                m_eof = true;
+                return NULL;
+            }
+            m_dents_len = nread;
+            m_dents_pos = 0;
+        }
+        struct linux_dirent64* d = (struct linux_dirent64*)(m_dents + m_dents_pos);
+        m_dents_pos += d->d_reclen;
+        if(strcmp(d->d_name, ".") != 0 && strcmp(d->d_name, "..") != 0){
+            return d;
+        }
+    }
+}
+
+bool dir_stream::append_entry(std::string& out, const char* name){
+    struct stat st;
+    if(fstatat(m_dirfd, name, &st, 0) < 0 || (!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode))){
+        return false;
+    }
+    bool dir = S_ISDIR(st.st_mode);
+    char buf[64];
+    if(m_format == FORMAT_JSON){
+        out += m_emitted ? ",{\"name\":\"" : "{\"name\":\"";
+        append_json(out, name);
+        snprintf(buf, sizeof(buf), "\",\"type\":\"%s\",\"size\":%lld,\"mtime\":%lld}", dir ? "dir" : "file",
+                 (long long)st.st_size, (long long)st.st_mtime);
+        out += buf;
+    }else{
+        //和缓存的目录页面一样的表格行，链接中的名字做%编码
+        char enstr[1024];
+        http_conn::encode_str(enstr, sizeof(enstr), name);
+        out += "<tr><td><a href=\"";
+        out += enstr;
+        out += dir ? "/\">" : "\">";
+        append_html(out, name);
+        snprintf(buf, sizeof(buf), "%s</a></td><td>%lld</td></tr>", dir ? "/" : "", (long long)st.st_size);
+        out += buf;
+    }
+    m_emitted++;
+    return true;
+}
+
+void dir_stream::append_head(std::string& out){
+    if(m_format == FORMAT_JSON){
+        out += "{\"path\":\"";
+        append_json(out, m_url.c_str());
+        out += "\",\"offset\":";
+        out += std::to_string(m_offset);
+        out += ",\"entries\":[";
+    }else{
+        out += "<html><head><meta charset=\"utf-8\"><title>目录名: ";
+        append_html(out, m_url.c_str());
+        out += "</title></head><body><h1>当前目录: ";
+        append_html(out, m_url.c_str());
+        out += "</h1><table><tr><td><a href=\"../\">../</a></td><td></td></tr>";
+    }
+}
+
+void dir_stream::append_tail(std::string& out){
+    long next = m_offset + m_limit;
+    if(m_format == FORMAT_JSON){
+        out += "],\"next\":";
+        out += m_more ? std::to_string(next) : "null";
+        out += "}\n";
+    }else{
+        out += "</table>";
+        if(m_more){
+            out += "<p><a href=\"?offset=" + std::to_string(next) + "&amp;limit=" + std::to_string(m_limit)
+                   + "\">下一页</a></p>";
+        }
+        out += "</body></html>";
+    }
+}
+
+bool dir_stream::next(std::string& out){
+    if(m_state == DONE){
+        return false;
+    }
+    out.assign(CHUNK_HEAD, CHUNK_HEAD_LEN);
+    if(m_state == HEAD){
+        append_head(out);
+        m_state = BODY;
+    }
+    while(m_state == BODY && (int)out.size() < CHUNK_SIZE){
+        struct linux_dirent64* d = next_entry();
+        if(!d){
+            m_state = TAIL;
+            break;
+        }
+        //分页时limit之后再看到一项就说明还有下一页
+        if(m_limit > 0 && m_index >= m_offset + m_limit){
+            m_more = true;
+            m_state = TAIL;
+            break;
+        }
+        //offset之前的项只数不stat
+        if(m_index++ < m_offset){
+            continue;
+        }
+        append_entry(out, d->d_name);
+    }
+    bool last = m_state == TAIL;
+    if(last){
+        append_tail(out);
+    }
+    //填上块长度，块数据后面是\r\n，最后一块后面再跟结束的0长度块
+    char head[CHUNK_HEAD_LEN + 1];
+    snprintf(head, sizeof(head), "%08x\r\n", (unsigned int)(out.size() - CHUNK_HEAD_LEN));
+    memcpy(&out[0], head, CHUNK_HEAD_LEN);
+    out += last ? "\r\n0\r\n\r\n" : "\r\n";
+    if(last){
+        m_state = DONE;
+    }
+    return true;
+}
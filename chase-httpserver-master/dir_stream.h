@@ -0,0 +1,76 @@
+// 流式目录列表：边用getdents64读目录边生成页面，按HTTP分块编码（Transfer-Encoding: chunked）一块一块交给连接发送，
+// 不需要先把整个目录读完。每块只在需要发送下一块时才生成，攒够CHUNK_SIZE字节或者读完目录就交出去，
+// 所以首字节时间和内存占用都和目录大小无关：一个连接只占一块getdents缓冲区和一块输出。
+// 支持HTML和JSON两种格式，以及按offset/limit分页：
+//   /dir/?format=json                      JSON：{"path":...,"entries":[{"name","type","size","mtime"}...],"next":...}
+//   /dir/?offset=200&limit=100             从第200项开始的100项，后面还有时页面末尾给出下一页的链接，JSON给出next
+// note：目录项按getdents返回的顺序输出，不排序；目录在分页浏览期间发生变化时相邻两页可能重复或遗漏一些项。
+// 生成下一块时要读目录和stat目录项，这些操作在发送响应的线程中进行
+#ifndef DIR_STREAM_H
+#define DIR_STREAM_H
+
+#include <sys/types.h>
+#include <string>
+
+//getdents64返回的目录项，glibc没有导出这个结构
+struct linux_dirent64
+{
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+class dir_stream
+{
+public:
+    enum FORMAT {FORMAT_HTML = 0, FORMAT_JSON};
+    //一次getdents64读取的缓冲区大小
+    static const int DENTS_SIZE = 32 * 1024;
+    //一块的目标大小，攒够这么多就交出去
+    static const int CHUNK_SIZE = 16 * 1024;
+
+    dir_stream();
+    ~dir_stream();
+
+    //打开path目录，url是目录的URL（用于页面标题和分页链接）。offset是跳过的项数，limit是最多输出的项数，0表示不限制
+    bool open(const char* path, const char* url, FORMAT format, long offset, long limit);
+    //生成下一块，按分块编码放进out（原有内容被替换），最后一块后面带着结束的0长度块；之后再调用返回false
+    bool next(std::string& out);
+
+    //解析查询字符串中的format、offset和limit，有其中任何一个时返回true，表示客户端要求流式列表。query可以为NULL
+    static bool parse_query(const char* query, FORMAT* format, long* offset, long* limit);
+
+private:
+    //取下一个目录项，跳过.和..；读完或者出错时返回NULL
+    struct linux_dirent64* next_entry();
+    //把一个目录项输出成表格的一行或者JSON的一个对象，不是普通文件也不是目录时不输出，返回是否输出了
+    bool append_entry(std::string& out, const char* name);
+    void append_head(std::string& out);
+    void append_tail(std::string& out);
+
+private:
+    //HEAD  还没有输出页面开头
+    //BODY  正在输出目录项
+    //TAIL  目录项输出完了，还没有输出页面结尾
+    //DONE  所有块都已经交出去
+    enum STATE {HEAD = 0, BODY, TAIL, DONE};
+    STATE m_state;
+    FORMAT m_format;
+    int m_dirfd;
+    std::string m_url;
+    long m_offset;
+    long m_limit;
+    //已经跳过或者输出的目录项数（用于分页），以及输出了的项数
+    long m_index;
+    long m_emitted;
+    //分页时limit之后是否还有目录项
+    bool m_more;
+    char* m_dents;
+    int m_dents_len;
+    int m_dents_pos;
+    bool m_eof;
+};
+
+#endif
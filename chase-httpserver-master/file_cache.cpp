@@ -0,0 +1,280 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <stdio.h>
+#include <sys/inotify.h>
+#include <exception>
+
+#include "file_cache.h"
+
+//inotify模式下关心的事件：文件内容或属性被修改、文件被删除或改名，以及目录下的条目变化
+static const unsigned int WATCH_MASK = IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF
+                                     | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
+
+file_cache::file_cache(int capacity, INVALIDATE_MODE mode, int ttl_ms, const char* (*mime)(const char*)):
+            m_capacity(capacity), m_mode(mode), m_ttl_ms(ttl_ms), m_mime(mime),
+            m_hits(0), m_misses(0), m_inotify_fd(-1){
+    if(m_capacity > 0 && m_mode == INVALIDATE_INOTIFY){
+        m_inotify_fd = inotify_init1(IN_CLOEXEC);
+        if(m_inotify_fd < 0){
+            throw std::exception();
+        }
+        if(pthread_create(&m_watcher, NULL, watcher, this) != 0){
+            close(m_inotify_fd);
+            throw std::exception();
+        }
+    }
+}
+
+file_cache::~file_cache(){
+    if(m_inotify_fd != -1){
+        pthread_cancel(m_watcher);
+        pthread_join(m_watcher, NULL);
+    }
+    for(int i = 0; i < SHARD_NUMBER; ++i){
+        shard& s = m_shards[i];
+        s.lock.lock();
+        while(!s.lru.empty()){
+            drop(s, s.lru.begin());
+        }
+        s.lock.unlock();
+    }
+    if(m_inotify_fd != -1){
+        close(m_inotify_fd);
+    }
+}
+
+void file_cache::make_validators(const struct stat& st, char* etag, int etag_size, char* date, int date_size){
+    //修改时间精确到纳秒，同一秒内的两次修改也能区分
+    snprintf(etag, etag_size, "\"%llx-%llx-%llx\"", (unsigned long long)st.st_ino, (unsigned long long)st.st_size,
+             (unsigned long long)st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec);
+    struct tm tm;
+    gmtime_r(&st.st_mtime, &tm);
+    strftime(date, date_size, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+long long file_cache::now_ms(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+bool file_cache::variants_expired(const file_entry* entry) const{
+    return entry->variants < 0 || now_ms() - entry->variants_ms >= m_ttl_ms;
+}
+
+void file_cache::set_variants(file_entry* entry, int variants){
+    entry->variants_ms = now_ms();
+    entry->variants = variants;
+}
+
+file_cache::shard& file_cache::shard_of(const std::string& path){
+    return m_shards[std::hash<std::string>()(path) % SHARD_NUMBER];
+}
+
+//打开文件并生成一个新条目，新条目的引用计数为1，属于调用者
+file_entry* file_cache::load(const char* path){
+    struct stat st;
+    if(stat(path, &st) < 0){
+        return NULL;
+    }
+    int fd = -1;
+    //只打开所有人可读的普通文件，目录和没有权限的文件只缓存stat，由调用者决定怎么处理
+    if(S_ISREG(st.st_mode) && (st.st_mode & S_IROTH)){
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        if(fd < 0){
+            return NULL;
+        }
+        //以打开的文件为准，避免stat和open之间文件被替换
+        fstat(fd, &st);
+    }
+    file_entry* entry = new file_entry;
+    entry->refs = 1;
+    entry->fd = fd;
+    entry->st = st;
+    entry->mime = m_mime(path);
+    entry->load_ms = now_ms();
+    entry->wd = -1;
+    entry->path = path;
+    entry->variants = -1;
+    entry->variants_ms = 0;
+    make_validators(st, entry->etag, sizeof(entry->etag), entry->last_modified, sizeof(entry->last_modified));
+    if(m_inotify_fd != -1){
+        m_wd_lock.lock();
+        entry->wd = inotify_add_watch(m_inotify_fd, path, WATCH_MASK);
+        if(entry->wd >= 0){
+            m_wd_paths.insert(std::make_pair(entry->wd, entry->path));
+        }
+        m_wd_lock.unlock();
+    }
+    return entry;
+}
+
+file_entry* file_cache::acquire(const char* path){
+    if(m_capacity <= 0){
+        m_misses++;
+        return load(path);
+    }
+    std::string key(path);
+    shard& s = shard_of(key);
+
+    s.lock.lock();
+    auto found = s.index.find(key);
+    if(found != s.index.end()){
+        file_entry* entry = *found->second;
+        //命中的条目移到LRU表头
+        s.lru.splice(s.lru.begin(), s.lru, found->second);
+        entry->refs++;
+        long long now = now_ms();
+        if(m_mode == INVALIDATE_INOTIFY || now - entry->load_ms < m_ttl_ms){
+            s.lock.unlock();
+            m_hits++;
+            return entry;
+        }
+        s.lock.unlock();
+
+        //TTL过期，重新stat一次，文件没变就继续使用原来的fd
+        struct stat st;
+        if(stat(path, &st) == 0 && st.st_ino == entry->st.st_ino && st.st_dev == entry->st.st_dev
+           && st.st_size == entry->st.st_size
+           && st.st_mtim.tv_sec == entry->st.st_mtim.tv_sec && st.st_mtim.tv_nsec == entry->st.st_mtim.tv_nsec
+           && st.st_ctim.tv_sec == entry->st.st_ctim.tv_sec && st.st_ctim.tv_nsec == entry->st.st_ctim.tv_nsec){
+            entry->load_ms = now;
+            m_hits++;
+            return entry;
+        }
+        //文件已经变了，把旧条目从缓存中拿掉，正在使用它的连接不受影响
+        s.lock.lock();
+        found = s.index.find(key);
+        if(found != s.index.end() && *found->second == entry){
+            drop(s, found->second);
+        }
+        s.lock.unlock();
+        release(entry);
+    }else{
+        s.lock.unlock();
+    }
+
+    m_misses++;
+    file_entry* entry = load(path);
+    if(!entry){
+        return NULL;
+    }
+
+    s.lock.lock();
+    found = s.index.find(key);
+    if(found != s.index.end()){
+        //其他线程已经抢先加载了同一个文件，使用它的条目
+        file_entry* exist = *found->second;
+        exist->refs++;
+        s.lock.unlock();
+        release(entry);
+        return exist;
+    }
+    //缓存持有一个引用，调用者持有一个引用
+    entry->refs++;
+    s.lru.push_front(entry);
+    s.index[key] = s.lru.begin();
+    int shard_capacity = m_capacity / SHARD_NUMBER > 0 ? m_capacity / SHARD_NUMBER : 1;
+    while((int)s.lru.size() > shard_capacity){
+        auto last = s.lru.end();
+        --last;
+        drop(s, last);
+    }
+    s.lock.unlock();
+    return entry;
+}
+
+void file_cache::release(file_entry* entry){
+    if(--entry->refs > 0){
+        return;
+    }
+    if(entry->fd != -1){
+        close(entry->fd);
+    }
+    if(entry->wd >= 0){
+        //同一个文件可能被多个条目监听，最后一个条目释放时才移除watch
+        m_wd_lock.lock();
+        auto range = m_wd_paths.equal_range(entry->wd);
+        for(auto it = range.first; it != range.second; ++it){
+            if(it->second == entry->path){
+                m_wd_paths.erase(it);
+                break;
+            }
+        }
+        if(m_wd_paths.count(entry->wd) == 0){
+            inotify_rm_watch(m_inotify_fd, entry->wd);
+        }
+        m_wd_lock.unlock();
+    }
+    delete entry;
+}
+
+void file_cache::drop(shard& s, std::list<file_entry*>::iterator it){
+    file_entry* entry = *it;
+    s.index.erase(entry->path);
+    s.lru.erase(it);
+    release(entry);
+}
+
+void file_cache::invalidate(const char* path){
+    if(m_capacity <= 0){
+        return;
+    }
+    std::string key(path);
+    shard& s = shard_of(key);
+    s.lock.lock();
+    auto found = s.index.find(key);
+    if(found != s.index.end()){
+        drop(s, found->second);
+    }
+    s.lock.unlock();
+}
+
+void file_cache::invalidate_wd(int wd){
+    std::list<std::string> paths;
+    m_wd_lock.lock();
+    auto range = m_wd_paths.equal_range(wd);
+    for(auto it = range.first; it != range.second; ++it){
+        paths.push_back(it->second);
+    }
+    m_wd_lock.unlock();
+
+    for(auto p = paths.begin(); p != paths.end(); ++p){
+        shard& s = shard_of(*p);
+        s.lock.lock();
+        auto found = s.index.find(*p);
+        if(found != s.index.end() && (*found->second)->wd == wd){
+            drop(s, found->second);
+        }
+        s.lock.unlock();
+    }
+}
+
+void* file_cache::watcher(void* arg){
+    file_cache* cache = (file_cache*)arg;
+    cache->watch();
+    return cache;
+}
+
+//后台线程：阻塞读取inotify事件，使对应的条目失效
+void file_cache::watch(){
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while(true){
+        int len = read(m_inotify_fd, buf, sizeof(buf));
+        if(len <= 0){
+            if(len < 0 && errno == EINTR){
+                continue;
+            }
+            break;
+        }
+        for(char* ptr = buf; ptr < buf + len; ){
+            struct inotify_event* event = (struct inotify_event*)ptr;
+            if(!(event->mask & IN_IGNORED)){
+                invalidate_wd(event->wd);
+            }
+            ptr += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
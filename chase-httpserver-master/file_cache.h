@@ -0,0 +1,102 @@
+// 所有工作线程共享的文件描述符/stat缓存：从路径映射到已经打开的fd、struct stat和MIME类型。
+// 同一个文件被大量客户端访问时，热路径上只需要一次哈希查找，不再有stat/open/close。
+// 缓存分成若干个分片，每个分片一把互斥锁和一个LRU链表，总条目数有上限。
+// 失效方式有两种：TTL模式下条目过期后重新stat校验；inotify模式下由后台线程监听文件变化并立即失效。
+// note：条目带引用计数，被淘汰或失效的条目要等最后一个使用它的连接release之后才关闭fd
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <sys/stat.h>
+#include <pthread.h>
+#include <atomic>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+#include "locker.h"
+
+//缓存中的一个文件
+struct file_entry
+{
+    std::atomic<int> refs;      //引用计数，缓存本身持有一个
+    int fd;                     //只读打开的文件描述符，目录为-1
+    struct stat st;             //文件的状态
+    const char* mime;           //文件的MIME类型
+    std::atomic<long long> load_ms; //加载或上次校验的时间，单位毫秒
+    int wd;                     //inotify模式下的watch描述符
+    std::string path;
+    //由inode、大小和修改时间生成的强ETag，以及HTTP日期格式的Last-Modified，加载时生成一次
+    char etag[64];
+    char last_modified[32];
+    //同目录下预先压缩好的.br/.gz文件是否存在，协商内容编码时探测，超过ttl重新探测，-1表示还没有探测过
+    std::atomic<int> variants;
+    //上次探测预压缩文件的时间，单位毫秒
+    std::atomic<long long> variants_ms;
+};
+
+class file_cache
+{
+public:
+    //失效方式
+    //INVALIDATE_TTL      条目超过ttl毫秒后重新stat，文件没变就继续使用
+    //INVALIDATE_INOTIFY  用inotify监听被缓存的文件，文件被修改、删除或改名时立即失效
+    enum INVALIDATE_MODE {INVALIDATE_TTL = 0, INVALIDATE_INOTIFY};
+
+    //生成文件的ETag和Last-Modified
+    static void make_validators(const struct stat& st, char* etag, int etag_size, char* date, int date_size);
+
+    //capacity是缓存的最大条目数，为0时不缓存，每次都打开新的文件；mime用来获取文件的MIME类型
+    file_cache(int capacity, INVALIDATE_MODE mode, int ttl_ms, const char* (*mime)(const char*));
+    ~file_cache();
+
+    //获取path对应的条目，调用者用完后必须release。失败返回NULL，errno说明原因
+    file_entry* acquire(const char* path);
+    void release(file_entry* entry);
+    //path对应的文件被服务器自己改写了（比如上传），马上让缓存中的条目失效，不等TTL或inotify
+    void invalidate(const char* path);
+
+    //预压缩文件的探测结果是否需要重新探测：还没有探测过，或者已经超过ttl。兄弟文件的增删不会改变原文件的状态，
+    //inotify模式下也不在监听范围内，所以两种失效方式都按ttl重新探测
+    bool variants_expired(const file_entry* entry) const;
+    void set_variants(file_entry* entry, int variants);
+
+    long hits() const { return m_hits; }
+    long misses() const { return m_misses; }
+
+private:
+    static const int SHARD_NUMBER = 16;
+    struct shard
+    {
+        locker lock;
+        //LRU链表，表头是最近使用的
+        std::list<file_entry*> lru;
+        std::unordered_map<std::string, std::list<file_entry*>::iterator> index;
+    };
+
+    shard& shard_of(const std::string& path);
+    file_entry* load(const char* path);
+    //把条目从分片中摘下并释放缓存持有的引用，调用者必须持有分片的锁
+    void drop(shard& s, std::list<file_entry*>::iterator it);
+    //inotify模式下使所有监听在wd上的条目失效
+    void invalidate_wd(int wd);
+    static void* watcher(void* arg);
+    void watch();
+    static long long now_ms();
+
+private:
+    int m_capacity;
+    INVALIDATE_MODE m_mode;
+    int m_ttl_ms;
+    const char* (*m_mime)(const char*);
+    shard m_shards[SHARD_NUMBER];
+    std::atomic<long> m_hits;
+    std::atomic<long> m_misses;
+
+    //inotify模式下使用
+    int m_inotify_fd;
+    pthread_t m_watcher;
+    locker m_wd_lock;
+    std::unordered_multimap<int, std::string> m_wd_paths;
+};
+
+#endif
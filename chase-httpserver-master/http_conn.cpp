@@ -1,4 +1,16 @@
 #include "http_conn.h"
+#include "reactor.h"
+#include "mime_types.h"
+#include "logger.h"
+#include "metrics.h"
+#include "response_header.h"
+#include "dir_stream.h"
+#include "upload.h"
+
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <algorithm>
+#include <vector>
 
 //定义HTTP响应的一些状态信息
 const char * ok_200_title = "OK";
@@ -10,10 +22,36 @@ const char * error_404_title = "Not Found";
 const char * error_404_form = "The requested file was not fount on this server.\n";
 const char * error_500_title = "INternal Error";
 const char * error_500_form = "There was an unusual problem serving the requested file.\n";
+const char * partial_206_title = "Partial Content";
+const char * not_modified_304_title = "Not Modified";
+const char * error_416_title = "Requested Range Not Satisfiable";
+const char * error_416_form = "The requested range is not satisfiable for this file.\n";
+const char * created_201_title = "Created";
+const char * created_201_form = "Created\n";
+const char * no_content_204_title = "No Content";
+const char * error_405_title = "Method Not Allowed";
+const char * error_405_form = "Uploads are not enabled on this server.\n";
+const char * error_411_title = "Length Required";
+const char * error_411_form = "An upload needs a Content-Length or Transfer-Encoding: chunked.\n";
+const char * error_413_title = "Payload Too Large";
+const char * error_413_form = "The upload is larger than this server accepts.\n";
+
+//一个请求最多接受的区间数，防止大量细碎区间放大响应
+static const int MAX_RANGE_NUMBER = 16;
 
 
 // const char * doc_root = "/home/dir";//网站的根目录
 
+//默认用sendfile零拷贝发送文件，mmap+writev作为备选模式保留
+http_conn::FILE_SEND_MODE http_conn::m_send_mode = http_conn::SEND_SENDFILE;
+file_cache* http_conn::m_file_cache = NULL;
+object_cache* http_conn::m_object_cache = NULL;
+dir_cache* http_conn::m_dir_cache = NULL;
+compress_cache* http_conn::m_compress_cache = NULL;
+access_log* http_conn::m_access_log = NULL;
+const char* http_conn::m_stats_path = "/__stats";
+long long http_conn::m_upload_limit = -1;
+
 //设置非阻塞
 int setnonblocking(int fd){
     int old_option = fcntl(fd, F_GETFL);
@@ -53,94 +91,296 @@ void modfd(int epollfd, int fd, int ev)
     epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event);
 }
 
-int http_conn::m_user_count = 0;
-int http_conn::m_epollfd = -1;
+//把最多max个字节复制进访问记录，返回复制的长度
+static int copy_field(char* to, const char* from, int len, int max){
+    if(!from){
+        return 0;
+    }
+    if(len < 0){
+        len = strlen(from);
+    }
+    len = std::min(len, max);
+    memcpy(to, from, len);
+    return len;
+}
+
+void http_conn::request_done(){
+    if(m_status == 0){
+        return;
+    }
+    long long now = metrics::now_ns();
+    long long latency = m_request_start > 0 && now > m_request_start ? now - m_request_start : 0;
+    metrics::add_response(m_status, bytes_have_send);
+    metrics::add_latency(metrics::LATENCY_TOTAL, latency);
+    if(!m_access_log){
+        m_status = 0;
+        return;
+    }
+    access_log::record entry;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    entry.time_us = (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000 - latency / 1000;
+    entry.latency_us = latency / 1000;
+    entry.addr = m_address.sin_addr.s_addr;
+    entry.port = ntohs(m_address.sin_port);
+    entry.status = m_status;
+    entry.bytes = bytes_have_send;
+    entry.keep_alive = m_linger;
+    //请求头还没有收齐（比如请求头太大）时请求行的各段都是空的
+    const char* method = 0;
+    int method_len = 0;
+    const char* version = m_version;
+    int version_len = -1;
+    if(m_read_buf && m_parser.request_line_done()){
+        method = m_read_buf + m_parser.method().off;
+        method_len = m_parser.method().len;
+        if(!version){
+            version = m_read_buf + m_parser.version().off;
+            version_len = m_parser.version().len;
+        }
+    }else{
+        version = 0;
+    }
+    entry.method_len = copy_field(entry.method, method, method_len, access_log::METHOD_LEN);
+    //请求目标按客户端发来的原样记录；还没有被resolve_path改写时直接取读缓冲区中的原文
+    const char* url = 0;
+    int url_len = 0;
+    if(!m_log_target.empty()){
+        url = m_log_target.data();
+        url_len = m_log_target.size();
+    }else if(method){
+        url = m_read_buf + m_parser.target().off;
+        url_len = m_parser.target().len;
+    }
+    entry.url_len = copy_field(entry.url, url, url_len, access_log::URL_LEN);
+    entry.version_len = copy_field(entry.version, version, version_len, access_log::VERSION_LEN);
+    entry.referer_len = copy_field(entry.referer, m_referer, -1, access_log::REFERER_LEN);
+    entry.agent_len = copy_field(entry.agent, m_user_agent, -1, access_log::AGENT_LEN);
+    m_access_log->append(entry);
+    m_status = 0;
+}
 
 void http_conn::close_conn(bool real_close){
     if(real_close && (m_sockfd != -1)){
-        removefd(m_epollfd, m_sockfd);
+        //响应没发完连接就断了，也要留下一条记录
+        request_done();
+        //连接可能在文件发送到一半时被关闭，要把文件映射区或文件描述符一并释放
+        unmap();
+        detach_buffer();
+        if(m_pipe[0] != -1){
+            close(m_pipe[0]);
+            close(m_pipe[1]);
+            m_pipe[0] = m_pipe[1] = -1;
+        }
+        m_reactor->remove_timer(this);
+        if(reactor::m_backend == reactor::BACKEND_URING){
+            close(m_sockfd);
+        }else{
+            removefd(m_epollfd, m_sockfd);
+        }
         m_sockfd = -1;
         //关闭一个连接客户数减1；
-        m_user_count--;
+        m_reactor->m_user_count--;
     }
 }
 
-void http_conn::init(int sockfd, const sockaddr_in& addr){
+void http_conn::init(int sockfd, const sockaddr_in& addr, reactor* owner){
+    m_reactor = owner;
+    m_epollfd = owner->epollfd();
+    m_last_worker = -1;
     m_sockfd = sockfd;
     m_address = addr;
+    timer_wheel::init_node(&m_timer, this);
+    m_timer_kind = reactor::TIMEOUT_HEADER;
     //信道复用
     int reuse = 1;
     setsockopt(m_sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
-    addfd(m_epollfd, sockfd, true);
-    m_user_count++;
+    //io_uring后端不使用epoll，读写事件由反应堆直接提交
+    if(reactor::m_backend == reactor::BACKEND_EPOLL){
+        addfd(m_epollfd, sockfd, true);
+    }
+    m_reactor->m_user_count++;
+    m_file_address = 0;
+    m_file_entry = 0;
+    m_object = 0;
+    m_compressed = 0;
+    m_listing = 0;
+    m_dir_stream = 0;
+    m_upload = 0;
+    m_file_fd = -1;
+    m_pipe[0] = m_pipe[1] = -1;
+    m_pipe_bytes = 0;
+    m_uring_inflight = 0;
+    m_uring_error = false;
+    m_read_idx = 0;
+    m_request_end = 0;
+    m_request_start = 0;
+    m_enqueue_ns = 0;
 
     init();
 }
 
+bool http_conn::attach_buffer(){
+    char* block = m_reactor->buffers()->get();
+    if(!block){
+        return false;
+    }
+    m_block = block;
+    m_read_buf = block;
+    m_read_size = READ_BUFFER_SIZE;
+    m_write_buf.reset(block + READ_BUFFER_SIZE, WRITE_BUFFER_SIZE);
+    m_real_file = block + READ_BUFFER_SIZE + WRITE_BUFFER_SIZE;
+    m_real_file[0] = '\0';
+    return true;
+}
+
+void http_conn::detach_buffer(){
+    if(!m_block){
+        return;
+    }
+    if(m_read_buf != m_block){
+        free(m_read_buf);
+    }
+    m_write_buf.reset(NULL, 0);
+    m_reactor->buffers()->put(m_block);
+    m_block = m_read_buf = m_real_file = 0;
+    m_read_size = 0;
+}
+
+bool http_conn::grow_read_buffer(){
+    int size = m_read_size * 2;
+    if(size > MAX_READ_BUFFER_SIZE){
+        return false;
+    }
+    char* buf = (char*)malloc(size);
+    if(!buf){
+        return false;
+    }
+    memcpy(buf, m_read_buf, m_read_idx);
+    char** parsed[] = {&m_url, &m_query, &m_version, &m_host, &m_range, &m_if_range, &m_if_none_match, &m_if_modified_since,
+                       &m_referer, &m_user_agent, &m_transfer_encoding};
+    for(size_t i = 0; i < sizeof(parsed) / sizeof(parsed[0]); ++i){
+        if(*parsed[i]){
+            *parsed[i] = buf + (*parsed[i] - m_read_buf);
+        }
+    }
+    if(m_read_buf != m_block){
+        free(m_read_buf);
+    }
+    m_read_buf = buf;
+    m_read_size = size;
+    return true;
+}
+
+//把io_uring收到的数据追加到读缓冲区，缓冲区放不下时返回false
+bool http_conn::feed(const char* data, int len){
+    if(!m_block && !attach_buffer()){
+        return false;
+    }
+    if(m_read_idx == 0){
+        m_request_start = metrics::now_ns();
+    }
+    while(m_read_idx + len > m_read_size){
+        if(!grow_read_buffer()){
+            return false;
+        }
+    }
+    memcpy(m_read_buf + m_read_idx, data, len);
+    m_read_idx += len;
+    return true;
+}
+
+//重新关注连接上的读或写事件：epoll后端修改内核事件表，io_uring后端把连接交回反应堆
+void http_conn::rearm(int ev){
+    if(reactor::m_backend == reactor::BACKEND_URING){
+        m_reactor->notify(this, ev);
+    }else{
+        modfd(m_epollfd, m_sockfd, ev);
+    }
+}
+
 void http_conn::init(){
      m_check_state = CHECK_STATE_REQUESTLINE;
     m_linger = false;
  
     m_method = GET;
     m_url = 0;
+    m_query = 0;
     m_version = 0;
-    m_content_length = 0;
+    m_content_length = -1;
+    m_transfer_encoding = 0;
+    m_expect_continue = false;
     m_host = 0;
-    m_start_line = 0;
+    m_referer = 0;
+    m_user_agent = 0;
+    m_log_target.clear();
+    m_status = 0;
+    m_parse_ns = 0;
     m_checked_idx = 0;
-    m_read_idx = 0;
-    m_write_idx = 0;
+    m_parser.reset();
+    m_write_buf.clear();
     bytes_have_send = 0;
     bytes_to_send = 0;
-    memset( m_read_buf, '\0', READ_BUFFER_SIZE );
-    memset( m_write_buf, '\0', WRITE_BUFFER_SIZE );
-    memset( m_real_file, '\0', FILENAME_LEN );
-}
-
-////从状态机，用于解析一行内容
-http_conn::LINE_STATUS http_conn::parse_line(){
-    char temp;
-    //checked_index指向buffer（应用程序的读缓冲区）中正在分析的字节，read_index指向buffer中客户数据的尾部的下一字节。
-    //buffer中第0-checked_index字节都已分析完毕，第checked_index-(read_index - 1)字节由下面循环挨个分析
-    for(; m_checked_idx < m_read_idx; ++m_checked_idx){
-        //获取当前要分析的字节
-        temp = m_read_buf[m_checked_idx];
-        //如果当前的字节是\r即回车符，说明可能读到一个完整的行
-        if(temp == '\r'){
-            //如果\r是buffer中最后一个已经被读入的客户数据，那么这次分析没有读到一个完整的行，返回LINE_OPEN表示还需要继续读取才能解析
-            if((m_checked_idx + 1) == m_read_idx){
-                return LINE_OPEN;
-            }else if(m_read_buf[m_checked_idx + 1] == '\n'){
-                //如果下一字符是\n，说明读到一个完整行
-                m_read_buf[m_checked_idx++] = '\0';
-                m_read_buf[m_checked_idx++] = '\0';
-                return LINE_OK;
-            }
-            //说明客户发送的HTTP请求存在语法问题
-            return LINE_BAD;
-        }else if (temp == '\n'){
-            /* 读到一个\n，换行符也说明可能读到一个完整的行 */
-            if((m_checked_idx > 1) && (m_read_buf[m_checked_idx - 1] == '\r')){
-                m_read_buf[m_checked_idx-1] = '\0';
-                m_read_buf[m_checked_idx++]   = '\0';
-                return LINE_OK;
-            }
-            return LINE_BAD;
-        }
-    }
-    //没读到\r\n说明还得继续读
-    return LINE_OPEN;
+    //流水线：读缓冲区中上一个请求后面已经收到的字节属于下一个请求，把它们移到缓冲区开头留下来
+    int left = 0;
+    if(m_request_end > 0 && m_request_end < m_read_idx){
+        left = m_read_idx - m_request_end;
+        if(m_read_buf != m_block && left <= READ_BUFFER_SIZE){
+            //扩大过的读缓冲区在剩下的字节放得回原来的缓冲区时就释放掉
+            memcpy(m_block, m_read_buf + m_request_end, left);
+            free(m_read_buf);
+            m_read_buf = m_block;
+            m_read_size = READ_BUFFER_SIZE;
+        }else{
+            memmove(m_read_buf, m_read_buf + m_request_end, left);
+        }
+    }
+    m_read_idx = left;
+    m_request_end = 0;
+    //流水线上的下一个请求从现在开始计时
+    if(left > 0){
+        m_request_start = metrics::now_ns();
+    }
+    //没有流水线上的后续请求时把缓冲区还给池，空闲的keep-alive连接不占用缓冲区。
+    //解析只看[0, m_read_idx)；响应头由固定片段memcpy进写缓冲区，按记录的长度发送，不依赖结尾的'\0'，所以不需要清零缓冲区
+    if(left == 0){
+        detach_buffer();
+    }
+    m_range = 0;
+    m_if_range = 0;
+    m_if_none_match = 0;
+    m_if_modified_since = 0;
+    m_accept_encoding = 0;
+    m_content_encoding = 0;
+    m_vary = false;
+    m_ranges.clear();
+    m_range_index = 0;
+    //统计页面很少被请求，用完就把内存还回去
+    if(!m_generated.empty()){
+        std::string().swap(m_generated);
+    }
 }
 
 //循环读取客户数据，知道无数据可读或者对方关闭连接
 bool http_conn::read(){
-    if(m_read_idx >= READ_BUFFER_SIZE){
+    //上传的消息体由工作线程直接从socket搬进文件，这里不收
+    if(m_upload){
+        return true;
+    }
+    if(!m_block && !attach_buffer()){
         return false;
     }
+    if(m_read_idx == 0){
+        m_request_start = metrics::now_ns();
+    }
 
     int bytes_read = 0;
     while(true){
-        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
+        //读缓冲区满了就扩大，已经到最大还放不下的请求只能关闭连接
+        if(m_read_idx >= m_read_size && !grow_read_buffer()){
+            return false;
+        }
+        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, m_read_size - m_read_idx, 0);
         if(bytes_read == -1){
             if(errno == EAGAIN || errno == EWOULDBLOCK){
                 break;
@@ -154,42 +394,32 @@ bool http_conn::read(){
     return true;
 }
 
-//解析HTTP请求行，获得请求方法、目标URL，以及HTTP版本号
-http_conn::HTTP_CODE http_conn::parse_request_line(char* text){
-    //请求行组成  请求 -- url --- 协议
-    //找到空格位置，匹配第一个空格，空格后面对应的就是url
-    m_url = strpbrk(text ," \t");
-    //如果请求行中没有空白字符或"\t字符，则HTTP请求必有问题
-    if(!m_url){
-        return BAD_REQUEST;
-    }
-    //将找到的空格位置写\0， 并将url指针自增1，指向真正url
-    *m_url++ = '\0';
-
-    //method指回到请求头的第一个位置
-    char* method = text;
-    //和GET进行匹配
-    if(strcasecmp(method, "GET") == 0){
-        printf("The request method is GET\n");
+//解析HTTP请求行，获得请求方法、目标URL，以及HTTP版本号。请求行已经由解析器切分好了
+http_conn::HTTP_CODE http_conn::parse_request_line(){
+    http_parser::span method = m_parser.method();
+    //和GET进行匹配，PUT和POST用于上传
+    if(method.len == 3 && strncasecmp(m_read_buf + method.off, "GET", 3) == 0){
+        LOG_DEBUG("The request method is GET");
         m_method = GET;
+    }else if(method.len == 3 && strncasecmp(m_read_buf + method.off, "PUT", 3) == 0){
+        m_method = PUT;
+    }else if(method.len == 4 && strncasecmp(m_read_buf + method.off, "POST", 4) == 0){
+        m_method = POST;
     }else{
         return BAD_REQUEST;
     }
-
-    // strspn 检索字符串 str1 中第一个不在字符串 str2 中出现的字符下标
-    m_url += strspn(m_url, " \t");
-    //匹配从url开始的第一个空格，空格后面的就是version
-    m_version = strpbrk(m_url, " \t");
-    if(!m_version){
-        return BAD_REQUEST;
-    }
-    *m_version++ = '\0';
-    m_version += strspn(m_version, " \t");
     //仅支持HTTP/1.1
-    if(strcasecmp(m_version, "HTTP/1.1") != 0){
-        printf("协议为HTTP/1.1");
+    http_parser::span version = m_parser.version();
+    if(version.len != 8 || strncasecmp(m_read_buf + version.off, "HTTP/1.1", 8) != 0){
+        LOG_DEBUG("unsupported version %.*s", version.len, m_read_buf + version.off);
         return BAD_REQUEST;
     }
+    //url和版本号后面是空白或者行尾的\r，都属于已经解析完的请求头，在那里补上结尾交给后面的字符串函数
+    http_parser::span target = m_parser.target();
+    m_url = m_read_buf + target.off;
+    m_url[target.len] = '\0';
+    m_version = m_read_buf + version.off;
+    m_version[version.len] = '\0';
     //检查url是否合法
     if(strncasecmp(m_url, "http://", 7) == 0){
         m_url += 7;
@@ -199,102 +429,152 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char* text){
     if(!m_url || m_url[0] != '/'){
         return BAD_REQUEST;
     }
-    printf("The request URL is : %s\n", m_url);
-    //HTTP请求行处理完毕，状态转移到头部字段的分析
-    m_check_state = CHECK_STATE_HEADER;
+    LOG_DEBUG("The request URL is : %s", m_url);
     return NO_REQUEST;
 }
 
-//解析HTTP请求的一个头部信息
-http_conn::HTTP_CODE http_conn::parse_headers(char* text){
-    //遇到一个空行，说明我们得到了一个正确的HTTP请求
-    if(text[0] == '\0'){
-        //如果HTTP请求有消息体，则还需要读取m_content_length字节的消息体，
-        //状态机转移到CHECK_STATE_CONTENT状态
-        if(m_content_length != 0){
-            m_check_state = CHECK_STATE_CONTENT;
-            return NO_REQUEST;
+//Accept-Encoding: gzip, deflate, br;q=1.0, *;q=0
+//只关心gzip和br，q=0表示明确拒绝这种编码
+static int parse_accept_encoding(const char* text){
+    int mask = 0;
+    const char* p = text;
+    while(*p){
+        p += strspn(p, " \t,");
+        const char* name = p;
+        size_t len = strcspn(p, " \t,;");
+        p += len;
+        p += strspn(p, " \t");
+        bool refused = false;
+        if(*p == ';'){
+            ++p;
+            p += strspn(p, " \t");
+            if(strncasecmp(p, "q=", 2) == 0){
+                refused = atof(p + 2) == 0;
+            }
+            p += strcspn(p, ",");
+        }
+        if(refused || len == 0){
+            continue;
+        }
+        if(len == 4 && strncasecmp(name, "gzip", 4) == 0){
+            mask |= compress_cache::ENCODING_GZIP;
+        }else if(len == 2 && strncasecmp(name, "br", 2) == 0){
+            mask |= compress_cache::ENCODING_BR;
+        }else if(len == 1 && name[0] == '*'){
+            mask |= compress_cache::ENCODING_GZIP | compress_cache::ENCODING_BR;
+        }
+    }
+    return mask;
+}
+
+//逐个处理解析器切分出来的头部字段
+void http_conn::parse_headers(){
+    for(int i = 0; i < m_parser.field_count(); ++i){
+        const http_parser::field& field = m_parser.field_at(i);
+        const char* name = m_read_buf + field.name.off;
+        int len = field.name.len;
+        //值后面是空白或者行尾的\r，补上结尾以后可以直接当C字符串用
+        char* text = m_read_buf + field.value.off;
+        text[field.value.len] = '\0';
+        switch(http_parser::header_id(name, len)){
+            case http_parser::HEADER_HOST:
+                //处理host头部字段
+                m_host = text;
+                LOG_DEBUG("the request host is:%s", text);
+                break;
+            case http_parser::HEADER_CONNECTION:
+                //处理Connection头部字段
+                if(strcasecmp(text, "keep-alive") == 0){
+                    m_linger = true;
+                }
+                break;
+            case http_parser::HEADER_CONTENT_LENGTH:
+                m_content_length = strtoll(text, NULL, 10);
+                break;
+            case http_parser::HEADER_RANGE:
+                m_range = text;
+                break;
+            case http_parser::HEADER_IF_RANGE:
+                m_if_range = text;
+                break;
+            case http_parser::HEADER_ACCEPT_ENCODING:
+                m_accept_encoding = parse_accept_encoding(text);
+                break;
+            case http_parser::HEADER_IF_NONE_MATCH:
+                m_if_none_match = text;
+                break;
+            case http_parser::HEADER_IF_MODIFIED_SINCE:
+                m_if_modified_since = text;
+                break;
+            case http_parser::HEADER_REFERER:
+                m_referer = text;
+                break;
+            case http_parser::HEADER_USER_AGENT:
+                m_user_agent = text;
+                break;
+            case http_parser::HEADER_TRANSFER_ENCODING:
+                m_transfer_encoding = text;
+                break;
+            case http_parser::HEADER_EXPECT:
+                m_expect_continue = strcasecmp(text, "100-continue") == 0;
+                break;
+            default:
+                LOG_DEBUG("oop! unknow header %.*s", len, name);
+                break;
         }
-        return GET_REQUEST;
-    }else if(strncasecmp(text, "Host:", 5) == 0){  //比较temp前五个字母
-        //处理host头部字段
-        //跳过host:
-        text += 5;
-        // 检索字符串 str1 中第一个不在字符串 str2 中出现的字符下标
-        text += strspn(text, "\t");
-        printf("the request host is:%s\n", text);
-    }else if(strncasecmp(text, "Connection:", 11) == 0){
-        //处理Connection头部字段
-        text += 11;
-        text += strspn(text, " \t");
-        if(strcasecmp(text, "keep-alive") == 0){
-            m_linger = true;
-        }
-    }else if(strncasecmp(text, "Content-Length:", 15) == 0){
-        text += 15;
-        text += strspn(text, " \t");
-        m_content_length = atol(text);
-    }else{
-        printf("oop! unknow header %s\n", text);
     }
-    return NO_REQUEST;
 }
 
 //没有真正解析HTTP请求的消息体，只是读入完整的消息体
-http_conn::HTTP_CODE http_conn::parse_content(char* text){
+http_conn::HTTP_CODE http_conn::parse_content(){
     if(m_read_idx >= (m_content_length + m_checked_idx)){
-        text[ m_content_length ] = '\0';
+        //消息体后面可能紧跟着流水线上的下一个请求，不能在这里写入'\0'
         return GET_REQUEST;
     }
     return NO_REQUEST;
 }
 
-//主状态机
+//主状态机：请求头由解析器增量地扫描，收齐以后再处理请求行和各个头部字段，然后等待消息体
 http_conn::HTTP_CODE http_conn::process_read(){
-    //buffer装着从客户端读来的内容，read_index是截止到哪， check_index代表从哪开始分析
-    LINE_STATUS line_status = LINE_OK;  //记录当前行的读取状态
-    HTTP_CODE ret = NO_REQUEST;    //记录HTTP请求的处理结果
-    char* text = 0;
-    //主状态机，用于从buffer中取出所有完整的行
-    while((m_check_state == CHECK_STATE_CONTENT) && (line_status == LINE_OK) || (line_status = parse_line()) == LINE_OK){
-        //如果返回ok了，那么就代表拿到了完整的一行请求，并且这行请求以/0结尾
-        text = get_line();                 //return m_read_buf + m_start_line;也就是当分析轮次的初始位置
-        m_start_line = m_checked_idx;        //记录下一行的起始状态（因为m_checked_idx已经指向下一行数据的第一个位置了）
-        //checkstate记录当前主状态机当前的状态
-        switch (m_check_state)
-        {
-            case CHECK_STATE_REQUESTLINE:{
-                //第一个状态， 分析请求行
-                ret = parse_request_line(text);
-                if(ret == BAD_REQUEST){
-                    return BAD_REQUEST;
-                }
-                break;
-            }
-            case CHECK_STATE_HEADER:{   
-                //第二个状态，分析头部字段
-                ret = parse_headers(text);
-                if(ret == BAD_REQUEST){
-                    return BAD_REQUEST;
-                }else if(ret == GET_REQUEST){
-                    return do_request();
-                }
-                break;
-            } 
-            case CHECK_STATE_CONTENT:{
-                ret = parse_content(text);
-                if(ret == GET_REQUEST){
-                    return do_request();
-                }
-                line_status = LINE_OPEN; //还需要继续读
-                break;
-            }
-            default:{
-                return INTERNAL_ERROR;
+    //上传的消息体不放在读缓冲区里，收到多少就搬多少进文件
+    if(m_upload){
+        return pump_upload();
+    }
+    if(m_check_state != CHECK_STATE_CONTENT){
+        http_parser::PARSE_RESULT result = m_parser.parse(m_read_buf, m_read_idx);
+        if(result == http_parser::PARSE_ERROR){
+            return BAD_REQUEST;
+        }
+        if(result == http_parser::PARSE_INCOMPLETE){
+            //请求头还没收全，需要继续读取客户数据
+            if(m_parser.request_line_done()){
+                m_check_state = CHECK_STATE_HEADER;
             }
+            m_parse_ns += metrics::now_ns() - m_parse_start;
+            return NO_REQUEST;
+        }
+        if(parse_request_line() == BAD_REQUEST){
+            return BAD_REQUEST;
         }
+        parse_headers();
+        //解析时间包括请求头分几次收到时之前每一轮的扫描，不包括后面找文件
+        metrics::add_latency(metrics::LATENCY_PARSE, m_parse_ns + metrics::now_ns() - m_parse_start);
+        //m_checked_idx指向消息体的第一个字节
+        m_checked_idx = m_parser.head_length();
+        if(m_method != GET){
+            return start_upload();
+        }
+        if(m_content_length <= 0){
+            m_request_end = m_checked_idx;
+            return do_request();
+        }
+        //如果HTTP请求有消息体，则还需要读取m_content_length字节的消息体，状态机转移到CHECK_STATE_CONTENT状态
+        m_check_state = CHECK_STATE_CONTENT;
+    }
+    if(parse_content() == GET_REQUEST){
+        m_request_end = m_checked_idx + m_content_length;
+        return do_request();
     }
-    //若没有读取到 一个完整行，则表示害需要继续读取客户数据才能进一步分析
     return NO_REQUEST;
 }
 
@@ -349,14 +629,18 @@ void http_conn::decode_str(char *to, char *from)
     *to = '\0';
 }
 
-//当得到一个完整的、正确的HTTP请求时，我们就分析目标文件的属性。如果目标文件存在、对所有用户可读，且不是目录，则使用mmap将
-//其映射到内存地址m_file_address处，并告诉调用者获取文件成功
-http_conn::HTTP_CODE http_conn::do_request(){
-    // strcpy(m_real_file, doc_root);
-    // int len = strlen(doc_root);
-    //char *strncpy(char *dest, const char *src, size_t n) 把 src 所指向的字符串复制到 dest，最多复制 n 个字符。
-    //当 src 的长度小于 n 时，dest 的剩余部分将用空字节填充。
-    printf("m_url:%s\n", m_url);
+void http_conn::resolve_path(){
+    if(m_access_log){
+        http_parser::span target = m_parser.target();
+        int len = target.len < access_log::URL_LEN ? target.len : access_log::URL_LEN;
+        m_log_target.assign(m_read_buf + target.off, len);
+    }
+    //查询字符串不属于路径，在解码之前分开，文件名中的?在URL里是%3F
+    char* query = strchr(m_url, '?');
+    if(query){
+        *query = '\0';
+        m_query = query + 1;
+    }
 
     // 转码 将不能识别的中文乱码 -> 中文
     // 解码 %23 %34 %5f
@@ -364,53 +648,603 @@ http_conn::HTTP_CODE http_conn::do_request(){
 
     // strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
     strncpy(m_real_file, m_url + 1, FILENAME_LEN - 1);
-    printf("m_real_file:%s\n", m_real_file);
+    //缓冲区来自池，没有清零，路径太长被截断时要自己补上结尾
+    m_real_file[FILENAME_LEN - 1] = '\0';
+    LOG_DEBUG("m_real_file:%s", m_real_file);
     char dirDialog[5] = "./";
     // 如果没有指定访问的资源, 默认显示资源目录中的内容
     if(strcmp(m_url, "/") == 0) {    
         // file的值, 资源目录的当前位置
         strncpy(m_real_file, dirDialog, FILENAME_LEN - 1);
-        printf("dirpath = %s\n", m_real_file);
+        LOG_DEBUG("dirpath = %s", m_real_file);
     }
+}
 
-    if(stat(m_real_file, &m_file_stat) < 0){
+//上传的请求头收齐以后检查请求，在目标文件同目录下打开临时文件。上传失败时消息体没有读完，连接上后面的字节无法再解析，
+//所以错误响应都不保持连接
+http_conn::HTTP_CODE http_conn::start_upload(){
+    if(m_upload_limit < 0){
+        m_linger = false;
+        return METHOD_NOT_ALLOWED;
+    }
+    bool chunked = false;
+    if(m_transfer_encoding){
+        //只支持chunked，其他的传输编码没法确定消息体在哪里结束
+        if(strcasecmp(m_transfer_encoding, "chunked") != 0){
+            m_linger = false;
+            return BAD_REQUEST;
+        }
+        chunked = true;
+    }else if(m_content_length < 0){
+        m_linger = false;
+        return LENGTH_REQUIRED;
+    }
+    if(!chunked && m_upload_limit > 0 && m_content_length > m_upload_limit){
+        m_linger = false;
+        return PAYLOAD_TOO_LARGE;
+    }
+    //路径太长会被截断成另一个文件名，上传时不能这样做
+    if(strlen(m_url) >= FILENAME_LEN){
+        m_linger = false;
+        return FORBIDDEN_REQUEST;
+    }
+    resolve_path();
+    if(!upload::valid_target(m_real_file)){
+        m_linger = false;
+        return FORBIDDEN_REQUEST;
+    }
+    m_upload = new upload();
+    if(!m_upload->open(m_real_file, chunked ? -1 : m_content_length, m_upload_limit)){
+        int err = errno;
+        delete m_upload;
+        m_upload = 0;
+        m_linger = false;
+        if(err == ENOENT || err == ENOTDIR){
+            return NO_RESOURCE;
+        }
+        return err == EACCES || err == ELOOP ? FORBIDDEN_REQUEST : INTERNAL_ERROR;
+    }
+    //客户端在等100 Continue才发消息体；已经收到消息体时说明客户端没有等
+    if(m_expect_continue && m_read_idx == m_checked_idx){
+        static const char continue_100[] = "HTTP/1.1 100 Continue\r\n\r\n";
+        send(m_sockfd, continue_100, sizeof(continue_100) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+    }
+    m_check_state = CHECK_STATE_CONTENT;
+    return pump_upload();
+}
+
+//先把读缓冲区中已经收到的消息体写进文件。epoll后端再直接从socket收：块数据和Content-Length的消息体用splice搬进文件，
+//分块编码的长度行收到读缓冲区中请求头的后面解析。读缓冲区只在请求头后面暂存一轮收到的数据，内存占用和消息体大小无关。
+//一轮最多搬UPLOAD_ROUND_BYTES字节，socket暂时没有数据或者搬够了就返回NO_REQUEST，把连接交回反应堆等下一次可读；
+//客户端发得比磁盘写得快时数据留在socket的接收缓冲区，TCP窗口自然地让客户端慢下来。
+//io_uring后端由反应堆收数据，收到的字节追加在读缓冲区中，这里只处理读缓冲区
+http_conn::HTTP_CODE http_conn::pump_upload(){
+    int used = m_upload->consume(m_read_buf + m_checked_idx, m_read_idx - m_checked_idx);
+    m_checked_idx += used;
+    if(reactor::m_backend == reactor::BACKEND_EPOLL){
+        long long moved = 0;
+        int head = m_parser.head_length();
+        while(!m_upload->done() && m_upload->error() == upload::ERROR_NONE && moved < UPLOAD_ROUND_BYTES){
+            if(m_upload->direct_bytes() > 0 && m_upload->can_splice()){
+                int ret = m_upload->splice_from(m_sockfd);
+                if(ret > 0){
+                    moved += ret;
+                    continue;
+                }
+                //socket不支持splice时改用下面的recv；没有数据、对方关闭或者失败时结束这一轮，失败的原因已经记在m_upload中
+                if(ret == 0 || m_upload->can_splice()){
+                    break;
+                }
+            }
+            //上一轮的数据都已经写进文件，从请求头后面开始收
+            m_read_idx = m_checked_idx = head;
+            if(m_read_idx >= m_read_size && !grow_read_buffer()){
+                m_linger = false;
+                return INTERNAL_ERROR;
+            }
+            int bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, m_read_size - m_read_idx, 0);
+            if(bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+                break;
+            }
+            if(bytes_read <= 0){
+                m_linger = false;
+                return BAD_REQUEST;
+            }
+            m_read_idx += bytes_read;
+            moved += bytes_read;
+            m_checked_idx += m_upload->consume(m_read_buf + m_checked_idx, bytes_read);
+        }
+    }
+    upload::ERROR error = m_upload->error();
+    if(error != upload::ERROR_NONE){
+        delete m_upload;
+        m_upload = 0;
+        m_linger = false;
+        if(error == upload::ERROR_TOO_LARGE){
+            return PAYLOAD_TOO_LARGE;
+        }
+        return error == upload::ERROR_IO ? INTERNAL_ERROR : BAD_REQUEST;
+    }
+    if(!m_upload->done()){
+        //读缓冲区中的数据都写进了文件，只留下请求头
+        m_read_idx = m_checked_idx = m_parser.head_length();
+        return NO_REQUEST;
+    }
+    //消息体后面可能紧跟着流水线上的下一个请求
+    m_request_end = m_checked_idx;
+    bool created = false;
+    bool ok = m_upload->commit(&created);
+    delete m_upload;
+    m_upload = 0;
+    if(!ok){
+        m_linger = false;
+        return INTERNAL_ERROR;
+    }
+    //文件缓存中可能还留着旧文件的fd和状态
+    m_file_cache->invalidate(m_real_file);
+    return created ? UPLOAD_CREATED : UPLOAD_REPLACED;
+}
+
+//当得到一个完整的、正确的HTTP请求时，我们就分析目标文件的属性。如果目标文件存在、对所有用户可读，且不是目录，则使用mmap将
+//其映射到内存地址m_file_address处，并告诉调用者获取文件成功
+http_conn::HTTP_CODE http_conn::do_request(){
+    // strcpy(m_real_file, doc_root);
+    // int len = strlen(doc_root);
+    //char *strncpy(char *dest, const char *src, size_t n) 把 src 所指向的字符串复制到 dest，最多复制 n 个字符。
+    //当 src 的长度小于 n 时，dest 的剩余部分将用空字节填充。
+    LOG_DEBUG("m_url:%s", m_url);
+
+    //统计页面不对应文件，汇总各线程的指标当场生成
+    if(m_stats_path){
+        size_t len = strlen(m_stats_path);
+        if(strncmp(m_url, m_stats_path, len) == 0 && (m_url[len] == '\0' || m_url[len] == '?')){
+            if(strstr(m_url + len, "format=json")){
+                metrics::render_json(m_generated);
+                m_file_type = "application/json";
+            }else{
+                metrics::render_prometheus(m_generated);
+                m_file_type = "text/plain; version=0.0.4";
+            }
+            return STATS_REQUEST;
+        }
+    }
+
+    resolve_path();
+
+    //从共享的文件缓存中取出文件的fd、状态和MIME类型，命中时不再有stat和open
+    m_file_entry = m_file_cache->acquire(m_real_file);
+    if(!m_file_entry){
         return NO_RESOURCE;
     }
-    if(!(m_file_stat.st_mode & S_IROTH)){
+    m_file_stat = m_file_entry->st;
+    if(!(m_file_stat.st_mode & S_IROTH) || (S_ISREG(m_file_stat.st_mode) && m_file_entry->fd == -1)){
+        unmap();
         return FORBIDDEN_REQUEST;
     }
     if(S_ISDIR(m_file_stat.st_mode)){
+        unmap();
         //这里应该发送一个页面过去，页面中展示目录下的所有文件和目录
-        printf("%s m_real_file\n", m_real_file);
+        LOG_DEBUG("%s is a directory", m_real_file);
         //对应文件的话应该把目录内容的地址指向m_file_address, 这里我觉得可以用数组来替代char buf[];
 
         return IS_DIR;
     }
-    printf("%s m_real_file\n", m_real_file);
-    int fd = open(m_real_file, O_RDONLY);
-    m_file_address = (char*)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-    close(fd);
+    //MIME类型也从缓存中取，process_write不用再解析扩展名
+    m_file_type = m_file_entry->mime;
+    memcpy(m_etag, m_file_entry->etag, sizeof(m_etag));
+    memcpy(m_last_modified, m_file_entry->last_modified, sizeof(m_last_modified));
+    //可压缩的文件先协商内容编码，条件请求要和最终发送的那个版本的ETag比较
+    negotiate_encoding();
+    //客户端缓存的文件仍然有效时只回应头部，不读也不发送文件内容
+    if(not_modified()){
+        unmap();
+        return NOT_MODIFIED;
+    }
+    //空文件不需要发送消息体
+    if(m_file_stat.st_size == 0){
+        unmap();
+        return FILE_REQUEST;
+    }
+    if(m_compressed){
+        //即时压缩的结果在内存中，不再需要原文件；压缩版本不支持Range，总是完整发送
+        m_file_cache->release(m_file_entry);
+        m_file_entry = 0;
+        return FILE_REQUEST;
+    }
+    if(m_range && !parse_range()){
+        unmap();
+        return RANGE_NOT_SATISFIABLE;
+    }
+    //小文件优先从热点对象缓存中取，命中时响应头和文件内容都已经在内存中准备好了。
+    //预先压缩好的文件不走热点对象缓存，它预先拼好的响应头里没有Content-Encoding
+    if(!m_content_encoding){
+        m_object = m_object_cache->acquire(m_real_file, m_file_entry);
+    }
+    if(m_object){
+        m_file_cache->release(m_file_entry);
+        m_file_entry = 0;
+        return FILE_REQUEST;
+    }
+    if(m_send_mode == SEND_SENDFILE){
+        //sendfile模式下只借用缓存中的文件描述符，由write()按偏移量把文件内容直接从页缓存发到socket，
+        //sendfile不修改文件自身的读写位置，所以多个连接可以同时使用同一个fd
+        m_file_fd = m_file_entry->fd;
+        m_file_offset = 0;
+        m_file_end = m_file_stat.st_size;
+        return FILE_REQUEST;
+    }
+    m_file_address = (char*)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, m_file_entry->fd, 0);
+    //映射建立以后就不再需要文件描述符了
+    m_file_cache->release(m_file_entry);
+    m_file_entry = 0;
+    if(m_file_address == MAP_FAILED){
+        m_file_address = 0;
+        return INTERNAL_ERROR;
+    }
     return FILE_REQUEST;
 }
 
-//对内存映射区执行munmap操作
+void http_conn::negotiate_encoding(){
+    if(!S_ISREG(m_file_stat.st_mode) || !compress_cache::compressible(m_file_type)){
+        return;
+    }
+    //可压缩类型的响应内容随Accept-Encoding变化，不管这次是否压缩都要告诉缓存
+    m_vary = true;
+    if(!m_accept_encoding){
+        return;
+    }
+    //同目录下预先压缩好的兄弟文件的探测结果跟着原文件的缓存条目走，超过ttl重新探测，兄弟文件后来增删也能发现
+    int variants = m_file_entry->variants;
+    char sibling[FILENAME_LEN + 4];
+    if(m_file_cache->variants_expired(m_file_entry)){
+        variants = 0;
+        struct stat st;
+        snprintf(sibling, sizeof(sibling), "%s.br", m_real_file);
+        if(stat(sibling, &st) == 0 && S_ISREG(st.st_mode) && (st.st_mode & S_IROTH)){
+            variants |= compress_cache::ENCODING_BR;
+        }
+        snprintf(sibling, sizeof(sibling), "%s.gz", m_real_file);
+        if(stat(sibling, &st) == 0 && S_ISREG(st.st_mode) && (st.st_mode & S_IROTH)){
+            variants |= compress_cache::ENCODING_GZIP;
+        }
+        m_file_cache->set_variants(m_file_entry, variants);
+    }
+    static const struct { int encoding; const char* suffix; const char* name; } candidates[] = {
+        {compress_cache::ENCODING_BR, "br", "br"},
+        {compress_cache::ENCODING_GZIP, "gz", "gzip"},
+    };
+    for(int i = 0; i < 2; ++i){
+        if(!(variants & m_accept_encoding & candidates[i].encoding)){
+            continue;
+        }
+        snprintf(sibling, sizeof(sibling), "%s.%s", m_real_file, candidates[i].suffix);
+        file_entry* entry = m_file_cache->acquire(sibling);
+        if(!entry){
+            continue;
+        }
+        if(!S_ISREG(entry->st.st_mode) || entry->fd == -1){
+            m_file_cache->release(entry);
+            continue;
+        }
+        //改为发送兄弟文件，MIME类型仍然是原文件的，ETag和Last-Modified是兄弟文件自己的
+        m_file_cache->release(m_file_entry);
+        m_file_entry = entry;
+        m_file_stat = entry->st;
+        memcpy(m_etag, entry->etag, sizeof(m_etag));
+        memcpy(m_last_modified, entry->last_modified, sizeof(m_last_modified));
+        m_content_encoding = candidates[i].name;
+        return;
+    }
+    //没有预先压缩好的文件，即时压缩并缓存结果
+    if(!(m_accept_encoding & compress_cache::ENCODING_GZIP)){
+        return;
+    }
+    m_compressed = m_compress_cache->acquire(m_real_file, m_file_entry);
+    if(!m_compressed){
+        return;
+    }
+    if(m_compressed->body.empty()){
+        m_compress_cache->release(m_compressed);
+        m_compressed = 0;
+        return;
+    }
+    //压缩版本是另一个表示，ETag要和原文件区分开
+    size_t len = strlen(m_etag);
+    if(len >= 2 && len + 3 < sizeof(m_etag)){
+        strcpy(m_etag + len - 1, "-gz\"");
+    }
+    m_content_encoding = "gzip";
+}
+
+//If-None-Match优先于If-Modified-Since；If-None-Match按弱比较，忽略W/前缀
+bool http_conn::not_modified(){
+    if(m_if_none_match){
+        if(strcmp(m_if_none_match, "*") == 0){
+            return true;
+        }
+        size_t len = strlen(m_etag);
+        const char* p = m_if_none_match;
+        while(*p){
+            p += strspn(p, " \t,");
+            if(strncmp(p, "W/", 2) == 0){
+                p += 2;
+            }
+            if(strncmp(p, m_etag, len) == 0 && (p[len] == '\0' || p[len] == ',' || p[len] == ' ' || p[len] == '\t')){
+                return true;
+            }
+            p = strchr(p, ',');
+            if(!p){
+                break;
+            }
+        }
+        return false;
+    }
+    if(m_if_modified_since){
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        if(!strptime(m_if_modified_since, "%a, %d %b %Y %H:%M:%S GMT", &tm)){
+            return false;
+        }
+        return m_file_stat.st_mtime <= timegm(&tm);
+    }
+    return false;
+}
+
+//Range: bytes=0-499,1000-,-500
+//语法错误时忽略整个Range头部发送完整文件，超出文件范围的区间丢掉，一个可满足的区间都没有时返回false
+bool http_conn::parse_range(){
+    off_t size = m_file_stat.st_size;
+    //If-Range的校验器和文件当前的不一致，说明客户端手里的部分内容已经过期，发送完整文件。
+    //实体标签要求强比较（W/开头的弱标签永远不匹配），日期要求和Last-Modified完全一致
+    if(m_if_range){
+        const char* validator = m_if_range[0] == '"' ? m_etag : m_last_modified;
+        if(strcmp(m_if_range, validator) != 0){
+            return true;
+        }
+    }
+    if(strncasecmp(m_range, "bytes=", 6) != 0){
+        return true;
+    }
+    char* p = m_range + 6;
+    bool any = false;
+    while(*p){
+        p += strspn(p, " \t");
+        off_t start, end;
+        char* stop;
+        if(*p == '-'){
+            //后缀区间：最后N个字节
+            long long n = strtoll(p + 1, &stop, 10);
+            if(stop == p + 1 || n < 0){
+                m_ranges.clear();
+                return true;
+            }
+            start = n >= size ? 0 : size - n;
+            end = size;
+            if(n == 0){
+                start = end;
+            }
+        }else{
+            long long first = strtoll(p, &stop, 10);
+            if(stop == p || *stop != '-' || first < 0){
+                m_ranges.clear();
+                return true;
+            }
+            p = stop + 1;
+            if(*p == ',' || *p == '\0' || *p == ' '){
+                end = size;
+                stop = p;
+            }else{
+                long long last = strtoll(p, &stop, 10);
+                if(stop == p || last < first){
+                    m_ranges.clear();
+                    return true;
+                }
+                end = last + 1 < size ? last + 1 : size;
+            }
+            start = first;
+        }
+        p = stop;
+        p += strspn(p, " \t");
+        if(*p == ','){
+            ++p;
+        }else if(*p != '\0'){
+            m_ranges.clear();
+            return true;
+        }
+        any = true;
+        if(start >= end){
+            continue;
+        }
+        if((int)m_ranges.size() >= MAX_RANGE_NUMBER){
+            //区间太多时不再按区间发送
+            m_ranges.clear();
+            return true;
+        }
+        byte_range range;
+        range.start = start;
+        range.end = end;
+        m_ranges.push_back(range);
+    }
+    return !any || !m_ranges.empty();
+}
+
+//扫描目录并渲染目录页面，目录列表缓存未命中时调用。
+//用getdents64一次读出一大批目录项，而不是scandir逐项分配内存；每一项再用fstatat取大小
+bool http_conn::build_dir_listing(const char* path, std::string& html){
+    int dirfd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(dirfd < 0){
+        return false;
+    }
+    std::vector<std::string> names;
+    char dents[32768];
+    while(true){
+        int nread = syscall(SYS_getdents64, dirfd, dents, sizeof(dents));
+        if(nread < 0){
+            close(dirfd);
+            return false;
+        }
+        if(nread == 0){
+            break;
+        }
+        for(int pos = 0; pos < nread; ){
+            struct linux_dirent64* d = (struct linux_dirent64*)(dents + pos);
+            names.push_back(d->d_name);
+            pos += d->d_reclen;
+        }
+        //目录太大，不读完也不渲染，由连接流式发送
+        if((int)names.size() > dir_cache::MAX_ENTRIES){
+            close(dirfd);
+            html.clear();
+            return true;
+        }
+    }
+    //和scandir+alphasort一样按名字排序
+    std::sort(names.begin(), names.end());
+
+    // 拼一个html页面<table></table>
+    char buf[4096];
+    snprintf(buf, sizeof(buf), "<html><head><title>目录名: %s</title></head><body><h1>当前目录: %s</h1><table>", path, path);
+    html = buf;
+
+    char enstr[1024] = {0};
+    for(size_t i = 0; i < names.size(); ++i){
+        const char* name = names[i].c_str();
+        struct stat st;
+        if(fstatat(dirfd, name, &st, 0) < 0){
+            continue;
+        }
+        //编码生成 %E5 %A7 之类的东西
+        encode_str(enstr, sizeof(enstr), name);
+        // 如果是文件
+        if(S_ISREG(st.st_mode)) {
+            snprintf(buf, sizeof(buf), "<tr><td><a href=\"%s\">%s</a></td><td>%ld</td></tr>",
+                     enstr, name, (long)st.st_size);
+        } else if(S_ISDIR(st.st_mode)) {		// 如果是目录
+            snprintf(buf, sizeof(buf), "<tr><td><a href=\"%s/\">%s/</a></td><td>%ld</td></tr>",
+                     enstr, name, (long)st.st_size);
+        } else {
+            continue;
+        }
+        html += buf;
+    }
+    close(dirfd);
+    html += "</table></body></html>";
+    return true;
+}
+
+//对内存映射区执行munmap操作，sendfile模式下则把借用的文件缓存条目还回去
 void http_conn::unmap(){
     if(m_file_address){
         munmap(m_file_address, m_file_stat.st_size);
         m_file_address = 0;
     }
+    if(m_file_entry){
+        m_file_cache->release(m_file_entry);
+        m_file_entry = 0;
+    }
+    if(m_object){
+        m_object_cache->release(m_object);
+        m_object = 0;
+    }
+    if(m_compressed){
+        m_compress_cache->release(m_compressed);
+        m_compressed = 0;
+    }
+    if(m_listing){
+        m_dir_cache->release(m_listing);
+        m_listing = 0;
+    }
+    if(m_dir_stream){
+        delete m_dir_stream;
+        m_dir_stream = 0;
+    }
+    //没有收完的上传删掉临时文件
+    if(m_upload){
+        delete m_upload;
+        m_upload = 0;
+    }
+    m_file_fd = -1;
+}
+
+//响应发送完毕，根据HTTP请求中的Connection字段决定是继续监听这个连接还是关闭它
+bool http_conn::write_done(){
+    request_done();
+    unmap();
+    if (m_linger){
+        init();
+        //读缓冲区里留着流水线上的下一个请求时由反应堆直接交给线程池，不用等EPOLLIN
+        if(!has_pipelined()){
+            modfd(m_epollfd, m_sockfd, EPOLLIN);
+        }
+        return true;
+    }
+    //监听socket设置了SO_LINGER{1, 0}，直接close会用RST丢弃内核发送缓冲区中还没发出去的数据，
+    //这里响应已经完整交给内核，关掉强制退出，让内核把剩下的数据发完再优雅关闭
+    struct linger tmp = {0, 0};
+    setsockopt(m_sockfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
+    return false;
+}
+
+//sendfile模式下发送文件：先用MSG_MORE发送响应头，让内核把它和随后的文件内容合并成满的TCP报文段，
+//再根据m_file_offset用sendfile从页缓存直接把文件发到socket，不经过用户态
+bool http_conn::write_file(){
+    ssize_t temp = 0;
+    while(1){
+        int first = 0;
+        while(first < m_iv_count && m_iv[first].iov_len == 0){
+            ++first;
+        }
+        if(first < m_iv_count){
+            //后面还有文件内容或者还有下一个区间时才用MSG_MORE，否则最后一段头部会被滞留
+            bool more = m_file_end > m_file_offset || m_range_index + 1 < (int)m_ranges.size();
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = m_iv + first;
+            msg.msg_iovlen = m_iv_count - first;
+            temp = sendmsg(m_sockfd, &msg, more ? MSG_MORE : 0);
+        }else{
+            temp = sendfile(m_sockfd, m_file_fd, &m_file_offset, bytes_to_send);
+            if(temp == 0){
+                //文件在发送过程中被截断了，剩下的内容再也发不出去，只能关闭连接
+                unmap();
+                return false;
+            }
+        }
+        if(temp < 0){
+            if(errno == EAGAIN){
+                modfd(m_epollfd, m_sockfd, EPOLLOUT);
+                return true;
+            }
+            unmap();
+            return false;
+        }
+        bytes_have_send += temp;
+        bytes_to_send -= temp;
+        if(first < m_iv_count){
+            consume_iov(temp);
+        }
+        if(bytes_to_send <= 0 && !next_part()){
+            return write_done();
+        }
+    }
 }
 
 //写HTTP相应
 bool http_conn::write(){
-    int temp = 0;
+    ssize_t temp = 0;
     // int bytes_have_send = 0;
     // int bytes_to_send = m_write_idx;
     if(bytes_to_send == 0){
-        modfd(m_epollfd, m_sockfd, EPOLLIN);
+        request_done();
         init();
+        if(!has_pipelined()){
+            modfd(m_epollfd, m_sockfd, EPOLLIN);
+        }
         return true;
     }
+    if(m_file_fd != -1){
+        return write_file();
+    }
     while(1){
         // temp = writev(m_sockfd, m_iv, m_iv_count);
         // if(temp <= -1){
@@ -447,37 +1281,17 @@ bool http_conn::write(){
             unmap();
             return false;
         }
-        printf("写了多少数据%d\n", temp);
+        LOG_DEBUG("写了多少数据%zd", temp);
         //读了temp字节数的文件
         bytes_have_send += temp;
         //已经temp字节数的文件
         bytes_to_send -= temp;
-        //如果可以发送的字节大于爆头，证明报头发送完毕
-        if(bytes_have_send >= m_iv[0].iov_len){
-            //报头长度清零
-            m_iv[0].iov_len = 0;
-            /*这行代码：因为m_write_idx表示为待发送文件的定位点，m_iv[0]指向m_write_buf，
-            所以bytes_have_send（已发送的数据量） - m_write_idx（已发送完的报头中的数据量）
-            就等于剩余发送文件映射区的起始位置*/
-            m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);
-            m_iv[1].iov_len = bytes_to_send;
-        }else{
-            m_iv[0].iov_base = m_write_buf + bytes_have_send;
-            m_iv[0].iov_len = m_iv[0].iov_len - bytes_have_send;
-        }
-        if (bytes_to_send <= 0)
+        consume_iov(temp);
+        if (bytes_to_send <= 0 && !next_part())
         {
-            printf("写完了\n");
+            LOG_DEBUG("写完了");
             //发送完毕，恢复默认值以便下次继续传输文件
-            unmap();
-            modfd(m_epollfd, m_sockfd, EPOLLIN);
-
-            if (m_linger){
-                init();
-                return true;
-            }else{
-                return false;
-            }
+            return write_done();
         }
 
     }
@@ -485,101 +1299,103 @@ bool http_conn::write(){
 
 }
 
-//向写缓冲中写入待发送的数据
-bool http_conn::add_reponse(const char* format, ...){
-    if(m_write_idx >= WRITE_BUFFER_SIZE){
-        return false;
+//按这次写出去的字节数依次推进各个内存块，报头发完后长度清零，再推进消息体。
+//m_iv中的内存块可能是写缓冲区的各段和mmap映射区，也可能是热点对象缓存中预先拼好的响应头和文件内容
+void http_conn::consume_iov(ssize_t bytes){
+    for(int i = 0; i < m_iv_count && bytes > 0; ++i){
+        if(bytes >= (ssize_t)m_iv[i].iov_len){
+            bytes -= m_iv[i].iov_len;
+            m_iv[i].iov_len = 0;
+        }else{
+            m_iv[i].iov_base = (char*)m_iv[i].iov_base + bytes;
+            m_iv[i].iov_len -= bytes;
+            bytes = 0;
+        }
     }
+}
+
+//向写缓冲中写入待发送的数据，第一段写满时链式缓冲区自动接上新段
+bool http_conn::add_reponse(const char* format, ...){
     //VA_LIST 是在C语言中解决变参问题的一组宏，变参问题是指参数的个数不定，可以是传入一个参数也可以是多个;
     //可变参数中的每个参数的类型可以不同,也可以相同;可变参数的每个参数并没有实际的名称与之相对应，用起来是很灵活
     //定义一具VA_LIST型的变量，这个变量是指向参数的指针
     va_list arg_list;
     //用VA_START宏初始化变量刚定义的VA_LIST变量
     va_start(arg_list, format);
-    int len = vsnprintf(m_write_buf + m_write_idx, WRITE_BUFFER_SIZE - 1 - m_write_idx, format, arg_list);
-    if(len >= (WRITE_BUFFER_SIZE - 1 - m_write_idx)){
-        return false;
-    }
-    m_write_idx += len;
+    bool ret = m_write_buf.append_format(format, arg_list);
     //用VA_END宏结束可变参数的获取
     va_end(arg_list);
-    return true;
+    return ret;
 }
 
-// 通过文件名获取文件的类型
+// 通过文件名获取文件的类型，查的是MIME类型表
 const char * http_conn::get_file_type(const char *name)
 {
-    const char* dot;
-
-    // 自右向左查找‘.’字符, 如不存在返回NULL
-    dot = strrchr(name, '.');   
-    if (dot == NULL)
-        return "text/plain; charset=utf-8";
-    if (strcmp(dot, ".html") == 0 || strcmp(dot, ".htm") == 0)
-        return "text/html; charset=utf-8";
-    if (strcmp(dot, ".jpg") == 0 || strcmp(dot, ".jpeg") == 0)
-        return "image/jpeg";
-    if (strcmp(dot, ".gif") == 0)
-        return "image/gif";
-    if (strcmp(dot, ".png") == 0)
-        return "image/png";
-    if (strcmp(dot, ".css") == 0)
-        return "text/css";
-    if (strcmp(dot, ".au") == 0)
-        return "audio/basic";
-    if (strcmp( dot, ".wav" ) == 0)
-        return "audio/wav";
-    if (strcmp(dot, ".avi") == 0)
-        return "video/x-msvideo";
-    if (strcmp(dot, ".mov") == 0 || strcmp(dot, ".qt") == 0)
-        return "video/quicktime";
-    if (strcmp(dot, ".mpeg") == 0 || strcmp(dot, ".mpe") == 0)
-        return "video/mpeg";
-    if (strcmp(dot, ".vrml") == 0 || strcmp(dot, ".wrl") == 0)
-        return "model/vrml";
-    if (strcmp(dot, ".midi") == 0 || strcmp(dot, ".mid") == 0)
-        return "audio/midi";
-    if (strcmp(dot, ".mp3") == 0)
-        return "audio/mpeg";
-    if (strcmp(dot, ".ogg") == 0)
-        return "application/ogg";
-    if (strcmp(dot, ".pac") == 0)
-        return "application/x-ns-proxy-autoconfig";
-
-    return "text/plain; charset=utf-8";
-}
-
-//将请求行加入到写缓冲区
+    return mime_types::lookup(name);
+}
+
+bool http_conn::add_text(const char* text){
+    return m_write_buf.append(text, strlen(text));
+}
+
+bool http_conn::add_number(long long value){
+    char buf[response_header::NUMBER_LEN];
+    return m_write_buf.append(buf, response_header::format_number(buf, value));
+}
+
+//将请求行加入到写缓冲区，常用状态码的状态行是预先拼好的，后面紧跟当前线程缓存的Date头部
 bool http_conn::add_status_line(int status, const char* title){
-    return add_reponse( "%s %d %s\r\n", "HTTP/1.1", status, title );
+    m_status = status;
+    int len;
+    const char* line = response_header::status_line(status, &len);
+    bool ret = line ? m_write_buf.append(line, len) : add_reponse("%s %d %s\r\n", "HTTP/1.1", status, title);
+    const char* date = response_header::date(&len);
+    return ret && m_write_buf.append(date, len);
 }
 
-bool http_conn::add_headers(int content_len, const char* type){
-    add_content_type(type);
-    add_content_length( content_len );
-    add_linger();
-    add_blank_line();
+bool http_conn::add_headers(long long content_len, const char* type){
+    return add_content_type(type) && add_content_length(content_len) && add_linger() && add_blank_line();
 }
 
-bool http_conn::add_content_length(int content_len){
-    return add_reponse("Content-Length: %d\r\n", content_len);
+bool http_conn::add_content_length(long long content_len){
+    return append_literal(m_write_buf, "Content-Length: ") && add_number(content_len)
+           && append_literal(m_write_buf, "\r\n");
 }
 
 bool http_conn::add_linger(){
-    return add_reponse("Connection: %s\r\n", (m_linger == true) ? "keep-alive" : "close");
+    int len;
+    const char* text = response_header::connection(m_linger, &len);
+    return m_write_buf.append(text, len);
 }
 
 bool http_conn::add_blank_line(){
-    return add_reponse("%s", "\r\n");
+    return append_literal(m_write_buf, "\r\n");
 }
 
 bool http_conn::add_content_type(const char* type){
-    printf("Content-Type:%s\n", type);
-    return add_reponse("Content-Type:%s\r\n", type);
+    LOG_DEBUG("Content-Type:%s", type);
+    return append_literal(m_write_buf, "Content-Type:") && add_text(type) && append_literal(m_write_buf, "\r\n");
+}
+
+bool http_conn::add_encoding(){
+    if(m_content_encoding && !(append_literal(m_write_buf, "Content-Encoding: ") && add_text(m_content_encoding)
+                               && append_literal(m_write_buf, "\r\n"))){
+        return false;
+    }
+    if(m_vary){
+        return append_literal(m_write_buf, "Vary: Accept-Encoding\r\n");
+    }
+    return true;
+}
+
+bool http_conn::add_validators(){
+    return append_literal(m_write_buf, "ETag: ") && add_text(m_etag)
+           && append_literal(m_write_buf, "\r\nLast-Modified: ") && add_text(m_last_modified)
+           && append_literal(m_write_buf, "\r\n");
 }
 
 bool http_conn::add_content(const char* content){
-    return add_reponse( "%s", content );
+    return add_text(content);
 }
 
 
@@ -625,121 +1441,320 @@ bool http_conn::process_write(HTTP_CODE ret){
             break;
         }
         case FILE_REQUEST:{
+            if(m_object && m_ranges.empty()){
+                //热点对象缓存命中：状态行和Date写进写缓冲区，后面跟预先拼好的其余响应头和文件内容，
+                //这两块都是不可变的共享内存
+                add_status_line(200, ok_200_title);
+                const std::string& header = m_object->header[m_linger ? 1 : 0];
+                int n = export_headers();
+                m_iv[n].iov_base = (char*)header.data();
+                m_iv[n].iov_len = header.size();
+                m_iv[n + 1].iov_base = m_object->body;
+                m_iv[n + 1].iov_len = m_object->body_len;
+                m_iv_count = n + 2;
+                bytes_to_send = m_write_buf.size() + header.size() + m_object->body_len;
+                return true;
+            }
+            if(m_compressed){
+                //即时压缩的结果
+                add_status_line(200, ok_200_title);
+                add_validators();
+                add_encoding();
+                add_headers(m_compressed->body.size(), m_file_type);
+                set_file_body(0, m_compressed->body.size());
+                return true;
+            }
+            if(m_file_stat.st_size != 0 && m_ranges.size() == 1){
+                //单个区间：206加Content-Range，消息体只是文件的一段
+                const byte_range& range = m_ranges[0];
+                add_status_line(206, partial_206_title);
+                append_literal(m_write_buf, "Accept-Ranges: bytes\r\nContent-Range: bytes ");
+                add_number(range.start);
+                append_literal(m_write_buf, "-");
+                add_number(range.end - 1);
+                append_literal(m_write_buf, "/");
+                add_number(m_file_stat.st_size);
+                append_literal(m_write_buf, "\r\n");
+                add_validators();
+                add_encoding();
+                add_headers(range.end - range.start, m_file_type);
+                set_file_body(range.start, range.end);
+                return true;
+            }
+            if(m_file_stat.st_size != 0 && m_ranges.size() > 1){
+                //多个区间：multipart/byteranges，每个区间前面有分隔行和自己的Content-Range，最后是结束分隔行
+                char boundary[48];
+                snprintf(boundary, sizeof(boundary), "chase%llx%llx", (unsigned long long)m_file_stat.st_ino,
+                         (unsigned long long)m_file_stat.st_mtim.tv_sec * 1000000000ULL + m_file_stat.st_mtim.tv_nsec);
+                long long length = 0;
+                char head[256];
+                for(size_t i = 0; i < m_ranges.size(); ++i){
+                    byte_range& range = m_ranges[i];
+                    snprintf(head, sizeof(head), "%s--%s\r\nContent-Type: %s\r\nContent-Range: bytes %lld-%lld/%lld\r\n\r\n",
+                             i == 0 ? "" : "\r\n", boundary, m_file_type, (long long)range.start,
+                             (long long)range.end - 1, (long long)m_file_stat.st_size);
+                    range.head = head;
+                    length += range.head.size() + (range.end - range.start);
+                }
+                byte_range last;
+                last.start = last.end = 0;
+                snprintf(head, sizeof(head), "\r\n--%s--\r\n", boundary);
+                last.head = head;
+                length += last.head.size();
+                m_ranges.push_back(last);
+
+                snprintf(head, sizeof(head), "multipart/byteranges; boundary=%s", boundary);
+                add_status_line(206, partial_206_title);
+                append_literal(m_write_buf, "Accept-Ranges: bytes\r\n");
+                add_validators();
+                add_encoding();
+                add_headers(length, head);
+                //第一个区间的头部直接跟在响应头后面
+                if(!m_write_buf.append(m_ranges[0].head.data(), m_ranges[0].head.size())){
+                    return false;
+                }
+                m_range_index = 0;
+                set_file_body(m_ranges[0].start, m_ranges[0].end);
+                return true;
+            }
             add_status_line(200, ok_200_title);
             if(m_file_stat.st_size != 0){
-                printf("进到这个if里面了\n");
-                add_headers(m_file_stat.st_size, get_file_type(m_real_file));
-                m_iv[0].iov_base = m_write_buf;  //读缓冲区全是应答头
-                m_iv[0].iov_len = m_write_idx;
-                m_iv[1].iov_base = m_file_address;  //mmap映射的文件，也就是客户请求要看的文件
-                m_iv[1].iov_len = m_file_stat.st_size;
-                m_iv_count = 2;
-                //下一行 为优化新增 保证还需要传入的数据量准确无误
-                bytes_to_send = m_write_idx + m_file_stat.st_size;//还需传入的数据字节
+                append_literal(m_write_buf, "Accept-Ranges: bytes\r\n");
+                add_validators();
+                add_encoding();
+                add_headers(m_file_stat.st_size, m_file_type);
+                set_file_body(0, m_file_stat.st_size);
                 return true;
             }else{
-                printf("进到这个else里面了\n");
                 const char* ok_string = "<html><body></body></html>";
+                add_validators();
                 add_headers(strlen(ok_string), get_file_type(".html"));
                 if(!add_content(ok_string)){
                     return false;
                 }
             }
+            break;
+        }
+        case NOT_MODIFIED:{
+            //304没有消息体，只带校验器
+            add_status_line(304, not_modified_304_title);
+            add_validators();
+            add_encoding();
+            add_linger();
+            add_blank_line();
+            break;
+        }
+        case RANGE_NOT_SATISFIABLE:{
+            add_status_line(416, error_416_title);
+            append_literal(m_write_buf, "Content-Range: bytes */");
+            add_number(m_file_stat.st_size);
+            append_literal(m_write_buf, "\r\n");
+            add_headers(strlen(error_416_form), get_file_type(".html"));
+            if(!add_content(error_416_form)){
+                return false;
+            }
+            break;
+        }
+        case UPLOAD_CREATED:{
+            add_status_line(201, created_201_title);
+            add_headers(strlen(created_201_form), get_file_type(".html"));
+            if(!add_content(created_201_form)){
+                return false;
+            }
+            break;
+        }
+        case UPLOAD_REPLACED:{
+            //204没有消息体
+            add_status_line(204, no_content_204_title);
+            add_linger();
+            add_blank_line();
+            break;
+        }
+        case METHOD_NOT_ALLOWED:{
+            add_status_line(405, error_405_title);
+            append_literal(m_write_buf, "Allow: GET\r\n");
+            add_headers(strlen(error_405_form), get_file_type(".html"));
+            if(!add_content(error_405_form)){
+                return false;
+            }
+            break;
+        }
+        case LENGTH_REQUIRED:{
+            add_status_line(411, error_411_title);
+            add_headers(strlen(error_411_form), get_file_type(".html"));
+            if(!add_content(error_411_form)){
+                return false;
+            }
+            break;
+        }
+        case PAYLOAD_TOO_LARGE:{
+            add_status_line(413, error_413_title);
+            add_headers(strlen(error_413_form), get_file_type(".html"));
+            if(!add_content(error_413_form)){
+                return false;
+            }
+            break;
+        }
+        case STATS_REQUEST:{
+            add_status_line(200, ok_200_title);
+            append_literal(m_write_buf, "Cache-Control: no-store\r\n");
+            add_headers(m_generated.size(), m_file_type);
+            int n = export_headers();
+            m_iv[n].iov_base = (char*)m_generated.data();
+            m_iv[n].iov_len = m_generated.size();
+            m_iv_count = n + 1;
+            bytes_to_send = m_write_buf.size() + m_generated.size();
+            return true;
         }
         case IS_DIR:{
+            //要求分页或者JSON时边读目录边发送
+            dir_stream::FORMAT format;
+            long offset, limit;
+            if(dir_stream::parse_query(m_query, &format, &offset, &limit)){
+                return start_dir_stream(format, offset, limit);
+            }
+            //目录页面从目录列表缓存中取，目录没有变化时不再扫描目录
+            m_listing = m_dir_cache->acquire(m_real_file, m_file_stat);
+            if(!m_listing){
+                return false;
+            }
+            //目录太大，缓存中只记了不缓存页面，也改成边读目录边发送
+            if(m_listing->html.empty()){
+                m_dir_cache->release(m_listing);
+                m_listing = 0;
+                return start_dir_stream(dir_stream::FORMAT_HTML, 0, 0);
+            }
+            LOG_DEBUG("dir message send OK");
             add_status_line(200, ok_200_title);
-            //确定要发送的大小
-            //把协议头装进去
-            int i, ret;
-            
-            // 拼一个html页面<table></table>
-            char buf[4096] = {0};
-
-            sprintf(buf, "<html><head><title>目录名: %s</title></head>", m_real_file);
-            sprintf(buf+strlen(buf), "<body><h1>当前目录: %s</h1><table>", m_real_file);
-
-            char enstr[1024] = {0};
-            char path[1024] = {0};
-            
-            // 目录项二级指针
-            struct dirent** ptr;
-            int num = scandir(m_real_file, &ptr, NULL, alphasort);
-            
-            // 遍历
-            for(i = 0; i < num; ++i) {
-            
-                char* name = ptr[i]->d_name;
-
-                // 拼接文件的完整路径
-                sprintf(path, "%s/%s", m_real_file, name);
-                printf("path = %s ===================\n", path);
-                struct stat st;
-                stat(path, &st);
-
-                //编码生成 %E5 %A7 之类的东西
-                encode_str(enstr, sizeof(enstr), name);
-                
-                // 如果是文件
-                if(S_ISREG(st.st_mode)) {       
-                    sprintf(buf+strlen(buf), 
-                            "<tr><td><a href=\"%s\">%s</a></td><td>%ld</td></tr>",
-                            enstr, name, (long)st.st_size);
-                } else if(S_ISDIR(st.st_mode)) {		// 如果是目录       
-                    sprintf(buf+strlen(buf), 
-                            "<tr><td><a href=\"%s/\">%s/</a></td><td>%ld</td></tr>",
-                            enstr, name, (long)st.st_size);
-                }
-                 // 如果是文件
-                // if(S_ISREG(st.st_mode)) {       
-                //     sprintf(buf+strlen(buf), "%s\n", name);
-                // } else if(S_ISDIR(st.st_mode)) {		// 如果是目录       
-                //     sprintf(buf+strlen(buf), "%s\n", name);
-                // }
-                // memset(buf, 0, sizeof(buf));
-                // 字符串拼接
-            }
-
-            sprintf(buf+strlen(buf), "</table></body></html>");
-            printf("size of buf %d\n", strlen(buf));
-            printf("dir message send OK!!!!\n");
-
-            add_headers(strlen(buf), get_file_type(".html"));
-            m_iv[0].iov_base = m_write_buf;  //读缓冲区全是应答头
-            m_iv[0].iov_len = m_write_idx;
-            //把内容装进去
-            m_iv[1].iov_base = buf;  //mmap映射的文件，也就是客户请求要看的文件
-            m_iv[1].iov_len = strlen(buf);
-            m_iv_count = 2;
+
+            //客户端支持gzip时发送目录缓存中压缩好的页面
+            const std::string& page = (m_accept_encoding & compress_cache::ENCODING_GZIP) && !m_listing->gzip.empty()
+                                      ? m_listing->gzip : m_listing->html;
+            m_content_encoding = &page == &m_listing->gzip ? "gzip" : 0;
+            m_vary = true;
+            add_encoding();
+            add_headers(page.size(), get_file_type(".html"));
+            int n = export_headers();  //写缓冲区全是应答头
+            //把内容装进去，页面由缓存持有，发送完之前不会被释放
+            m_iv[n].iov_base = (char*)page.data();
+            m_iv[n].iov_len = page.size();
+            m_iv_count = n + 1;
             //下一行 为优化新增 保证还需要传入的数据量准确无误
-            bytes_to_send = m_write_idx + strlen(buf);//还需传入的数据字节
+            bytes_to_send = m_write_buf.size() + page.size();//还需传入的数据字节
             return true;
         }
     default:
         return false;
     }
-    m_iv[0].iov_base = m_write_buf;
-    m_iv[0].iov_len = m_write_idx;
-    m_iv_count = 1;
+    m_iv_count = export_headers();
     //下一行 为优化新增 如果是其他行为，待发送的字节数则就位写缓冲区的数据
-    bytes_to_send = m_write_idx;
+    bytes_to_send = m_write_buf.size();
+    return true;
+}
+
+int http_conn::export_headers(){
+    return m_write_buf.export_iov(m_iv);
+}
+
+void http_conn::set_file_body(off_t start, off_t end){
+    int n = export_headers();  //写缓冲区全是应答头
+    if(m_file_fd != -1){
+        //sendfile模式下m_iv中只有响应头，文件内容由write_file()按m_file_offset发送
+        m_file_offset = start;
+        m_file_end = end;
+        m_iv_count = n;
+    }else{
+        m_iv[n].iov_base = memory_body() + start;
+        m_iv[n].iov_len = end - start;
+        m_iv_count = n + 1;
+    }
+    bytes_to_send = m_write_buf.size() + (end - start);
+}
+
+bool http_conn::start_dir_stream(int format, long offset, long limit){
+    m_dir_stream = new dir_stream();
+    if(!m_dir_stream->open(m_real_file, m_url, (dir_stream::FORMAT)format, offset, limit)){
+        delete m_dir_stream;
+        m_dir_stream = 0;
+        return false;
+    }
+    //长度事先不知道，按分块编码发送；列表随目录变化，不让缓存保存
+    add_status_line(200, ok_200_title);
+    append_literal(m_write_buf, "Transfer-Encoding: chunked\r\nCache-Control: no-store\r\n");
+    add_content_type(format == dir_stream::FORMAT_JSON ? get_file_type(".json") : get_file_type(".html"));
+    add_linger();
+    add_blank_line();
+    m_dir_stream->next(m_generated);
+    int n = export_headers();
+    m_iv[n].iov_base = (char*)m_generated.data();
+    m_iv[n].iov_len = m_generated.size();
+    m_iv_count = n + 1;
+    bytes_to_send = m_write_buf.size() + m_generated.size();
+    return true;
+}
+
+char* http_conn::memory_body(){
+    if(m_compressed){
+        return (char*)m_compressed->body.data();
+    }
+    //热点对象缓存中的文件内容或者mmap映射的文件
+    return m_object ? m_object->body : m_file_address;
+}
+
+bool http_conn::next_part(){
+    if(m_dir_stream){
+        if(!m_dir_stream->next(m_generated)){
+            return false;
+        }
+        m_iv[0].iov_base = (char*)m_generated.data();
+        m_iv[0].iov_len = m_generated.size();
+        m_iv_count = 1;
+        bytes_to_send = m_generated.size();
+        return true;
+    }
+    if(m_range_index + 1 >= (int)m_ranges.size()){
+        return false;
+    }
+    const byte_range& range = m_ranges[++m_range_index];
+    m_iv[0].iov_base = (char*)range.head.data();
+    m_iv[0].iov_len = range.head.size();
+    if(m_file_fd != -1){
+        m_file_offset = range.start;
+        m_file_end = range.end;
+        m_iv_count = 1;
+    }else{
+        m_iv[1].iov_base = memory_body() + range.start;
+        m_iv[1].iov_len = range.end - range.start;
+        m_iv_count = 2;
+    }
+    bytes_to_send = range.head.size() + (range.end - range.start);
     return true;
 }
 
 //线程池中的工作线程调用，这是处理HTTP请求的入口函数
 //这里因为是某一个线程调用的，一个线程从工作队列里面拿一个socket的处理任务，所以这个m_sockfd会对应到那个socket的文件描述符
 void http_conn::process(){
+    m_parse_start = metrics::now_ns();
+    //在请求队列中等待的时间，流水线上的后续请求也是由反应堆放进队列的
+    if(m_enqueue_ns > 0){
+        metrics::add_latency(metrics::LATENCY_QUEUE, m_parse_start - m_enqueue_ns);
+        m_enqueue_ns = 0;
+    }
     HTTP_CODE read_ret = process_read(); //解析来的请求
     //如果解析全的话就得继续去监听读，不能放他往下走往写缓冲力写
     if(read_ret == NO_REQUEST){
-        modfd(m_epollfd, m_sockfd, EPOLLIN);
+        rearm(EPOLLIN);
         return;
     }
     bool write_ret = process_write(read_ret);
     if(!write_ret){
-        close_conn();
+        //连接只在反应堆线程中关闭，这里关掉读写，等反应堆收到挂断事件或者读到0字节时关闭
+        shutdown(m_sockfd, SHUT_RDWR);
+        rearm(EPOLLIN);
+        return;
     }
     //把东西都写到写缓冲里面了就监听写
-    modfd(m_epollfd, m_sockfd, EPOLLOUT);
+    rearm(EPOLLOUT);
 }
 
 
@@ -21,19 +21,42 @@
 #include<sys/uio.h>
 #include <dirent.h>
 #include <ctype.h>
+#include <string>
+#include <vector>
 
 #include"locker.h"
+#include"file_cache.h"
+#include"object_cache.h"
+#include"dir_cache.h"
+#include"compress_cache.h"
+#include"timer_wheel.h"
+#include"chain_buffer.h"
+#include"http_parser.h"
+#include"access_log.h"
+
+class reactor;
+class dir_stream;
+class upload;
 
 class http_conn{
+    //io_uring后端由反应堆直接完成连接上的收发
+    friend class reactor;
+    //微基准直接调用解析和拼响应头的私有函数
+    friend class microbench;
     public:
         //文件名的最大长度
         static const int FILENAME_LEN = 200;
-        //读缓冲区的大小
+        //读缓冲区的初始大小，以及请求头很大时读缓冲区最多扩大到的大小
         static const int READ_BUFFER_SIZE = 2048;
-        //写缓冲区的大小
+        static const int MAX_READ_BUFFER_SIZE = 64 * 1024;
+        //写缓冲区第一段的大小，响应头更大时链式缓冲区接上更多的段
         static const int WRITE_BUFFER_SIZE = 2048;
+        //从反应堆缓冲区池中取的一块：读缓冲区、写缓冲区和目标文件路径依次排在里面
+        static const int BUFFER_BLOCK_SIZE = READ_BUFFER_SIZE + WRITE_BUFFER_SIZE + FILENAME_LEN;
+        //工作线程处理一次上传最多搬的字节数，搬够了就把连接交回反应堆，让其他连接也有机会
+        static const int UPLOAD_ROUND_BYTES = 4 * 1024 * 1024;
         //HTTP请求方法
-        enum METHOD{GET = 0, POST};
+        enum METHOD{GET = 0, POST, PUT};
         //解析客户请求，主状态机所处的状态
         enum CHECK_STATE {CHECK_STATE_REQUESTLINE = 0, CHECK_STATE_HEADER, CHECK_STATE_CONTENT};
         //服务器处理HTTP请求的可能结果
@@ -46,16 +69,27 @@ class http_conn{
         //INTERNAL_ERROR     服务器内部错误
         //CLOSED_CONNECTION  客户端已经关闭连接
         //IS_DIR             代表访问的是一个目录
-        enum HTTP_CODE {NO_REQUEST, GET_REQUEST, BAD_REQUEST, NO_RESOURCE, FORBIDDEN_REQUEST, FILE_REQUEST, INTERNAL_ERROR, CLOSED_CONNECTION, IS_DIR};
-        //行的读取状态
-        enum LINE_STATUS {LINE_OK=0, LINE_BAD, LINE_OPEN};
+        //RANGE_NOT_SATISFIABLE  Range请求的区间都超出了文件范围
+        //NOT_MODIFIED       条件请求命中，客户端缓存的文件仍然有效
+        //STATS_REQUEST      请求的是统计页面，内容已经生成在m_generated中
+        //UPLOAD_CREATED     上传完成，新建了目标文件
+        //UPLOAD_REPLACED    上传完成，替换了原来的目标文件
+        //METHOD_NOT_ALLOWED 没有打开上传时的PUT/POST
+        //LENGTH_REQUIRED    上传既没有Content-Length也不是分块编码
+        //PAYLOAD_TOO_LARGE  上传的消息体超过上限
+        enum HTTP_CODE {NO_REQUEST, GET_REQUEST, BAD_REQUEST, NO_RESOURCE, FORBIDDEN_REQUEST, FILE_REQUEST, INTERNAL_ERROR, CLOSED_CONNECTION, IS_DIR, RANGE_NOT_SATISFIABLE, NOT_MODIFIED, STATS_REQUEST,
+                        UPLOAD_CREATED, UPLOAD_REPLACED, METHOD_NOT_ALLOWED, LENGTH_REQUIRED, PAYLOAD_TOO_LARGE};
+        //文件内容的发送方式
+        //SEND_SENDFILE      用sendfile按偏移量零拷贝发送
+        //SEND_MMAP          mmap到内存后用writev发送
+        enum FILE_SEND_MODE {SEND_SENDFILE = 0, SEND_MMAP};
     public:
-        http_conn(){}
+        http_conn(): m_sockfd(-1), m_block(0), m_read_buf(0), m_read_size(0), m_real_file(0){}
         ~http_conn(){}
     
     public:
-        //初始化新接收的连接
-        void init(int sockfd, const sockaddr_in& addr);
+        //初始化新接收的连接，owner是接受这个连接的反应堆
+        void init(int sockfd, const sockaddr_in& addr, reactor* owner);
         //关闭连接
         void close_conn(bool real_close = true);
         //处理客户请求
@@ -64,6 +98,37 @@ class http_conn{
         bool read();
         //非阻塞写操作
         bool write();
+        //io_uring后端下把反应堆收到的数据放进读缓冲区
+        bool feed(const char* data, int len);
+        //上一个响应发完以后读缓冲区中是否还有流水线上的后续请求
+        bool has_pipelined() const { return m_read_idx > 0; }
+        //工作窃取模式下上一次处理这个连接的工作线程
+        int last_worker() const { return m_last_worker; }
+        void set_last_worker(int id) { m_last_worker = id; }
+
+    public:
+        //所有连接共用的文件发送方式，启动时根据命令行参数设置
+        static FILE_SEND_MODE m_send_mode;
+        //所有工作线程共享的文件描述符/stat缓存
+        static file_cache* m_file_cache;
+        //所有工作线程共享的热点对象缓存
+        static object_cache* m_object_cache;
+        //所有工作线程共享的目录列表缓存
+        static dir_cache* m_dir_cache;
+        //所有工作线程共享的即时压缩缓存
+        static compress_cache* m_compress_cache;
+        //访问日志，为NULL时不记录
+        static access_log* m_access_log;
+        //统计页面的路径，默认/__stats，加上?format=json时输出JSON；为NULL时关闭统计页面
+        static const char* m_stats_path;
+        //PUT/POST上传的消息体上限（字节），-1表示不接受上传，0表示不限制
+        static long long m_upload_limit;
+        //通过文件名获取文件的类型
+        static const char *get_file_type(const char *name);
+        //扫描目录并渲染目录页面，供目录列表缓存调用
+        static bool build_dir_listing(const char* path, std::string& html);
+        //把文件名按URL的要求做%编码，结果最多tosize字节（包括结尾的'\0'）
+        static void encode_str(char* to, int tosize, const char* from);
     
     private:
         //初始化连接
@@ -74,55 +139,112 @@ class http_conn{
         bool process_write(HTTP_CODE ret);
 
         //下面这一组函数process_read调用以分析HTTP请求
-        HTTP_CODE parse_request_line(char* text);
-        HTTP_CODE parse_headers(char* text);
-        HTTP_CODE parse_content(char* text);
+        HTTP_CODE parse_request_line();
+        void parse_headers();
+        HTTP_CODE parse_content();
         HTTP_CODE do_request();
-        char* get_line(){return m_read_buf + m_start_line;}
-        LINE_STATUS parse_line();
+        //URL去掉查询字符串、解码以后得到相对网站根目录的路径，放在m_real_file中
+        void resolve_path();
+        //请求头收齐以后开始上传：检查请求、打开临时文件，然后搬已经收到的消息体
+        HTTP_CODE start_upload();
+        //把消息体搬进文件，消息体还没收完时返回NO_REQUEST，等反应堆收到更多数据再继续
+        HTTP_CODE pump_upload();
+        //解析Range和If-Range头部，结果放在m_ranges中；所有区间都不可满足时返回false
+        bool parse_range();
+        //根据If-None-Match和If-Modified-Since判断客户端缓存的文件是否仍然有效
+        bool not_modified();
+        //根据Accept-Encoding选择预先压缩好的文件或即时压缩的结果
+        void negotiate_encoding();
+        //消息体在内存中时的起始地址：即时压缩的结果、热点对象或者mmap映射区
+        char* memory_body();
+
+        //下面三个函数被write调用
+        bool write_file();
+        bool write_done();
+        //当前这部分消息体发完以后准备下一部分：多区间响应切换到下一个区间，流式目录列表生成下一块，
+        //没有更多时返回false
+        bool next_part();
+        //开始流式发送目录列表，响应头和第一块放进m_iv
+        bool start_dir_stream(int format, long offset, long limit);
+        //处理完请求后重新关注读或写事件
+        void rearm(int ev);
+        //从反应堆的缓冲区池中取一块作为读写缓冲区，以及把它还回去；只在反应堆线程中调用
+        bool attach_buffer();
+        void detach_buffer();
+        //读缓冲区满了而请求还不完整时把它扩大一倍。解析器直接在缓冲区里切分请求，所以扩大时要整体搬到
+        //一块连续的新内存中，并把已经解析出来的指向旧缓冲区的指针一起挪过去
+        bool grow_read_buffer();
+        //把写缓冲区的各段导出到m_iv开头，返回导出的项数
+        int export_headers();
+        //按发出去的字节数推进m_iv中的各个内存块
+        void consume_iov(ssize_t bytes);
+        //响应发完或者连接中途关闭时记录指标和访问日志，每个响应只记一次
+        void request_done();
 
         //下面这一组函数被process_write调用以填充HTTP应答
         void unmap();
         bool add_reponse(const char* format, ...);
+        //不经过格式化直接追加字符串和十进制数字，字符串常量按编译期已知的长度追加
+        template<int N>
+        static bool append_literal(chain_buffer& buf, const char (&text)[N]){
+            return buf.append(text, N - 1);
+        }
+        bool add_text(const char* text);
+        bool add_number(long long value);
         bool add_content(const char* content);
         bool add_status_line(int status, const char* title);
-        bool add_headers(int content_len, const char* type);
-        bool add_content_length(int content_length);
+        bool add_headers(long long content_len, const char* type);
+        bool add_content_length(long long content_length);
         bool add_linger();
         bool add_blank_line();
         bool add_content_type(const char* type);
-        const char *get_file_type(const char *name);
+        bool add_validators();
+        bool add_encoding();
+        //设置文件消息体中本次要发送的区间[start, end)，响应头已经在写缓冲区中
+        void set_file_body(off_t start, off_t end);
         void decode_str(char *to, char *from);
-        void encode_str(char* to, int tosize, const char* from);
         int hexit(char c);
 
-    public:
-        //所有socket上的事件都被注册到同一个epoll内核时间表中，所以将epoll文件描述符设置为静态的
-        static int m_epollfd;
-        //统计用户数量
-        static int m_user_count;
-    
     private:
+        //这个连接所属的反应堆，连接上的事件都注册在该反应堆的epoll内核事件表中，用户数量也记在该反应堆上
+        reactor* m_reactor;
+        int m_epollfd;
+        //上一次处理这个连接的工作线程，-1表示还没有处理过
+        int m_last_worker;
         //读HTTP连接的socket和对方的socket地址
         int m_sockfd;
         sockaddr_in m_address;
+        //反应堆时间轮中的定时器节点，以及当前期限的类型（reactor::TIMEOUT_KIND）
+        timer_node m_timer;
+        int m_timer_kind;
 
-        //读缓冲区
-        char m_read_buf[READ_BUFFER_SIZE];
+        //从缓冲区池中取得的一块，依次放着读缓冲区、写缓冲区的第一段和目标文件路径，连接空闲时为0
+        char* m_block;
+        //读缓冲区，平时就是m_block的开头，请求头很大时换成单独分配的更大的缓冲区
+        char* m_read_buf;
+        int m_read_size;
         //标识读缓冲区已经进入客户数据最后一个字节的下一个位置
         int m_read_idx;
-        //当前分析的字符在缓冲区中的位置
+        //请求头解析器，记录请求行和头部字段在读缓冲区中的位置
+        http_parser m_parser;
+        //请求头收齐以后指向消息体的第一个字节
         int m_checked_idx;
-        //当前正在解析的行的起始位置
-        int m_start_line;
+        //解析出的完整请求（包括消息体）在读缓冲区中的结束位置，0表示还没有解析出完整请求
+        int m_request_end;
         //写缓冲区
-        char m_write_buf[WRITE_BUFFER_SIZE];
-        //写缓冲区中待发送的字节数
-        int m_write_idx;
-        //向TCP缓冲区发送了多少
-        int bytes_have_send;
+        chain_buffer m_write_buf;
+        //向TCP缓冲区发送了多少，大文件和大区间会超过2GB，用off_t
+        off_t bytes_have_send;
+        //响应的状态码，还没有开始响应或者已经记过访问日志时为0
+        int m_status;
+        //收到请求第一个字节的时间、反应堆把连接放进请求队列的时间、开始解析这一轮数据的时间
+        //和之前几轮解析已经花掉的时间，都是CLOCK_MONOTONIC纳秒
+        long long m_request_start;
+        long long m_enqueue_ns;
+        long long m_parse_start;
+        long long m_parse_ns;
         //还有多少需要向TCP缓冲区发送的
-        int bytes_to_send;
+        off_t bytes_to_send;
 
         //主状态机当前所处的状态
         CHECK_STATE m_check_state;
@@ -130,26 +252,93 @@ class http_conn{
         METHOD m_method;
 
         //客户请求的目标文件的完整路径，器内容等于doc_root + m_url, doc_root是网站根目录
-        char m_real_file[FILENAME_LEN];
+        char* m_real_file;
         //客户请求的目标文件的文件名
         char* m_url;
         //HTTP协议版本号，我们仅支持HTTP/1.1
         char* m_version;
+        //URL中?后面的查询字符串，没有时为0
+        char* m_query;
         //主机名
         char* m_host;
-        //HTTP请求的消息体的长度
-        int m_content_length;
+        //Referer和User-Agent，只用于访问日志
+        char* m_referer;
+        char* m_user_agent;
+        //访问日志中的请求目标：resolve_path会就地切掉查询字符串并解码URL，在那之前把客户端发来的原样复制一份
+        std::string m_log_target;
+        //HTTP请求的消息体的长度，没有Content-Length时为-1
+        long long m_content_length;
+        //请求中的Transfer-Encoding，没有时为0；请求头是否带了Expect: 100-continue
+        char* m_transfer_encoding;
+        bool m_expect_continue;
+        //正在进行的上传，消息体收完并改名成目标文件以后释放
+        upload* m_upload;
         //HTTP请求是否要求保持连接
         bool m_linger;
 
         //客户请求的目标文件被mmap到内存中的起始位置
         char* m_file_address;
-        //客户请求的目录的起始位置
-        char dirbuf[4096];
+        //从文件缓存中借用的目标文件条目，响应发送完后还回去
+        file_entry* m_file_entry;
+        //从热点对象缓存中借用的对象，命中时直接发送它预先拼好的响应头和文件内容
+        cached_object* m_object;
+        //目标文件的MIME类型
+        const char* m_file_type;
+        //sendfile模式下客户请求的目标文件的描述符，下一次sendfile开始的文件偏移，以及要发送的区间的结束位置
+        int m_file_fd;
+        off_t m_file_offset;
+        off_t m_file_end;
+
+        //请求中的Range、If-Range和条件请求头部，没有时为0
+        char* m_range;
+        char* m_if_range;
+        char* m_if_none_match;
+        char* m_if_modified_since;
+        //客户端接受的内容编码，compress_cache::CONTENT_ENCODING的组合
+        int m_accept_encoding;
+        //响应的内容编码，0表示不压缩；响应是否随Accept-Encoding变化
+        const char* m_content_encoding;
+        bool m_vary;
+        //从压缩缓存中借用的即时压缩结果
+        compressed_object* m_compressed;
+        //目标文件的ETag和Last-Modified，从文件缓存条目中复制过来，条目可能在发送前就还回去了
+        char m_etag[64];
+        char m_last_modified[32];
+        //Range请求解析出来的区间[start, end)，head是多区间响应中每个区间前面的分隔行和头部。
+        //只有一个区间时直接发送206，多个区间时按multipart/byteranges逐个发送，最后一项只有结束分隔行
+        struct byte_range
+        {
+            off_t start;
+            off_t end;
+            std::string head;
+        };
+        std::vector<byte_range> m_ranges;
+        //正在发送的区间
+        int m_range_index;
+        //从目录列表缓存中借用的目录页面
+        dir_listing* m_listing;
+        //流式发送的目录列表，要求分页、JSON或者目录太大不缓存页面时使用
+        dir_stream* m_dir_stream;
+        //当场生成的消息体（统计页面，流式目录列表的当前块）
+        std::string m_generated;
         //目标文件的状态。通过它我们可以判断文件是否存在、是否为目录、是否刻度，并获取文件大小等信息
         struct stat m_file_stat;
-        //我们将采用writev来执行写操作，所以定义下面两个成员，其中m_iv_count表示被写在内存块的数量
-        struct iovec m_iv[2];
+        //我们将采用writev来执行写操作，所以定义下面两个成员，其中m_iv_count表示被写在内存块的数量。
+        //写缓冲区的每一段占一项，消息体在内存中时跟在后面
+        struct iovec m_iv[chain_buffer::MAX_SEGMENTS + 1];
         int m_iv_count;
+
+        //下面这一组成员只在io_uring后端使用
+        //工作线程交回连接时要求的下一步：EPOLLIN继续读，EPOLLOUT发送响应
+        int m_uring_event;
+        //连接上已经提交、还没有完成的io_uring操作数
+        int m_uring_inflight;
+        //在途的操作中有失败的，全部完成后关闭连接
+        bool m_uring_error;
+        //splice发送文件用的管道，以及管道中还没有发到socket的字节数
+        int m_pipe[2];
+        int m_pipe_bytes;
+        //sendmsg的消息头，要保持到操作完成
+        struct msghdr m_msg;
 };
 #endif
\ No newline at end of file
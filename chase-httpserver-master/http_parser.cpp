@@ -0,0 +1,234 @@
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HTTP_PARSER_X86
+#endif
+
+#include "http_parser.h"
+#include "perfect_hash.h"
+
+//字段名，顺序和HEADER_ID一致
+static constexpr const char* const s_header_names[] = {
+    "Host", "Connection", "Content-Length", "Range", "If-Range", "Accept-Encoding", "If-None-Match", "If-Modified-Since",
+    "Referer", "User-Agent", "Transfer-Encoding", "Expect"
+};
+static_assert(sizeof(s_header_names) / sizeof(s_header_names[0]) == http_parser::HEADER_NUMBER, "header table mismatch");
+static constexpr static_perfect_hash<http_parser::HEADER_NUMBER, 32> s_headers(s_header_names);
+
+//在[p, p + len)中找第一个'\r'或'\n'，返回它的下标，没有时返回len。
+//*colon小于0时顺便找行尾之前的第一个':'，找到就把下标写进去
+typedef int (*scan_function)(const char* p, int len, int* colon);
+
+static int scan_scalar(const char* p, int len, int* colon){
+    for(int i = 0; i < len; ++i){
+        char c = p[i];
+        if(c == '\r' || c == '\n'){
+            return i;
+        }
+        if(c == ':' && *colon < 0){
+            *colon = i;
+        }
+    }
+    return len;
+}
+
+#ifdef HTTP_PARSER_X86
+//一次比较32字节，行尾和冒号各得到一个位掩码，冒号只看行尾之前的部分
+__attribute__((target("avx2")))
+static int scan_avx2(const char* p, int len, int* colon){
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    const __m256i co = _mm256_set1_epi8(':');
+    int i = 0;
+    for(; i + 32 <= len; i += 32){
+        __m256i v = _mm256_loadu_si256((const __m256i*)(p + i));
+        unsigned int eol = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, cr), _mm256_cmpeq_epi8(v, lf)));
+        if(*colon < 0){
+            unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, co));
+            if(eol){
+                mask &= (eol & -eol) - 1;
+            }
+            if(mask){
+                *colon = i + __builtin_ctz(mask);
+            }
+        }
+        if(eol){
+            return i + __builtin_ctz(eol);
+        }
+    }
+    int tail = *colon;
+    int found = scan_scalar(p + i, len - i, &tail);
+    if(*colon < 0 && tail >= 0){
+        *colon = i + tail;
+    }
+    return i + found;
+}
+
+//SSE4.2的字符串比较指令直接给出16字节中第一个属于字符集合的字节的下标
+__attribute__((target("sse4.2")))
+static int scan_sse42(const char* p, int len, int* colon){
+    const __m128i eol_set = _mm_setr_epi8('\r', '\n', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i colon_set = _mm_setr_epi8(':', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    const int mode = _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT;
+    int i = 0;
+    for(; i + 16 <= len; i += 16){
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+        int eol = _mm_cmpestri(eol_set, 2, v, 16, mode);
+        if(*colon < 0){
+            int c = _mm_cmpestri(colon_set, 1, v, 16, mode);
+            if(c < eol){
+                *colon = i + c;
+            }
+        }
+        if(eol < 16){
+            return i + eol;
+        }
+    }
+    int tail = *colon;
+    int found = scan_scalar(p + i, len - i, &tail);
+    if(*colon < 0 && tail >= 0){
+        *colon = i + tail;
+    }
+    return i + found;
+}
+#endif
+
+static scan_function choose_scan(const char** name){
+#ifdef HTTP_PARSER_X86
+    //在静态初始化阶段使用__builtin_cpu_supports之前要先初始化
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")){
+        *name = "avx2";
+        return scan_avx2;
+    }
+    if(__builtin_cpu_supports("sse4.2")){
+        *name = "sse4.2";
+        return scan_sse42;
+    }
+#endif
+    *name = "scalar";
+    return scan_scalar;
+}
+
+static const char* s_scan_name;
+static scan_function s_scan = choose_scan(&s_scan_name);
+
+const char* http_parser::implementation(){
+    return s_scan_name;
+}
+
+http_parser::HEADER_ID http_parser::header_id(const char* name, int len){
+    return (HEADER_ID)s_headers.find(s_header_names, name, len);
+}
+
+void http_parser::reset(){
+    m_line_start = 0;
+    m_scan = 0;
+    m_colon = -1;
+    m_line_number = 0;
+    m_head_length = 0;
+    m_method.off = m_method.len = 0;
+    m_target.off = m_target.len = 0;
+    m_version.off = m_version.len = 0;
+    m_field_count = 0;
+}
+
+static inline bool is_blank(char c){
+    return c == ' ' || c == '\t';
+}
+
+//请求行：方法 空白 目标 空白 版本，各部分之间可以有多个空格或制表符
+bool http_parser::parse_request_line(const char* buf, int start, int end){
+    span* parts[3] = {&m_method, &m_target, &m_version};
+    int i = start;
+    for(int n = 0; n < 3; ++n){
+        while(i < end && is_blank(buf[i])){
+            ++i;
+        }
+        int begin = i;
+        while(i < end && !is_blank(buf[i])){
+            ++i;
+        }
+        if(i == begin){
+            return false;
+        }
+        parts[n]->off = begin;
+        parts[n]->len = i - begin;
+    }
+    while(i < end && is_blank(buf[i])){
+        ++i;
+    }
+    return i == end;
+}
+
+//头部字段：名字 ':' 空白 值 空白。没有冒号或者名字为空的行当作格式错误
+bool http_parser::add_field(const char* buf, int start, int end, int colon){
+    if(colon <= start){
+        return false;
+    }
+    if(m_field_count == MAX_FIELDS){
+        return false;
+    }
+    int begin = colon + 1;
+    while(begin < end && is_blank(buf[begin])){
+        ++begin;
+    }
+    int finish = end;
+    while(finish > begin && is_blank(buf[finish - 1])){
+        --finish;
+    }
+    field& f = m_fields[m_field_count++];
+    f.name.off = start;
+    f.name.len = colon - start;
+    f.value.off = begin;
+    f.value.len = finish - begin;
+    return true;
+}
+
+http_parser::PARSE_RESULT http_parser::parse(const char* buf, int len){
+    if(m_head_length > 0){
+        return PARSE_DONE;
+    }
+    while(m_scan < len){
+        //这一行的冒号已经找到时传入非负数，扫描函数就不再找冒号
+        int colon = m_colon < 0 ? -1 : 0;
+        int found = s_scan(buf + m_scan, len - m_scan, &colon);
+        if(m_colon < 0 && colon >= 0){
+            m_colon = m_scan + colon;
+        }
+        int eol = m_scan + found;
+        if(eol == len){
+            //这一行还没收全，下次从这里继续
+            m_scan = len;
+            return PARSE_INCOMPLETE;
+        }
+        //只接受\r\n结尾，单独的\r或\n都是格式错误；\r是最后一个字节时要等下一个字节
+        if(buf[eol] == '\n'){
+            return PARSE_ERROR;
+        }
+        if(eol + 1 == len){
+            m_scan = eol;
+            return PARSE_INCOMPLETE;
+        }
+        if(buf[eol + 1] != '\n'){
+            return PARSE_ERROR;
+        }
+        int start = m_line_start;
+        if(m_line_number == 0){
+            if(!parse_request_line(buf, start, eol)){
+                return PARSE_ERROR;
+            }
+        }else if(eol == start){
+            //空行，请求头结束
+            m_head_length = eol + 2;
+            m_line_number++;
+            return PARSE_DONE;
+        }else if(!add_field(buf, start, eol, m_colon)){
+            return PARSE_ERROR;
+        }
+        m_line_number++;
+        m_line_start = m_scan = eol + 2;
+        m_colon = -1;
+    }
+    return PARSE_INCOMPLETE;
+}
@@ -0,0 +1,76 @@
+// HTTP请求头解析器：一遍扫描找出每一行的结尾，同时找出头部字段名和值的分界，结果记成一张相对读缓冲区开头的偏移量表，
+// 不改写缓冲区。找行尾和冒号用向量指令，一次比较32字节（AVX2）或16字节（SSE4.2），启动时按CPU支持的指令集选择实现，
+// 都不支持时用逐字节的实现。
+// 解析是增量的：数据没收全时记住扫描到的位置，下一次从那里继续，不重复扫描已经看过的字节。
+// note：偏移量用unsigned short保存，读缓冲区不能超过64KB
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+class http_parser
+{
+public:
+    //PARSE_INCOMPLETE  请求头还没收全
+    //PARSE_DONE        请求头已经完整，空行之后是消息体或者下一个请求
+    //PARSE_ERROR       请求头格式错误，或者字段太多
+    enum PARSE_RESULT {PARSE_INCOMPLETE = 0, PARSE_DONE, PARSE_ERROR};
+    //一个请求最多的头部字段数
+    static const int MAX_FIELDS = 64;
+    //服务器会处理的头部字段，其他字段都是HEADER_UNKNOWN
+    enum HEADER_ID {HEADER_UNKNOWN = -1, HEADER_HOST = 0, HEADER_CONNECTION, HEADER_CONTENT_LENGTH, HEADER_RANGE,
+                    HEADER_IF_RANGE, HEADER_ACCEPT_ENCODING, HEADER_IF_NONE_MATCH, HEADER_IF_MODIFIED_SINCE,
+                    HEADER_REFERER, HEADER_USER_AGENT, HEADER_TRANSFER_ENCODING, HEADER_EXPECT, HEADER_NUMBER};
+
+    //一段文本在缓冲区中的位置
+    struct span
+    {
+        unsigned short off;
+        unsigned short len;
+    };
+    //一个头部字段，值已经去掉了前后的空白
+    struct field
+    {
+        span name;
+        span value;
+    };
+
+    http_parser() { reset(); }
+    //开始解析一个新的请求，请求从缓冲区开头开始
+    void reset();
+    //解析buf中前len个字节，buf可以和上一次调用时不同（缓冲区扩大后搬了地方），但已有的内容不能变
+    PARSE_RESULT parse(const char* buf, int len);
+
+    //请求行是否已经完整
+    bool request_line_done() const { return m_line_number > 0; }
+    //请求头（包括结尾的空行）的长度，PARSE_DONE之后有效
+    int head_length() const { return m_head_length; }
+    span method() const { return m_method; }
+    span target() const { return m_target; }
+    span version() const { return m_version; }
+    int field_count() const { return m_field_count; }
+    const field& field_at(int i) const { return m_fields[i]; }
+
+    //当前使用的实现："avx2"、"sse4.2"或"scalar"
+    static const char* implementation();
+    //按字段名查字段编号，不区分大小写，用编译期生成的完美哈希表，一次哈希一次比较
+    static HEADER_ID header_id(const char* name, int len);
+
+private:
+    bool parse_request_line(const char* buf, int start, int end);
+    bool add_field(const char* buf, int start, int end, int colon);
+
+private:
+    //当前行的开头、当前行已经扫描到的位置，以及当前行中第一个冒号的位置（-1表示还没找到）
+    int m_line_start;
+    int m_scan;
+    int m_colon;
+    //已经完整解析的行数
+    int m_line_number;
+    int m_head_length;
+    span m_method;
+    span m_target;
+    span m_version;
+    int m_field_count;
+    field m_fields[MAX_FIELDS];
+};
+
+#endif
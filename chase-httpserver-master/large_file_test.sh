@@ -0,0 +1,40 @@
+#!/bin/bash
+# 超过2GB的文件和区间的发送测试：在网站根目录下建一个3GB的稀疏文件，
+# 用每种I/O后端和发送方式请求整个文件、一个超过INT_MAX的区间和一个带超大区间的多区间请求，检查收到的字节数。
+# 用法：./large_file_test.sh [port]，需要先make server，服务器的网站根目录是/home/dir
+PORT=${1:-18181}
+ROOT=/home/dir
+NAME=.large_file_test.bin
+SIZE=$((3 * 1024 * 1024 * 1024))
+#超过INT_MAX的区间
+RANGE_END=2200000000
+cd "$(dirname "$0")"
+truncate -s $SIZE $ROOT/$NAME || exit 1
+trap 'rm -f $ROOT/$NAME; kill $PID 2>/dev/null' EXIT
+rc=0
+check(){
+    if [ "$2" != "$3" ]; then
+        echo "FAIL $1: got $2, want $3"
+        rc=1
+    else
+        echo "ok   $1"
+    fi
+}
+for backend in epoll uring; do
+    for mode in sendfile mmap; do
+        ./server $PORT -b $backend -f $mode -l off -o 0 >/dev/null 2>&1 &
+        PID=$!
+        sleep 0.5
+        URL=http://127.0.0.1:$PORT/$NAME
+        got=$(curl -s -o /dev/null -w '%{http_code} %{size_download}' $URL)
+        check "$backend $mode whole file" "$got" "200 $SIZE"
+        got=$(curl -s -o /dev/null -w '%{http_code} %{size_download}' -r 0-$((RANGE_END - 1)) $URL)
+        check "$backend $mode range over INT_MAX" "$got" "206 $RANGE_END"
+        #多区间：分隔行和各区间的头部之外是两个区间的内容
+        got=$(curl -s -r 0-9,10-$((RANGE_END - 1)) $URL | grep -a -c '^--chase')
+        check "$backend $mode multipart over INT_MAX" "$got" "3"
+        kill $PID
+        wait $PID 2>/dev/null
+    done
+done
+exit $rc
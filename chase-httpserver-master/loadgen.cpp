@@ -0,0 +1,576 @@
+// 压测客户端：多个线程各自用一个epoll驱动一批非阻塞连接，连接上一次只有一个请求，
+// 收完响应（按Content-Length、chunked或者关闭连接判断结束）就记录延迟，然后在同一个连接上发下一个请求，
+// 或者在短连接模式下关掉重新连接。请求的URL按权重从混合列表中随机选，可以混合小文件、大文件、目录页面和404。
+// 结束时输出一行JSON：请求数、每秒请求数、吞吐量、各状态码和各URL的请求数，以及延迟的p50/p90/p99/p999。
+// 延迟直方图和服务器的统计页面用的是同一个实现。
+// 用法：loadgen ip port [-c 连接数] [-t 线程数] [-d 秒数] [-n 短连接] [-u URL:权重]...
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "metrics.h"
+
+#define MAX_EVENT_NUMBER 1024
+//一次recv的缓冲区大小，响应头必须能放进这么大的缓冲区
+#define RECV_BUFFER_SIZE 65536
+
+//请求混合中的一项
+struct target
+{
+    std::string url;
+    int weight;
+    std::string request;
+};
+
+//所有线程共用的配置
+struct config
+{
+    struct sockaddr_in address;
+    int connections;
+    int threads;
+    int seconds;
+    bool keep_alive;
+    std::vector<target> targets;
+    int total_weight;
+};
+
+//一个连接的状态
+struct client
+{
+    //CONNECTING  非阻塞connect还没完成
+    //SENDING     请求还没发完
+    //HEAD        在读响应头
+    //BODY        在读消息体
+    enum STATE {CONNECTING = 0, SENDING, HEAD, BODY};
+    int fd;
+    STATE state;
+    int target;
+    int sent;
+    long long start_ns;
+    //响应头读到的位置
+    std::string head;
+    int status;
+    //剩下的消息体字节数，-1表示读到连接关闭为止
+    long long remaining;
+    bool chunked;
+    //chunked消息体的解析状态：还在读块大小那一行，或者块数据后面的\r\n，或者最后的空行
+    enum CHUNK_STATE {CHUNK_SIZE = 0, CHUNK_DATA, CHUNK_DATA_END, CHUNK_TRAILER};
+    CHUNK_STATE chunk_state;
+    std::string chunk_line;
+    bool server_close;
+};
+
+//一个线程的结果
+struct worker_result
+{
+    long long requests;
+    long long errors;
+    long long connects;
+    long long bytes;
+    std::vector<long long> status;  //按状态码下标，0到599
+    std::vector<long long> per_target;
+    latency_histogram* latency;
+};
+
+struct worker_arg
+{
+    const config* conf;
+    int connections;
+    long long deadline_ns;
+    worker_result result;
+    unsigned long long seed;
+};
+
+static unsigned long long next_random(unsigned long long* state){
+    //xorshift64
+    unsigned long long x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+static int pick_target(const config* conf, unsigned long long* seed){
+    int r = next_random(seed) % conf->total_weight;
+    for(size_t i = 0; i < conf->targets.size(); ++i){
+        r -= conf->targets[i].weight;
+        if(r < 0){
+            return i;
+        }
+    }
+    return 0;
+}
+
+static void close_client(int epollfd, client* c){
+    if(c->fd >= 0){
+        epoll_ctl(epollfd, EPOLL_CTL_DEL, c->fd, 0);
+        close(c->fd);
+        c->fd = -1;
+    }
+}
+
+static bool start_connect(int epollfd, const config* conf, client* c, worker_result* result){
+    c->fd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if(c->fd < 0){
+        return false;
+    }
+    int nodelay = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    result->connects++;
+    int ret = connect(c->fd, (struct sockaddr*)&conf->address, sizeof(conf->address));
+    if(ret < 0 && errno != EINPROGRESS){
+        close(c->fd);
+        c->fd = -1;
+        return false;
+    }
+    c->state = client::CONNECTING;
+    epoll_event event;
+    event.data.ptr = c;
+    event.events = EPOLLOUT;
+    epoll_ctl(epollfd, EPOLL_CTL_ADD, c->fd, &event);
+    return true;
+}
+
+static void watch(int epollfd, client* c, int events){
+    epoll_event event;
+    event.data.ptr = c;
+    event.events = events;
+    epoll_ctl(epollfd, EPOLL_CTL_MOD, c->fd, &event);
+}
+
+//开始一个新请求，先把能发的发出去
+static void start_request(int epollfd, worker_arg* arg, client* c){
+    c->target = pick_target(arg->conf, &arg->seed);
+    c->sent = 0;
+    c->head.clear();
+    c->status = 0;
+    c->remaining = -1;
+    c->chunked = false;
+    c->chunk_state = client::CHUNK_SIZE;
+    c->chunk_line.clear();
+    c->server_close = false;
+    c->start_ns = metrics::now_ns();
+    c->state = client::SENDING;
+    watch(epollfd, c, EPOLLOUT);
+}
+
+//解析响应头，返回false表示响应格式不对
+static bool parse_head(client* c){
+    const char* head = c->head.c_str();
+    if(strncmp(head, "HTTP/1.", 7) != 0){
+        return false;
+    }
+    c->status = atoi(head + 9);
+    const char* line = strstr(head, "\r\n");
+    while(line && line[2] != '\r'){
+        line += 2;
+        if(strncasecmp(line, "Content-Length:", 15) == 0){
+            c->remaining = atoll(line + 15);
+        }else if(strncasecmp(line, "Transfer-Encoding:", 18) == 0 && strstr(line, "chunked")){
+            c->chunked = true;
+        }else if(strncasecmp(line, "Connection:", 11) == 0 && strncasecmp(line + 11 + strspn(line + 11, " "), "close", 5) == 0){
+            c->server_close = true;
+        }
+        line = strstr(line, "\r\n");
+    }
+    //304和HEAD请求的响应没有消息体
+    if(c->status == 304 || c->status == 204){
+        c->remaining = 0;
+        c->chunked = false;
+    }
+    return true;
+}
+
+//消耗chunked消息体中的len个字节，整个消息体结束时返回true
+static bool consume_chunked(client* c, const char* data, int len, bool* error){
+    int i = 0;
+    while(i < len){
+        if(c->chunk_state == client::CHUNK_DATA){
+            long long n = std::min((long long)(len - i), c->remaining);
+            i += n;
+            c->remaining -= n;
+            if(c->remaining == 0){
+                c->chunk_state = client::CHUNK_DATA_END;
+            }
+            continue;
+        }
+        char ch = data[i++];
+        if(ch != '\n'){
+            c->chunk_line += ch;
+            continue;
+        }
+        //一行结束，去掉\r
+        if(!c->chunk_line.empty() && c->chunk_line.back() == '\r'){
+            c->chunk_line.pop_back();
+        }
+        if(c->chunk_state == client::CHUNK_SIZE){
+            char* end;
+            long long size = strtoll(c->chunk_line.c_str(), &end, 16);
+            if(end == c->chunk_line.c_str()){
+                *error = true;
+                return false;
+            }
+            c->remaining = size;
+            c->chunk_state = size == 0 ? client::CHUNK_TRAILER : client::CHUNK_DATA;
+        }else if(c->chunk_state == client::CHUNK_DATA_END){
+            c->chunk_state = client::CHUNK_SIZE;
+        }else if(c->chunk_line.empty()){
+            //最后一个块后面的空行
+            c->chunk_line.clear();
+            return true;
+        }
+        c->chunk_line.clear();
+    }
+    return false;
+}
+
+//一个响应收完：记录结果，然后在同一个连接上发下一个请求，或者重新连接
+static void finish_response(int epollfd, worker_arg* arg, client* c){
+    worker_result* result = &arg->result;
+    long long now = metrics::now_ns();
+    result->latency->record(now - c->start_ns);
+    result->requests++;
+    if(c->status >= 0 && c->status < (int)result->status.size()){
+        result->status[c->status]++;
+    }
+    result->per_target[c->target]++;
+    if(now >= arg->deadline_ns){
+        close_client(epollfd, c);
+        return;
+    }
+    if(arg->conf->keep_alive && !c->server_close){
+        start_request(epollfd, arg, c);
+        return;
+    }
+    close_client(epollfd, c);
+    if(!start_connect(epollfd, arg->conf, c, result)){
+        result->errors++;
+    }
+}
+
+//连接出错：记一次错误，截止时间之前重新连接
+static void fail(int epollfd, worker_arg* arg, client* c){
+    arg->result.errors++;
+    close_client(epollfd, c);
+    if(metrics::now_ns() < arg->deadline_ns && !start_connect(epollfd, arg->conf, c, &arg->result)){
+        arg->result.errors++;
+    }
+}
+
+static void on_readable(int epollfd, worker_arg* arg, client* c, char* buf){
+    while(c->fd >= 0){
+        int len = recv(c->fd, buf, RECV_BUFFER_SIZE, 0);
+        if(len < 0){
+            if(errno != EAGAIN && errno != EWOULDBLOCK){
+                fail(epollfd, arg, c);
+            }
+            return;
+        }
+        if(len == 0){
+            //没有长度的消息体读到连接关闭为止，其他情况下对方关闭连接都算错误
+            if(c->state == client::BODY && c->remaining < 0 && !c->chunked){
+                c->server_close = true;
+                finish_response(epollfd, arg, c);
+            }else{
+                fail(epollfd, arg, c);
+            }
+            return;
+        }
+        arg->result.bytes += len;
+        const char* data = buf;
+        if(c->state == client::HEAD){
+            c->head.append(buf, len);
+            size_t end = c->head.find("\r\n\r\n");
+            if(end == std::string::npos){
+                if(c->head.size() > RECV_BUFFER_SIZE){
+                    fail(epollfd, arg, c);
+                    return;
+                }
+                continue;
+            }
+            if(!parse_head(c)){
+                fail(epollfd, arg, c);
+                return;
+            }
+            //头部后面已经收到的是消息体
+            int body = c->head.size() - (end + 4);
+            data = buf + len - body;
+            len = body;
+            c->state = client::BODY;
+        }
+        bool done = false;
+        if(c->chunked){
+            bool error = false;
+            done = consume_chunked(c, data, len, &error);
+            if(error){
+                fail(epollfd, arg, c);
+                return;
+            }
+        }else if(c->remaining >= 0){
+            c->remaining -= len;
+            done = c->remaining <= 0;
+        }
+        if(done){
+            //连接上一次只有一个请求，响应后面不应该还有多余的字节
+            finish_response(epollfd, arg, c);
+            return;
+        }
+    }
+}
+
+static void on_writable(int epollfd, worker_arg* arg, client* c){
+    if(c->state == client::CONNECTING){
+        int error = 0;
+        socklen_t len = sizeof(error);
+        getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &error, &len);
+        if(error != 0){
+            fail(epollfd, arg, c);
+            return;
+        }
+        start_request(epollfd, arg, c);
+    }
+    const std::string& request = arg->conf->targets[c->target].request;
+    while(c->sent < (int)request.size()){
+        int ret = send(c->fd, request.data() + c->sent, request.size() - c->sent, MSG_NOSIGNAL);
+        if(ret < 0){
+            if(errno != EAGAIN && errno != EWOULDBLOCK){
+                fail(epollfd, arg, c);
+            }
+            return;
+        }
+        c->sent += ret;
+    }
+    c->state = client::HEAD;
+    watch(epollfd, c, EPOLLIN);
+}
+
+static void* worker(void* p){
+    worker_arg* arg = (worker_arg*)p;
+    const config* conf = arg->conf;
+    int epollfd = epoll_create(5);
+    std::vector<client> clients(arg->connections);
+    for(int i = 0; i < arg->connections; ++i){
+        clients[i].fd = -1;
+        if(!start_connect(epollfd, conf, &clients[i], &arg->result)){
+            arg->result.errors++;
+        }
+    }
+    char* buf = new char[RECV_BUFFER_SIZE];
+    epoll_event events[MAX_EVENT_NUMBER];
+    while(true){
+        int number = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, 100);
+        if(number < 0 && errno != EINTR){
+            break;
+        }
+        for(int i = 0; i < number; ++i){
+            client* c = (client*)events[i].data.ptr;
+            if(c->fd < 0){
+                continue;
+            }
+            if(events[i].events & EPOLLIN){
+                on_readable(epollfd, arg, c, buf);
+            }else if(events[i].events & EPOLLOUT){
+                on_writable(epollfd, arg, c);
+            }else if(events[i].events & (EPOLLERR | EPOLLHUP)){
+                fail(epollfd, arg, c);
+            }
+        }
+        //截止时间到了以后不再发新请求，已经在途的请求作废
+        if(metrics::now_ns() >= arg->deadline_ns){
+            break;
+        }
+    }
+    for(int i = 0; i < arg->connections; ++i){
+        close_client(epollfd, &clients[i]);
+    }
+    delete [] buf;
+    close(epollfd);
+    return arg;
+}
+
+static void json_string(std::string& out, const std::string& text){
+    out += '"';
+    for(size_t i = 0; i < text.size(); ++i){
+        char c = text[i];
+        if(c == '"' || c == '\\'){
+            out += '\\';
+        }
+        out += c;
+    }
+    out += '"';
+}
+
+int main(int argc, char* argv[]){
+    if(argc <= 2){
+        printf("usage: %s ip port [-c connections] [-t threads] [-d seconds] [-n] [-u url:weight]...\n", basename(argv[0]));
+        return 1;
+    }
+    config conf;
+    memset(&conf.address, 0, sizeof(conf.address));
+    conf.address.sin_family = AF_INET;
+    if(inet_pton(AF_INET, argv[1], &conf.address.sin_addr) != 1){
+        printf("bad address %s\n", argv[1]);
+        return 1;
+    }
+    conf.address.sin_port = htons(atoi(argv[2]));
+    conf.connections = 100;
+    conf.threads = 1;
+    conf.seconds = 10;
+    conf.keep_alive = true;
+    conf.total_weight = 0;
+    int opt;
+    //argv[1]和argv[2]是地址和端口，从它们后面开始解析选项
+    while((opt = getopt(argc - 2, argv + 2, "c:t:d:nu:")) != -1){
+        switch(opt){
+            case 'c':
+                conf.connections = atoi(optarg);
+                break;
+            case 't':
+                conf.threads = atoi(optarg);
+                break;
+            case 'd':
+                conf.seconds = atoi(optarg);
+                break;
+            case 'n':
+                conf.keep_alive = false;
+                break;
+            case 'u':{
+                //URL后面可以跟:权重，默认权重1
+                target t;
+                t.url = optarg;
+                t.weight = 1;
+                size_t colon = t.url.rfind(':');
+                if(colon != std::string::npos){
+                    t.weight = atoi(t.url.c_str() + colon + 1);
+                    t.url.resize(colon);
+                }
+                if(t.weight <= 0 || t.url.empty() || t.url[0] != '/'){
+                    printf("bad url %s\n", optarg);
+                    return 1;
+                }
+                conf.targets.push_back(t);
+                break;
+            }
+            default:
+                return 1;
+        }
+    }
+    if(conf.targets.empty()){
+        target t;
+        t.url = "/";
+        t.weight = 1;
+        conf.targets.push_back(t);
+    }
+    if(conf.connections <= 0 || conf.threads <= 0 || conf.seconds <= 0){
+        return 1;
+    }
+    if(conf.threads > conf.connections){
+        conf.threads = conf.connections;
+    }
+    for(size_t i = 0; i < conf.targets.size(); ++i){
+        target& t = conf.targets[i];
+        t.request = "GET " + t.url + " HTTP/1.1\r\nHost: " + argv[1] + "\r\nUser-Agent: loadgen\r\n";
+        t.request += conf.keep_alive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+        conf.total_weight += t.weight;
+    }
+    //连接数多的时候把文件描述符的上限提到最大
+    struct rlimit limit;
+    if(getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max){
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    long long start = metrics::now_ns();
+    std::vector<worker_arg> args(conf.threads);
+    std::vector<pthread_t> threads(conf.threads);
+    for(int i = 0; i < conf.threads; ++i){
+        worker_arg& arg = args[i];
+        arg.conf = &conf;
+        //连接平均分给各个线程
+        arg.connections = conf.connections / conf.threads + (i < conf.connections % conf.threads ? 1 : 0);
+        arg.deadline_ns = start + (long long)conf.seconds * 1000000000LL;
+        arg.seed = 0x9e3779b97f4a7c15ULL * (i + 1);
+        arg.result.requests = arg.result.errors = arg.result.connects = arg.result.bytes = 0;
+        arg.result.status.assign(600, 0);
+        arg.result.per_target.assign(conf.targets.size(), 0);
+        arg.result.latency = new latency_histogram();
+        if(pthread_create(&threads[i], NULL, worker, &arg) != 0){
+            return 1;
+        }
+    }
+    worker_result total;
+    total.requests = total.errors = total.connects = total.bytes = 0;
+    total.status.assign(600, 0);
+    total.per_target.assign(conf.targets.size(), 0);
+    total.latency = new latency_histogram();
+    for(int i = 0; i < conf.threads; ++i){
+        pthread_join(threads[i], NULL);
+        worker_result& r = args[i].result;
+        total.requests += r.requests;
+        total.errors += r.errors;
+        total.connects += r.connects;
+        total.bytes += r.bytes;
+        for(int s = 0; s < 600; ++s){
+            total.status[s] += r.status[s];
+        }
+        for(size_t t = 0; t < conf.targets.size(); ++t){
+            total.per_target[t] += r.per_target[t];
+        }
+        total.latency->merge(*r.latency);
+        delete r.latency;
+    }
+    double elapsed = (metrics::now_ns() - start) / 1e9;
+
+    //结果输出成一行JSON，方便不同版本之间比较
+    char buf[512];
+    std::string out;
+    snprintf(buf, sizeof(buf), "{\"connections\":%d,\"threads\":%d,\"keep_alive\":%s,\"seconds\":%.3f,"
+             "\"requests\":%lld,\"errors\":%lld,\"connects\":%lld,\"requests_per_sec\":%.1f,"
+             "\"bytes\":%lld,\"mbytes_per_sec\":%.2f,",
+             conf.connections, conf.threads, conf.keep_alive ? "true" : "false", elapsed,
+             total.requests, total.errors, total.connects, total.requests / elapsed,
+             total.bytes, total.bytes / elapsed / (1024 * 1024));
+    out += buf;
+    const latency_histogram& h = *total.latency;
+    snprintf(buf, sizeof(buf), "\"latency_us\":{\"mean\":%.1f,\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f},",
+             h.count() ? h.sum() / 1e3 / h.count() : 0.0, h.quantile(0.5) / 1e3, h.quantile(0.9) / 1e3,
+             h.quantile(0.99) / 1e3, h.quantile(0.999) / 1e3, h.quantile(1) / 1e3);
+    out += buf;
+    out += "\"status\":{";
+    bool first = true;
+    for(int s = 0; s < 600; ++s){
+        if(total.status[s]){
+            snprintf(buf, sizeof(buf), "%s\"%d\":%lld", first ? "" : ",", s, total.status[s]);
+            out += buf;
+            first = false;
+        }
+    }
+    out += "},\"urls\":{";
+    for(size_t t = 0; t < conf.targets.size(); ++t){
+        if(t){
+            out += ',';
+        }
+        json_string(out, conf.targets[t].url);
+        snprintf(buf, sizeof(buf), ":%lld", total.per_target[t]);
+        out += buf;
+    }
+    out += "}}\n";
+    fputs(out.c_str(), stdout);
+    delete total.latency;
+    return total.requests > 0 ? 0 : 1;
+}
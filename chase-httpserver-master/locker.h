@@ -71,6 +71,12 @@ public:
         return pthread_mutex_unlock(&m_mutex) == 0;
     }
 
+    //获取互斥锁本身，供条件变量等待时使用
+    pthread_mutex_t* get()
+    {
+        return &m_mutex;
+    }
+
 private:
     pthread_mutex_t m_mutex;
 };
@@ -82,25 +88,20 @@ public:
     //创将并初始化条件变量
     cond()
     {
-        if(pthread_mutex_init(&m_mutex, NULL) != 0)
-        throw std::exception();
+        if(pthread_cond_init(&m_cond, NULL) != 0)
+            throw std::exception();
     }
 
     //销毁条件变量
     ~cond()
     {
-        pthread_mutex_destroy(&m_mutex);
         pthread_cond_destroy(&m_cond);
     }
 
-    //等待条件变量
-    bool wait()
+    //等待条件变量，调用者必须已经持有保护条件的互斥锁mutex
+    bool wait(pthread_mutex_t* mutex)
     {
-        int ret = 0;
-        pthread_mutex_lock(&m_mutex);
-        ret = pthread_cond_wait(&m_cond, &m_mutex);
-        pthread_mutex_unlock(&m_mutex);
-        return ret == 0;
+        return pthread_cond_wait(&m_cond, mutex) == 0;
     }
 
     //唤醒等待条件变量的线程
@@ -109,8 +110,13 @@ public:
         return pthread_cond_signal(&m_cond) == 0;
     }
 
+    //唤醒所有等待条件变量的线程
+    bool broadcast()
+    {
+        return pthread_cond_broadcast(&m_cond) == 0;
+    }
+
 private:
-    pthread_mutex_t m_mutex;
     pthread_cond_t m_cond;
 };
 
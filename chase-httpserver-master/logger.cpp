@@ -0,0 +1,227 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "locker.h"
+#include "logger.h"
+
+//一条日志记录，写日志的线程填好以后推进环的写位置，刷盘线程读完以后推进读位置
+struct log_record
+{
+    long long time_ms;
+    int level;
+    int len;
+    char text[logger::TEXT_SIZE];
+};
+
+//单生产者单消费者的环形缓冲区，写位置只由所属线程修改，读位置只由刷盘线程修改
+struct log_ring
+{
+    alignas(64) std::atomic<unsigned int> head;
+    alignas(64) std::atomic<unsigned int> tail;
+    log_record records[logger::RING_RECORDS];
+};
+
+int logger::m_level = logger::LEVEL_OFF;
+std::atomic<long> logger::m_dropped(0);
+
+//所有登记过的环，只增不减，环在进程退出前不释放
+static log_ring* s_rings[logger::MAX_THREADS];
+static std::atomic<int> s_ring_count(0);
+static locker s_register_lock;
+static thread_local log_ring* t_ring = NULL;
+
+static int s_fd = -1;
+static pthread_t s_thread;
+static bool s_running = false;
+static std::atomic<bool> s_stop(false);
+//刷盘线程睡眠的futex字，有环写到一半时加1并唤醒它
+static std::atomic<int> s_futex(0);
+
+static const char* s_level_names[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+
+//当前线程的环，第一次写日志时登记
+static log_ring* ring_of_thread(){
+    if(t_ring){
+        return t_ring;
+    }
+    s_register_lock.lock();
+    int count = s_ring_count.load(std::memory_order_relaxed);
+    if(count < logger::MAX_THREADS){
+        log_ring* ring = new log_ring;
+        ring->head.store(0, std::memory_order_relaxed);
+        ring->tail.store(0, std::memory_order_relaxed);
+        s_rings[count] = ring;
+        s_ring_count.store(count + 1, std::memory_order_release);
+        t_ring = ring;
+    }
+    s_register_lock.unlock();
+    return t_ring;
+}
+
+bool logger::init(int level, const char* path){
+    if(path){
+        s_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if(s_fd < 0){
+            return false;
+        }
+    }else{
+        s_fd = STDOUT_FILENO;
+    }
+    s_stop = false;
+    if(pthread_create(&s_thread, NULL, drain, NULL) != 0){
+        return false;
+    }
+    s_running = true;
+    m_level = level;
+    return true;
+}
+
+void logger::shutdown(){
+    //先关掉所有级别，之后的日志调用直接返回
+    m_level = LEVEL_OFF;
+    if(!s_running){
+        return;
+    }
+    s_stop.store(true, std::memory_order_release);
+    s_futex.fetch_add(1);
+    syscall(SYS_futex, (int*)&s_futex, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    pthread_join(s_thread, NULL);
+    s_running = false;
+    if(s_fd != STDOUT_FILENO){
+        close(s_fd);
+    }
+    s_fd = -1;
+}
+
+int logger::parse_level(const char* name){
+    for(int i = LEVEL_DEBUG; i < LEVEL_OFF; ++i){
+        if(strcasecmp(name, s_level_names[i]) == 0){
+            return i;
+        }
+    }
+    if(strcasecmp(name, "warning") == 0){
+        return LEVEL_WARN;
+    }
+    if(strcasecmp(name, "off") == 0){
+        return LEVEL_OFF;
+    }
+    return -1;
+}
+
+void logger::write(int level, const char* format, ...){
+    log_ring* ring = ring_of_thread();
+    if(!ring){
+        m_dropped++;
+        return;
+    }
+    unsigned int head = ring->head.load(std::memory_order_relaxed);
+    unsigned int used = head - ring->tail.load(std::memory_order_acquire);
+    if(used >= (unsigned int)RING_RECORDS){
+        m_dropped++;
+        return;
+    }
+    log_record* record = &ring->records[head & (RING_RECORDS - 1)];
+    //粗粒度时钟走vDSO，不进内核
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    record->time_ms = (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    record->level = level;
+    va_list arg_list;
+    va_start(arg_list, format);
+    int len = vsnprintf(record->text, TEXT_SIZE, format, arg_list);
+    va_end(arg_list);
+    if(len < 0){
+        len = 0;
+    }else if(len >= TEXT_SIZE){
+        len = TEXT_SIZE - 1;
+    }
+    //换行由刷盘线程统一加
+    while(len > 0 && record->text[len - 1] == '\n'){
+        --len;
+    }
+    record->len = len;
+    ring->head.store(head + 1, std::memory_order_release);
+    //环写到一半时叫醒刷盘线程，平时由它按时间间隔自己醒来
+    if(used + 1 == (unsigned int)RING_RECORDS / 2){
+        s_futex.fetch_add(1);
+        syscall(SYS_futex, (int*)&s_futex, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
+
+static void write_all(const char* data, int len){
+    while(len > 0){
+        int ret = ::write(s_fd, data, len);
+        if(ret <= 0){
+            return;
+        }
+        data += ret;
+        len -= ret;
+    }
+}
+
+int logger::drain_once(char* batch){
+    int count = s_ring_count.load(std::memory_order_acquire);
+    int taken = 0;
+    int used = 0;
+    //时间前缀精确到秒的部分每秒才重新格式化一次
+    static long long s_second = -1;
+    static char s_second_text[32];
+    for(int i = 0; i < count; ++i){
+        log_ring* ring = s_rings[i];
+        unsigned int tail = ring->tail.load(std::memory_order_relaxed);
+        unsigned int head = ring->head.load(std::memory_order_acquire);
+        while(tail != head){
+            log_record* record = &ring->records[tail & (RING_RECORDS - 1)];
+            //时间前缀最长30个字节，级别6个字节，加上换行
+            if(used + 40 + record->len > BATCH_SIZE){
+                write_all(batch, used);
+                used = 0;
+            }
+            long long second = record->time_ms / 1000;
+            if(second != s_second){
+                time_t t = second;
+                struct tm tm;
+                localtime_r(&t, &tm);
+                strftime(s_second_text, sizeof(s_second_text), "%Y-%m-%d %H:%M:%S", &tm);
+                s_second = second;
+            }
+            used += sprintf(batch + used, "%s.%03d %-5s ", s_second_text, (int)(record->time_ms % 1000),
+                            s_level_names[record->level]);
+            memcpy(batch + used, record->text, record->len);
+            used += record->len;
+            batch[used++] = '\n';
+            ++tail;
+            ++taken;
+        }
+        //记录已经拷贝出来，把槽位还给写日志的线程
+        ring->tail.store(tail, std::memory_order_release);
+    }
+    if(used > 0){
+        write_all(batch, used);
+    }
+    return taken;
+}
+
+void* logger::drain(void* arg){
+    char* batch = new char[BATCH_SIZE];
+    struct timespec interval;
+    interval.tv_sec = FLUSH_INTERVAL_MS / 1000;
+    interval.tv_nsec = (FLUSH_INTERVAL_MS % 1000) * 1000000L;
+    while(!s_stop.load(std::memory_order_acquire)){
+        int futex = s_futex.load();
+        drain_once(batch);
+        //睡到下一个间隔，让日志攒成一批；收集期间有环写到一半的话futex字已经变了，马上返回
+        syscall(SYS_futex, (int*)&s_futex, FUTEX_WAIT_PRIVATE, futex, &interval, NULL, 0);
+    }
+    drain_once(batch);
+    delete [] batch;
+    return arg;
+}
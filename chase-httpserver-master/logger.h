@@ -0,0 +1,69 @@
+// 异步日志：按级别过滤的日志，写日志的线程只把格式化好的一条记录放进自己的环形缓冲区，
+// 由后台的刷盘线程轮流收集所有线程的环形缓冲区，攒成一批以后一次write写到日志文件。
+// 每个线程第一次写日志时登记一个单生产者单消费者的无锁环，写日志不加锁也不做系统调用；
+// 没有打开的级别在宏里就被过滤掉，只比较一次整数，不会去格式化参数。
+// note：环满了的时候丢弃新的记录并计数，不阻塞请求处理；不同线程的日志之间只保证大致的时间顺序
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <atomic>
+
+//编译期的最低级别，低于它的日志调用连判断都会被编译器去掉
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL 0
+#endif
+
+class logger
+{
+public:
+    //日志级别，LEVEL_OFF表示关闭所有日志
+    enum LEVEL {LEVEL_DEBUG = 0, LEVEL_INFO, LEVEL_WARN, LEVEL_ERROR, LEVEL_OFF};
+    //一条日志正文的最大长度，超出的部分被截掉
+    static const int TEXT_SIZE = 240;
+    //每个线程的环形缓冲区能存放的记录数，必须是2的幂
+    static const int RING_RECORDS = 1024;
+    //最多登记的线程数，超出的线程写的日志被丢弃
+    static const int MAX_THREADS = 256;
+    //刷盘线程一次write的最大字节数，以及没有新日志时最长多久检查一次
+    static const int BATCH_SIZE = 64 * 1024;
+    static const int FLUSH_INTERVAL_MS = 50;
+
+    //设置级别，打开日志文件（path为NULL时写到标准输出）并启动刷盘线程
+    static bool init(int level, const char* path);
+    //停止刷盘线程，退出前把所有环中剩下的日志写完
+    static void shutdown();
+    //按名字（debug、info、warn、error、off）取级别，不认识的名字返回-1
+    static int parse_level(const char* name);
+
+    static bool enabled(int level) { return level >= m_level; }
+    //格式化一条日志放进当前线程的环形缓冲区，调用前应当先用enabled判断级别
+    static void write(int level, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+    //因为环满了或线程数超出上限而丢弃的日志条数
+    static long dropped() { return m_dropped; }
+
+private:
+    //在刷盘线程中运行
+    static void* drain(void* arg);
+    //把所有环中的记录取出来写到日志文件，返回取出的条数
+    static int drain_once(char* batch);
+
+private:
+    //当前级别，init之前是LEVEL_OFF
+    static int m_level;
+    static std::atomic<long> m_dropped;
+};
+
+#define LOG_AT(level, format, ...) \
+    do{ \
+        if((level) >= LOG_MIN_LEVEL && __builtin_expect(logger::enabled(level), 0)){ \
+            logger::write(level, format, ##__VA_ARGS__); \
+        } \
+    }while(0)
+
+#define LOG_DEBUG(format, ...) LOG_AT(logger::LEVEL_DEBUG, format, ##__VA_ARGS__)
+#define LOG_INFO(format, ...) LOG_AT(logger::LEVEL_INFO, format, ##__VA_ARGS__)
+#define LOG_WARN(format, ...) LOG_AT(logger::LEVEL_WARN, format, ##__VA_ARGS__)
+#define LOG_ERROR(format, ...) LOG_AT(logger::LEVEL_ERROR, format, ##__VA_ARGS__)
+
+#endif
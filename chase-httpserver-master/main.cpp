@@ -13,14 +13,15 @@
 #include "locker.h"
 #include "threadpool.h"
 #include "http_conn.h"
+#include "upload.h"
+#include "mime_types.h"
+#include "reactor.h"
+#include "logger.h"
+#include "metrics.h"
 
 #include <iostream>
  
 #define MAX_FD 65536
-#define MAX_EVENT_NUMBER 10000
-
-extern void addfd( int epollfd, int fd, bool one_shot );
-extern void removefd( int epollfd, int fd );
 const char * doc_root = "/home/dir";//网站的根目录
 
 void addsig( int sig, void( handler )(int), bool restart = true )
@@ -38,23 +39,274 @@ void addsig( int sig, void( handler )(int), bool restart = true )
     assert( sigaction( sig, &sa, NULL ) != -1 );
 }
  
-void show_error( int connfd, const char* info )
-{
-    printf( "%s", info );
-    send( connfd, info, strlen( info ), 0 );
-    close( connfd );
+//下面这一组函数供统计页面在读取时取值
+static reactor** s_reactors = NULL;
+static int s_reactor_number = 0;
+
+static long long reactor_connections(void* arg){
+    return ((reactor*)arg)->m_user_count.load();
+}
+
+static long long reactor_buffers_in_use(void* arg){
+    return ((reactor*)arg)->buffers()->in_use();
+}
+
+static long long reactor_buffers(void* arg){
+    return ((reactor*)arg)->buffers()->capacity();
+}
+
+//arg是超时类型
+static long long timeout_evictions(void* arg){
+    long long total = 0;
+    for(int i = 0; i < s_reactor_number; ++i){
+        total += s_reactors[i]->evictions((int)(long)arg);
+    }
+    return total;
+}
+
+static long long timeout_eviction_ns(void*){
+    long long total = 0;
+    for(int i = 0; i < s_reactor_number; ++i){
+        total += s_reactors[i]->eviction_ns();
+    }
+    return total;
+}
+
+static long long queue_depth(void* arg){
+    return ((threadpool<http_conn>*)arg)->queue_depth();
+}
+
+static long long file_cache_hits(void*) { return http_conn::m_file_cache->hits(); }
+static long long file_cache_misses(void*) { return http_conn::m_file_cache->misses(); }
+static long long object_cache_hits(void*) { return http_conn::m_object_cache->hits(); }
+static long long object_cache_misses(void*) { return http_conn::m_object_cache->misses(); }
+static long long object_cache_bytes(void*) { return http_conn::m_object_cache->bytes(); }
+static long long dir_cache_hits(void*) { return http_conn::m_dir_cache->hits(); }
+static long long dir_cache_misses(void*) { return http_conn::m_dir_cache->misses(); }
+static long long compress_cache_hits(void*) { return http_conn::m_compress_cache->hits(); }
+static long long compress_cache_misses(void*) { return http_conn::m_compress_cache->misses(); }
+static long long compress_cache_bytes(void*) { return http_conn::m_compress_cache->bytes(); }
+static long long access_log_written(void*) { return http_conn::m_access_log->written(); }
+static long long access_log_dropped(void*) { return http_conn::m_access_log->dropped(); }
+static long long log_dropped(void*) { return logger::dropped(); }
+static long long constant_one(void*) { return 1; }
+
+static void register_metrics(reactor** reactors, int reactor_number, threadpool<http_conn>* pool){
+    s_reactors = reactors;
+    s_reactor_number = reactor_number;
+    char** ids = new char*[reactor_number];
+    for(int i = 0; i < reactor_number; ++i){
+        ids[i] = new char[16];
+        snprintf(ids[i], 16, "%d", i);
+    }
+    for(int i = 0; i < reactor_number; ++i){
+        metrics::add_gauge("chase_connections", "Open connections per reactor", "reactor", ids[i],
+                           reactor_connections, reactors[i]);
+    }
+    for(int i = 0; i < reactor_number; ++i){
+        metrics::add_gauge("chase_buffer_blocks_in_use", "Connection buffer blocks in use per reactor", "reactor", ids[i],
+                           reactor_buffers_in_use, reactors[i]);
+    }
+    for(int i = 0; i < reactor_number; ++i){
+        metrics::add_gauge("chase_buffer_blocks", "Connection buffer blocks allocated per reactor", "reactor", ids[i],
+                           reactor_buffers, reactors[i]);
+    }
+    metrics::add_gauge("chase_queue_depth", "Requests waiting in the worker queue", NULL, NULL, queue_depth, pool);
+    static const char* kinds[reactor::TIMEOUT_NUMBER] = {"header", "body", "write", "idle"};
+    for(int i = 0; i < reactor::TIMEOUT_NUMBER; ++i){
+        metrics::add_gauge("chase_timeout_evictions_total", "Connections closed by each kind of timeout", "kind", kinds[i],
+                           timeout_evictions, (void*)(long)i, true);
+    }
+    metrics::add_gauge("chase_timeout_eviction_nanoseconds_total", "Time spent closing timed out connections",
+                       NULL, NULL, timeout_eviction_ns, NULL, true);
+
+    metrics::add_gauge("chase_cache_hits_total", "Cache hits", "cache", "file", file_cache_hits, NULL, true);
+    metrics::add_gauge("chase_cache_hits_total", "Cache hits", "cache", "object", object_cache_hits, NULL, true);
+    metrics::add_gauge("chase_cache_hits_total", "Cache hits", "cache", "dir", dir_cache_hits, NULL, true);
+    metrics::add_gauge("chase_cache_hits_total", "Cache hits", "cache", "compress", compress_cache_hits, NULL, true);
+    metrics::add_gauge("chase_cache_misses_total", "Cache misses", "cache", "file", file_cache_misses, NULL, true);
+    metrics::add_gauge("chase_cache_misses_total", "Cache misses", "cache", "object", object_cache_misses, NULL, true);
+    metrics::add_gauge("chase_cache_misses_total", "Cache misses", "cache", "dir", dir_cache_misses, NULL, true);
+    metrics::add_gauge("chase_cache_misses_total", "Cache misses", "cache", "compress", compress_cache_misses, NULL, true);
+    metrics::add_gauge("chase_cache_bytes", "Memory held by a cache", "cache", "object", object_cache_bytes, NULL);
+    metrics::add_gauge("chase_cache_bytes", "Memory held by a cache", "cache", "compress", compress_cache_bytes, NULL);
+
+    if(http_conn::m_access_log){
+        metrics::add_gauge("chase_access_log_records_total", "Access log records written", NULL, NULL,
+                           access_log_written, NULL, true);
+        metrics::add_gauge("chase_access_log_dropped_total", "Access log records dropped", NULL, NULL,
+                           access_log_dropped, NULL, true);
+    }
+    metrics::add_gauge("chase_log_dropped_total", "Log messages dropped because a ring was full", NULL, NULL,
+                       log_dropped, NULL, true);
+    metrics::add_gauge("chase_parser_info", "Request head scanner selected for this CPU", "implementation",
+                       http_parser::implementation(), constant_one, NULL);
 }
 
 int main( int argc, char* argv[] )
 {
     if( argc <= 1 )
     {
-        printf( "usage: %s ip_address port_number\n", basename( argv[0] ) );
+        printf( "usage: %s port_number [-r reactor_number] [-f sendfile|mmap] [-c cache_capacity] [-i ttl_ms|inotify] [-o object_cache_kb] [-q locked|lockfree|stealing] [-b epoll|uring] [-z compress_cache_kb] [-t header,body,write,idle] [-m mime.types] [-l debug|info|warn|error|off] [-L log_file] [-a access_log[,text|binary[,rotate_mb]]] [-s stats_path|off] [-w upload_limit_mb]\n", basename( argv[0] ) );
         return 1;
     }
     // const char* ip = argv[1];
     int port = atoi( argv[1] );
-    printf("%dport", port);
+
+    //反应堆的数量，默认只有一个；-r 0表示每个在线CPU核一个
+    int reactor_number = 1;
+    //文件缓存的最大条目数和失效方式，默认1024个条目，1秒后重新校验
+    int cache_capacity = 1024;
+    file_cache::INVALIDATE_MODE cache_mode = file_cache::INVALIDATE_TTL;
+    int cache_ttl = 1000;
+    //热点对象缓存的内存预算，单位KB，默认64MB
+    long object_budget = 64 * 1024;
+    //即时压缩缓存的内存预算，单位KB，默认16MB
+    long compress_budget = 16 * 1024;
+    //线程池请求队列的类型
+    threadpool<http_conn>::QUEUE_MODE queue_mode = threadpool<http_conn>::QUEUE_LOCKED;
+    //日志级别和日志文件，默认info级别，写到标准输出
+    int log_level = logger::LEVEL_INFO;
+    const char* log_file = NULL;
+    //访问日志的路径、格式和轮转大小（MB），默认不记录访问日志
+    const char* access_path = NULL;
+    access_log::FORMAT access_format = access_log::FORMAT_TEXT;
+    long access_rotate = 0;
+    int opt;
+    //argv[1]是端口号，从它后面开始解析选项
+    while((opt = getopt(argc - 1, argv + 1, "r:f:c:i:o:q:b:z:t:m:l:L:a:s:w:")) != -1){
+        switch(opt){
+            case 'r':
+                reactor_number = atoi(optarg);
+                break;
+            case 'f':
+                //文件的发送方式，默认sendfile，mmap作为备选
+                if(strcmp(optarg, "mmap") == 0){
+                    http_conn::m_send_mode = http_conn::SEND_MMAP;
+                }else if(strcmp(optarg, "sendfile") == 0){
+                    http_conn::m_send_mode = http_conn::SEND_SENDFILE;
+                }else{
+                    return 1;
+                }
+                break;
+            case 'c':
+                cache_capacity = atoi(optarg);
+                break;
+            case 'i':
+                if(strcmp(optarg, "inotify") == 0){
+                    cache_mode = file_cache::INVALIDATE_INOTIFY;
+                }else{
+                    cache_mode = file_cache::INVALIDATE_TTL;
+                    cache_ttl = atoi(optarg);
+                }
+                break;
+            case 'o':
+                object_budget = atol(optarg);
+                break;
+            case 'q':
+                if(strcmp(optarg, "lockfree") == 0){
+                    queue_mode = threadpool<http_conn>::QUEUE_LOCKFREE;
+                }else if(strcmp(optarg, "stealing") == 0){
+                    queue_mode = threadpool<http_conn>::QUEUE_STEALING;
+                }else if(strcmp(optarg, "locked") == 0){
+                    queue_mode = threadpool<http_conn>::QUEUE_LOCKED;
+                }else{
+                    return 1;
+                }
+                break;
+            case 'z':
+                compress_budget = atol(optarg);
+                break;
+            case 't':{
+                //各类超时的期限，单位秒，用逗号隔开，依次是请求头、消息体、发送停滞、keep-alive空闲，0表示不限制
+                char* p = optarg;
+                for(int i = 0; i < reactor::TIMEOUT_NUMBER && *p; ++i){
+                    reactor::m_timeout_ms[i] = strtol(p, &p, 10) * 1000;
+                    if(*p == ','){
+                        ++p;
+                    }
+                }
+                break;
+            }
+            case 'm':
+                //在内置的MIME类型之外从mime.types文件加入更多扩展名，要在chdir之前读
+                if(mime_types::load(optarg) < 0){
+                    perror("mime.types");
+                    return 1;
+                }
+                break;
+            case 'l':
+                log_level = logger::parse_level(optarg);
+                if(log_level < 0){
+                    return 1;
+                }
+                break;
+            case 'L':
+                log_file = optarg;
+                break;
+            case 'a':{
+                //路径后面可以跟格式和轮转大小，用逗号隔开
+                char* comma = strchr(optarg, ',');
+                access_path = optarg;
+                if(comma){
+                    *comma = '\0';
+                    char* format = comma + 1;
+                    comma = strchr(format, ',');
+                    if(comma){
+                        *comma = '\0';
+                        access_rotate = atol(comma + 1) * 1024 * 1024;
+                    }
+                    int ret = access_log::parse_format(format);
+                    if(ret < 0){
+                        return 1;
+                    }
+                    access_format = (access_log::FORMAT)ret;
+                }
+                break;
+            }
+            case 's':
+                //统计页面的路径，off表示关闭
+                http_conn::m_stats_path = strcmp(optarg, "off") == 0 ? NULL : optarg;
+                break;
+            case 'w':
+                //打开PUT/POST上传，参数是消息体的上限（MB），0表示不限制；默认不接受上传
+                http_conn::m_upload_limit = atoll(optarg) * 1024 * 1024;
+                if(http_conn::m_upload_limit < 0){
+                    return 1;
+                }
+                break;
+            case 'b':
+                //反应堆的I/O后端，默认epoll
+                if(strcmp(optarg, "uring") == 0){
+                    reactor::m_backend = reactor::BACKEND_URING;
+                }else if(strcmp(optarg, "epoll") == 0){
+                    reactor::m_backend = reactor::BACKEND_EPOLL;
+                }else{
+                    return 1;
+                }
+                break;
+            default:
+                return 1;
+        }
+    }
+    if(reactor_number <= 0){
+        reactor_number = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+
+    //日志文件的相对路径按启动时的目录算，要在chdir之前打开
+    if(!logger::init(log_level, log_file)){
+        perror("log file");
+        return 1;
+    }
+    LOG_INFO("listen on port %d", port);
+    if(access_path){
+        try{
+            http_conn::m_access_log = new access_log(access_path, access_format, access_rotate);
+        }catch(...){
+            perror("access log");
+            return 1;
+        }
+    }
 
     //改变进程工作目录
     int retchdir = chdir(doc_root);
@@ -62,120 +314,71 @@ int main( int argc, char* argv[] )
         perror("chdir error");
         exit(1);
     }
+    //上传的文件都相对网站根目录的fd创建
+    if(http_conn::m_upload_limit >= 0){
+        upload::m_root_fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if(upload::m_root_fd < 0){
+            perror("doc root");
+            exit(1);
+        }
+    }
 
     //忽略SIGPIPE信号,像一个读端关闭的管道或者socket连接中写数据将引发该信号，
     //我们应该忽略这个信号，因为程序接收到这个信号的默认行为是结束进程
     addsig(SIGPIPE, SIG_IGN);
 
+    //创建所有工作线程共享的文件缓存
+    try{
+        http_conn::m_file_cache = new file_cache(cache_capacity, cache_mode, cache_ttl, http_conn::get_file_type);
+        http_conn::m_object_cache = new object_cache(object_budget * 1024);
+        http_conn::m_dir_cache = new dir_cache(256, http_conn::build_dir_listing);
+        http_conn::m_compress_cache = new compress_cache(compress_budget * 1024);
+    }catch(...){
+        return 1;
+    }
+
     //创建线程池
     threadpool<http_conn>* pool = NULL;
     try{
-        pool = new threadpool<http_conn>(10, 20);
+        pool = new threadpool<http_conn>(10, 10000, queue_mode);
     }catch(...){
         return 1;
     }
 
-    //预先为每个可能的客户连接分配一个http_conn对象
-    http_conn* users = new http_conn[MAX_FD];
+    //所有反应堆共用这张按fd下标索引的连接表，表中只放指针，连接对象由反应堆在fd第一次出现时创建
+    http_conn** users = new http_conn*[MAX_FD]();
     assert(users);
-    int user_count = 0;
-
-    int listenfd = socket(PF_INET, SOCK_STREAM, 0);
-    assert(listenfd >= 0);
-    //这样设置的话，当调用close,TCP连接会立即断开，sendbuffer中未被发送的数据被丢弃，并向
-    //对方发送发送一个RST信息.值得注意的是，由于这种方式，是非正常的4中握手方式结束TCP链接，
-    //所以，TCP连接将不会进入TIME_WAIT状态
-    struct linger tmp = {1, 0};
-    /*设置优雅断开
-    #include <arpa/inet.h>
-    struct linger {
-　　    int l_onoff;
-　　    int l_linger;
-    };
-    三种断开方式：
-
-    1. l_onoff = 0; l_linger忽略
-    close()立刻返回，底层会将未发送完的数据发送完成后再释放资源，即优雅退出。
-
-    2. l_onoff != 0; l_linger = 0;
-    close()立刻返回，但不会发送未发送完成的数据，而是通过一个REST包强制的关闭socket描述符，即强制退出。
-
-    3. l_onoff != 0; l_linger > 0;
-    close()不会立刻返回，内核会延迟一段时间，这个时间就由l_linger的值来决定。如果超时时间到达之前，发送
-    完未发送的数据(包括FIN包)并得到另一端的确认，close()会返回正确，socket描述符优雅性退出。否则，close()
-    会直接返回错误值，未发送数据丢失，socket描述符被强制性退出。需要注意的时，如果socket描述符被设置为非堵
-    塞型，则close()会直接返回值。
-    */
-    setsockopt(listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
-
-    int ret = 0;
-    struct sockaddr_in address;
-    bzero(&address, sizeof(address));
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = htonl(INADDR_ANY);
-    address.sin_port = htons(port);
-
-    ret = bind(listenfd, (struct sockaddr*)&address, sizeof(address));
-    assert(ret >= -1);
-
-    ret = listen(listenfd, 5);
-    assert(ret >= -1);
-
-    epoll_event events[MAX_EVENT_NUMBER];
-    int epollfd = epoll_create(5);
-    assert(epollfd != -1);
-    addfd(epollfd, listenfd, false);
-    http_conn::m_epollfd = epollfd;
-
-    printf("while！\n");
-    while(true){
-        printf("epoll wait!\n");
-        int number = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, -1);
-        if((number < 0) && (errno != EINTR)){
-            printf("epoll failure\n");
-            break;
-        }
-        for(int i = 0; i < number; i++){
-            int sockfd = events[i].data.fd;
-            if(sockfd == listenfd){
-                struct sockaddr_in client_address;
-                socklen_t client_addrlength = sizeof(client_address);
-                printf("wait listen accpt!\n");
-                int connfd = accept(listenfd, (struct sockaddr*)&client_address, &client_addrlength);
-                printf("get listen accpt!\n");
-                if(connfd < 0){
-                    printf("errno is : %d\n", errno);
-                    continue;
-                }
-                if(http_conn::m_user_count >= MAX_FD){
-                    show_error(connfd, "Internal server busy");
-                    continue;
-                }
-                //初始化客户连接
-                users[connfd].init(connfd, client_address);
-            }else if(events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)){
-                //如果有异常直接关闭客户连接
-                users[sockfd].close_conn();
-            }else if(events[i].events & EPOLLIN){
-                //根据读的结果，决定是将任务添加到线程池还是关闭连接
-                if(users[sockfd].read()){
-                    pool->append(users + sockfd);
-                }else{
-                    users[sockfd].close_conn();
-                }
-            }else if(events[i].events & EPOLLOUT){
-                //根据写的结果，决定是否关闭连接
-                if(!users[sockfd].write()){
-                    users[sockfd].close_conn();
-                }
-            }else{
 
-            }
+    //每个反应堆一个线程、一个epoll和一个SO_REUSEPORT监听socket
+    reactor** reactors = new reactor*[reactor_number];
+    for(int i = 0; i < reactor_number; ++i){
+        reactors[i] = new reactor(i, port, users, MAX_FD, pool);
+    }
+    //统计页面读取的量要在反应堆开始接收请求之前登记好
+    register_metrics(reactors, reactor_number, pool);
+    for(int i = 0; i < reactor_number; ++i){
+        if(!reactors[i]->start()){
+            LOG_ERROR("start the %dth reactor failed", i);
+            logger::shutdown();
+            return 1;
         }
     }
-    close(epollfd);
-    close(listenfd);
+
+    for(int i = 0; i < reactor_number; ++i){
+        reactors[i]->join();
+        delete reactors[i];
+    }
+    delete [] reactors;
+    for(int i = 0; i < MAX_FD; ++i){
+        delete users[i];
+    }
     delete [] users;
     delete pool;
+    delete http_conn::m_compress_cache;
+    delete http_conn::m_dir_cache;
+    delete http_conn::m_object_cache;
+    delete http_conn::m_file_cache;
+    delete http_conn::m_access_log;
+    logger::shutdown();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,279 @@
+#include <stdio.h>
+#include <time.h>
+#include <string.h>
+#include <stdarg.h>
+#include <vector>
+
+#include "locker.h"
+#include "metrics.h"
+
+//一个线程的那一份指标，只由这个线程写。计数器的加法是“读出来加一再写回去”，没有竞争，
+//用原子变量只是为了让读取线程读到完整的值
+struct thread_metrics
+{
+    std::atomic<long long> responses[metrics::STATUS_NUMBER];
+    std::atomic<long long> bytes;
+    latency_histogram latency[metrics::LATENCY_NUMBER];
+};
+
+struct gauge
+{
+    const char* name;
+    const char* help;
+    const char* label_name;
+    const char* label_value;
+    metrics::gauge_function function;
+    void* arg;
+    bool counter;
+};
+
+//所有登记过的线程，只增不减
+static thread_metrics* s_threads[metrics::MAX_THREADS];
+static std::atomic<int> s_thread_count(0);
+static locker s_register_lock;
+static thread_local thread_metrics* t_metrics = NULL;
+static std::vector<gauge> s_gauges;
+
+static const int s_status_codes[metrics::STATUS_NUMBER] = {200, 206, 304, 400, 403, 404, 416, 500, 0};
+static const char* s_latency_names[metrics::LATENCY_NUMBER] = {"queue_wait", "parse", "time_to_last_byte"};
+static const char* s_latency_help[metrics::LATENCY_NUMBER] = {
+    "Time a request waited in the worker queue",
+    "Time spent parsing a request",
+    "Time from the first request byte to the last response byte"
+};
+
+static inline void bump(std::atomic<long long>& counter, long long value){
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+int latency_histogram::bucket_of(long long ns){
+    if(ns < 2 * SUB_COUNT){
+        return ns > 0 ? (int)ns : 0;
+    }
+    int exponent = 63 - __builtin_clzll(ns);
+    if(exponent >= MAX_EXPONENT){
+        return BUCKET_NUMBER - 1;
+    }
+    int sub = (ns >> (exponent - SUB_BITS)) & (SUB_COUNT - 1);
+    return 2 * SUB_COUNT + (exponent - SUB_BITS - 1) * SUB_COUNT + sub;
+}
+
+long long latency_histogram::bucket_upper(int i){
+    if(i < 2 * SUB_COUNT){
+        return i;
+    }
+    int exponent = (i - 2 * SUB_COUNT) / SUB_COUNT + SUB_BITS + 1;
+    int sub = (i - 2 * SUB_COUNT) % SUB_COUNT;
+    long long lower = (long long)(SUB_COUNT + sub) << (exponent - SUB_BITS);
+    return lower + (1LL << (exponent - SUB_BITS)) - 1;
+}
+
+void latency_histogram::record(long long ns){
+    bump(m_buckets[bucket_of(ns)], 1);
+    bump(m_count, 1);
+    bump(m_sum, ns > 0 ? ns : 0);
+}
+
+void latency_histogram::merge(const latency_histogram& other){
+    for(int i = 0; i < BUCKET_NUMBER; ++i){
+        bump(m_buckets[i], other.bucket(i));
+    }
+    bump(m_count, other.count());
+    bump(m_sum, other.sum());
+}
+
+long long latency_histogram::quantile(double q) const{
+    long long total = 0;
+    for(int i = 0; i < BUCKET_NUMBER; ++i){
+        total += bucket(i);
+    }
+    if(total == 0){
+        return 0;
+    }
+    long long rank = (long long)(q * total);
+    if(rank >= total){
+        rank = total - 1;
+    }
+    long long seen = 0;
+    for(int i = 0; i < BUCKET_NUMBER; ++i){
+        seen += bucket(i);
+        if(seen > rank){
+            return bucket_upper(i);
+        }
+    }
+    return bucket_upper(BUCKET_NUMBER - 1);
+}
+
+//当前线程的那一份，第一次记录时登记
+static thread_metrics* local(){
+    if(t_metrics){
+        return t_metrics;
+    }
+    s_register_lock.lock();
+    int count = s_thread_count.load(std::memory_order_relaxed);
+    if(count < metrics::MAX_THREADS){
+        //值初始化，所有计数器从0开始
+        thread_metrics* m = new thread_metrics();
+        s_threads[count] = m;
+        s_thread_count.store(count + 1, std::memory_order_release);
+        t_metrics = m;
+    }
+    s_register_lock.unlock();
+    return t_metrics;
+}
+
+long long metrics::now_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void metrics::add_response(int status, long long bytes){
+    thread_metrics* m = local();
+    if(!m){
+        return;
+    }
+    int index = STATUS_OTHER;
+    for(int i = 0; i < STATUS_OTHER; ++i){
+        if(s_status_codes[i] == status){
+            index = i;
+            break;
+        }
+    }
+    bump(m->responses[index], 1);
+    bump(m->bytes, bytes);
+}
+
+void metrics::add_latency(int kind, long long ns){
+    thread_metrics* m = local();
+    if(m){
+        m->latency[kind].record(ns);
+    }
+}
+
+void metrics::add_gauge(const char* name, const char* help, const char* label_name, const char* label_value,
+                        gauge_function function, void* arg, bool counter){
+    gauge g = {name, help, label_name, label_value, function, arg, counter};
+    s_gauges.push_back(g);
+}
+
+//读取时把所有线程的指标加起来
+struct metrics_total
+{
+    long long responses[metrics::STATUS_NUMBER];
+    long long bytes;
+    latency_histogram latency[metrics::LATENCY_NUMBER];
+};
+
+static metrics_total* collect(){
+    metrics_total* total = new metrics_total();
+    int count = s_thread_count.load(std::memory_order_acquire);
+    for(int i = 0; i < count; ++i){
+        thread_metrics* m = s_threads[i];
+        for(int j = 0; j < metrics::STATUS_NUMBER; ++j){
+            total->responses[j] += m->responses[j].load(std::memory_order_relaxed);
+        }
+        total->bytes += m->bytes.load(std::memory_order_relaxed);
+        for(int j = 0; j < metrics::LATENCY_NUMBER; ++j){
+            total->latency[j].merge(m->latency[j]);
+        }
+    }
+    return total;
+}
+
+static void append(std::string& out, const char* format, ...) __attribute__((format(printf, 2, 3)));
+static void append(std::string& out, const char* format, ...){
+    char buf[512];
+    va_list arg_list;
+    va_start(arg_list, format);
+    int len = vsnprintf(buf, sizeof(buf), format, arg_list);
+    va_end(arg_list);
+    if(len > 0){
+        out.append(buf, len < (int)sizeof(buf) ? len : sizeof(buf) - 1);
+    }
+}
+
+void metrics::render_prometheus(std::string& out){
+    metrics_total* total = collect();
+    long long requests = 0;
+    append(out, "# HELP chase_responses_total Responses by status code\n# TYPE chase_responses_total counter\n");
+    for(int i = 0; i < STATUS_NUMBER; ++i){
+        requests += total->responses[i];
+        if(i == STATUS_OTHER){
+            append(out, "chase_responses_total{code=\"other\"} %lld\n", total->responses[i]);
+        }else{
+            append(out, "chase_responses_total{code=\"%d\"} %lld\n", s_status_codes[i], total->responses[i]);
+        }
+    }
+    append(out, "# HELP chase_requests_total Requests answered\n# TYPE chase_requests_total counter\n"
+                "chase_requests_total %lld\n", requests);
+    append(out, "# HELP chase_sent_bytes_total Bytes handed to the kernel, headers included\n"
+                "# TYPE chase_sent_bytes_total counter\nchase_sent_bytes_total %lld\n", total->bytes);
+
+    //直方图的桶按2的幂合并，从1微秒左右到一分钟左右
+    for(int kind = 0; kind < LATENCY_NUMBER; ++kind){
+        const latency_histogram& h = total->latency[kind];
+        const char* name = s_latency_names[kind];
+        append(out, "# HELP chase_%s_seconds %s\n# TYPE chase_%s_seconds histogram\n", name, s_latency_help[kind], name);
+        long long cumulative = 0;
+        int i = 0;
+        for(int exponent = 10; exponent <= 36; ++exponent){
+            long long bound = (1LL << exponent) - 1;
+            while(i < latency_histogram::BUCKET_NUMBER && latency_histogram::bucket_upper(i) <= bound){
+                cumulative += h.bucket(i++);
+            }
+            append(out, "chase_%s_seconds_bucket{le=\"%.9g\"} %lld\n", name, (double)(bound + 1) / 1e9, cumulative);
+        }
+        append(out, "chase_%s_seconds_bucket{le=\"+Inf\"} %lld\n", name, h.count());
+        append(out, "chase_%s_seconds_sum %.9f\n", name, (double)h.sum() / 1e9);
+        append(out, "chase_%s_seconds_count %lld\n", name, h.count());
+    }
+    delete total;
+
+    const char* last = NULL;
+    for(size_t i = 0; i < s_gauges.size(); ++i){
+        const gauge& g = s_gauges[i];
+        //同名的量连续登记，HELP和TYPE只输出一次
+        if(!last || strcmp(last, g.name) != 0){
+            append(out, "# HELP %s %s\n# TYPE %s %s\n", g.name, g.help, g.name, g.counter ? "counter" : "gauge");
+            last = g.name;
+        }
+        if(g.label_name){
+            append(out, "%s{%s=\"%s\"} %lld\n", g.name, g.label_name, g.label_value, g.function(g.arg));
+        }else{
+            append(out, "%s %lld\n", g.name, g.function(g.arg));
+        }
+    }
+}
+
+void metrics::render_json(std::string& out){
+    metrics_total* total = collect();
+    long long requests = 0;
+    out += "{\"responses\":{";
+    for(int i = 0; i < STATUS_NUMBER; ++i){
+        requests += total->responses[i];
+        if(i == STATUS_OTHER){
+            append(out, "\"other\":%lld", total->responses[i]);
+        }else{
+            append(out, "\"%d\":%lld,", s_status_codes[i], total->responses[i]);
+        }
+    }
+    append(out, "},\"requests\":%lld,\"sent_bytes\":%lld,\"latency_ns\":{", requests, total->bytes);
+    for(int kind = 0; kind < LATENCY_NUMBER; ++kind){
+        const latency_histogram& h = total->latency[kind];
+        append(out, "%s\"%s\":{\"count\":%lld,\"sum\":%lld,\"p50\":%lld,\"p90\":%lld,\"p99\":%lld,\"p999\":%lld,\"max\":%lld}",
+               kind ? "," : "", s_latency_names[kind], h.count(), h.sum(), h.quantile(0.5), h.quantile(0.9),
+               h.quantile(0.99), h.quantile(0.999), h.quantile(1));
+    }
+    delete total;
+    out += "},\"gauges\":[";
+    for(size_t i = 0; i < s_gauges.size(); ++i){
+        const gauge& g = s_gauges[i];
+        append(out, "%s{\"name\":\"%s\",", i ? "," : "", g.name);
+        if(g.label_name){
+            append(out, "\"labels\":{\"%s\":\"%s\"},", g.label_name, g.label_value);
+        }
+        append(out, "\"value\":%lld}", g.function(g.arg));
+    }
+    out += "]}\n";
+}
@@ -0,0 +1,80 @@
+// 运行指标：每个线程一份计数器和延迟直方图，只由所属线程写，记录时不加锁也不用带lock前缀的原子指令；
+// 读取时把所有线程的那一份加起来。延迟直方图是HDR风格的对数线性分桶：每个2的幂区间再均分成8个子桶，
+// 相对误差在12.5%以内，从1纳秒到十几分钟一共三百多个桶。
+// 另外可以登记一些读取时才去取值的量（连接数、队列深度、缓存命中数等），统计页面把它们一起输出成
+// Prometheus文本格式或者JSON。
+// note：线程第一次记录时登记自己的那一份，之后一直保留到进程退出；读取不会和写入互斥，
+// 读到的是各个计数器在读取时刻附近的值，不保证彼此严格一致
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <string>
+
+//HDR风格的延迟直方图，单位纳秒
+class latency_histogram
+{
+public:
+    //每个2的幂区间的子桶数是2^SUB_BITS
+    static const int SUB_BITS = 3;
+    static const int SUB_COUNT = 1 << SUB_BITS;
+    //最大能区分的值是2^MAX_EXPONENT纳秒，更大的值都算进最后一个桶
+    static const int MAX_EXPONENT = 40;
+    static const int BUCKET_NUMBER = 2 * SUB_COUNT + (MAX_EXPONENT - SUB_BITS - 1) * SUB_COUNT;
+
+    //只能由所属线程调用
+    void record(long long ns);
+    //把另一个直方图的计数加到这个直方图上，用于读取时汇总
+    void merge(const latency_histogram& other);
+    //第q分位（0到1之间）的近似值，取所在桶的上界
+    long long quantile(double q) const;
+    long long count() const { return m_count.load(std::memory_order_relaxed); }
+    long long sum() const { return m_sum.load(std::memory_order_relaxed); }
+    long long bucket(int i) const { return m_buckets[i].load(std::memory_order_relaxed); }
+
+    static int bucket_of(long long ns);
+    //第i个桶中最大的值
+    static long long bucket_upper(int i);
+
+private:
+    std::atomic<long long> m_buckets[BUCKET_NUMBER];
+    std::atomic<long long> m_count;
+    std::atomic<long long> m_sum;
+};
+
+class metrics
+{
+public:
+    //分别统计的状态码，其他状态码算在STATUS_OTHER
+    enum STATUS {STATUS_200 = 0, STATUS_206, STATUS_304, STATUS_400, STATUS_403, STATUS_404, STATUS_416, STATUS_500,
+                 STATUS_OTHER, STATUS_NUMBER};
+    //延迟的种类
+    //LATENCY_QUEUE  连接从反应堆放进请求队列到工作线程开始处理
+    //LATENCY_PARSE  工作线程解析请求花的时间
+    //LATENCY_TOTAL  从收到请求的第一个字节到响应的最后一个字节交给内核
+    enum LATENCY {LATENCY_QUEUE = 0, LATENCY_PARSE, LATENCY_TOTAL, LATENCY_NUMBER};
+    //最多登记的线程数，超出的线程记录的指标被丢弃
+    static const int MAX_THREADS = 256;
+
+    //读取时才取值的量，arg是登记时给的参数
+    typedef long long (*gauge_function)(void* arg);
+
+    //CLOCK_MONOTONIC，纳秒
+    static long long now_ns();
+
+    //下面这一组函数由请求处理线程调用，记到当前线程的那一份上
+    //一个响应结束：状态码和发送的字节数
+    static void add_response(int status, long long bytes);
+    static void add_latency(int kind, long long ns);
+
+    //登记一个读取时才取值的量。name是指标名，label_name和label_value是可选的一个标签（可以为NULL），
+    //counter为true时按只增不减的计数器输出。只能在工作线程启动之前调用
+    static void add_gauge(const char* name, const char* help, const char* label_name, const char* label_value,
+                          gauge_function function, void* arg, bool counter = false);
+
+    //汇总所有线程的指标，生成Prometheus文本格式或者JSON
+    static void render_prometheus(std::string& out);
+    static void render_json(std::string& out);
+};
+
+#endif
@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "mime_types.h"
+#include "perfect_hash.h"
+
+static const char* const DEFAULT_TYPE = "text/plain; charset=utf-8";
+
+//内置的扩展名和对应的类型，两张表下标一一对应
+static constexpr const char* const s_builtin_exts[] = {
+    "html", "htm", "jpg", "jpeg", "gif", "png", "css", "js", "mjs", "json", "xml", "svg", "ico", "webp", "mp4", "pdf",
+    "gz", "wasm", "au", "wav", "avi", "mov", "qt", "mpeg", "mpe", "vrml", "wrl", "midi", "mid", "mp3", "ogg", "pac"
+};
+static const char* const s_builtin_types[] = {
+    "text/html; charset=utf-8", "text/html; charset=utf-8", "image/jpeg", "image/jpeg", "image/gif", "image/png",
+    "text/css", "application/javascript", "application/javascript", "application/json", "application/xml",
+    "image/svg+xml", "image/x-icon", "image/webp", "video/mp4", "application/pdf", "application/gzip", "application/wasm",
+    "audio/basic", "audio/wav", "video/x-msvideo", "video/quicktime", "video/quicktime", "video/mpeg", "video/mpeg",
+    "model/vrml", "model/vrml", "audio/midi", "audio/midi", "audio/mpeg", "application/ogg",
+    "application/x-ns-proxy-autoconfig"
+};
+static const int BUILTIN_NUMBER = sizeof(s_builtin_exts) / sizeof(s_builtin_exts[0]);
+static_assert(BUILTIN_NUMBER == sizeof(s_builtin_types) / sizeof(s_builtin_types[0]), "mime table mismatch");
+
+static constexpr static_perfect_hash<BUILTIN_NUMBER, 128> s_builtin(s_builtin_exts);
+
+//运行时生成的表：关键字先按第一次哈希分到桶里，每个桶找一个位移，使桶里的关键字按这个位移哈希到空闲且互不相同的槽位。
+//查找时先用第一次哈希取桶的位移，再用位移算出槽位，比较一次扩展名
+struct runtime_table
+{
+    std::vector<std::string> exts;
+    std::vector<std::string> types;
+    std::vector<unsigned int> displace;
+    std::vector<int> slot;
+};
+static runtime_table* s_runtime = NULL;
+
+static unsigned int round_pow2(unsigned int n){
+    unsigned int size = 1;
+    while(size < n){
+        size <<= 1;
+    }
+    return size;
+}
+
+static bool build(runtime_table* table, unsigned int slots){
+    int n = table->exts.size();
+    unsigned int buckets = round_pow2((n + 3) / 4);
+    std::vector<std::vector<int> > members(buckets);
+    for(int k = 0; k < n; ++k){
+        const std::string& ext = table->exts[k];
+        members[ph_hash(ext.data(), ext.size(), 0) & (buckets - 1)].push_back(k);
+    }
+    //先安排关键字多的桶，空位多的时候容易找到位移
+    std::vector<unsigned int> order(buckets);
+    for(unsigned int b = 0; b < buckets; ++b){
+        order[b] = b;
+    }
+    std::sort(order.begin(), order.end(), [&members](unsigned int a, unsigned int b){
+        return members[a].size() > members[b].size();
+    });
+    table->displace.assign(buckets, 0);
+    table->slot.assign(slots, -1);
+    std::vector<unsigned int> taken;
+    for(unsigned int i = 0; i < buckets && !members[order[i]].empty(); ++i){
+        const std::vector<int>& keys = members[order[i]];
+        bool placed = false;
+        for(unsigned int d = 1; d < 65536 && !placed; ++d){
+            taken.clear();
+            placed = true;
+            for(size_t j = 0; j < keys.size() && placed; ++j){
+                const std::string& ext = table->exts[keys[j]];
+                unsigned int s = ph_hash(ext.data(), ext.size(), d) & (slots - 1);
+                if(table->slot[s] >= 0 || std::find(taken.begin(), taken.end(), s) != taken.end()){
+                    placed = false;
+                }
+                taken.push_back(s);
+            }
+            if(placed){
+                for(size_t j = 0; j < keys.size(); ++j){
+                    table->slot[taken[j]] = keys[j];
+                }
+                table->displace[order[i]] = d;
+            }
+        }
+        if(!placed){
+            return false;
+        }
+    }
+    return true;
+}
+
+static const char* find(const char* ext, int len){
+    if(!s_runtime){
+        int k = s_builtin.find(s_builtin_exts, ext, len);
+        return k < 0 ? DEFAULT_TYPE : s_builtin_types[k];
+    }
+    const runtime_table* table = s_runtime;
+    unsigned int d = table->displace[ph_hash(ext, len, 0) & (table->displace.size() - 1)];
+    int k = table->slot[ph_hash(ext, len, d) & (table->slot.size() - 1)];
+    if(k < 0 || (int)table->exts[k].size() != len || strncasecmp(table->exts[k].data(), ext, len) != 0){
+        return DEFAULT_TYPE;
+    }
+    return table->types[k].c_str();
+}
+
+const char* mime_types::lookup(const char* name){
+    // 自右向左查找‘.’字符, 如不存在按纯文本处理
+    const char* dot = strrchr(name, '.');
+    if(dot == NULL){
+        return DEFAULT_TYPE;
+    }
+    return find(dot + 1, strlen(dot + 1));
+}
+
+int mime_types::load(const char* path){
+    FILE* fp = fopen(path, "r");
+    if(!fp){
+        return -1;
+    }
+    //扩展名统一转成小写，最后放入内置类型，内置的扩展名保持原来的类型（比如html带着charset）
+    std::unordered_map<std::string, std::string> merged;
+    int count = 0;
+    char line[1024];
+    while(fgets(line, sizeof(line), fp)){
+        char* hash = strchr(line, '#');
+        if(hash){
+            *hash = '\0';
+        }
+        char* save = NULL;
+        char* type = strtok_r(line, " \t\r\n", &save);
+        if(!type){
+            continue;
+        }
+        char* ext;
+        while((ext = strtok_r(NULL, " \t\r\n", &save)) != NULL){
+            std::string key(ext);
+            std::transform(key.begin(), key.end(), key.begin(), ph_lower);
+            merged[key] = type;
+            count++;
+        }
+    }
+    fclose(fp);
+    for(int k = 0; k < BUILTIN_NUMBER; ++k){
+        merged[s_builtin_exts[k]] = s_builtin_types[k];
+    }
+
+    runtime_table* table = new runtime_table;
+    for(auto it = merged.begin(); it != merged.end(); ++it){
+        table->exts.push_back(it->first);
+        table->types.push_back(it->second);
+    }
+    //槽位数从关键字数的两倍开始，找不到位移就加倍
+    unsigned int slots = round_pow2(table->exts.size() * 2);
+    while(!build(table, slots)){
+        slots <<= 1;
+    }
+    delete s_runtime;
+    s_runtime = table;
+    return count;
+}
+
+int mime_types::size(){
+    return s_runtime ? s_runtime->exts.size() : BUILTIN_NUMBER;
+}
@@ -0,0 +1,18 @@
+// MIME类型表：按扩展名查文件的MIME类型。内置的常用类型是编译期生成的完美哈希表，
+// 启动时可以从mime.types格式的文件加入更多扩展名，这时把内置类型和文件中的类型合在一起重新生成一张完美哈希表。
+// note：内置的扩展名不被文件覆盖，文件只增加新的扩展名；load只能在工作线程启动之前调用，之后表只读，查找不加锁
+#ifndef MIME_TYPES_H
+#define MIME_TYPES_H
+
+class mime_types
+{
+public:
+    //按文件名的扩展名取MIME类型，没有扩展名或者不认识的扩展名按纯文本处理
+    static const char* lookup(const char* name);
+    //读入mime.types格式的文件（每行一个类型加若干扩展名，#开头是注释），返回读到的扩展名个数，打不开文件时返回-1
+    static int load(const char* path);
+    //表中的扩展名个数
+    static int size();
+};
+
+#endif
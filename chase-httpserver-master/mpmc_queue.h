@@ -0,0 +1,167 @@
+// 无锁的有界多生产者多消费者队列（环形缓冲区）。每个槽位带一个序号，生产者和消费者各自用CAS推进
+// 入队位置和出队位置，槽位的序号告诉它这个槽位当前是空的还是满的，不需要任何互斥锁，也不需要为每个元素分配内存。
+// 支持批量入队和批量出队：一次CAS占下连续的多个槽位。
+// note：容量会向上取整到2的幂；队列只负责存取，空的时候怎么等待由使用者决定
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <exception>
+
+template<typename T>
+class mpmc_queue
+{
+public:
+    explicit mpmc_queue(size_t capacity);
+    ~mpmc_queue();
+
+    //入队一个元素，队列满时返回false
+    bool push(const T& data);
+    //出队一个元素，队列空时返回false
+    bool pop(T& data);
+    //批量入队，返回实际入队的个数，可能小于n
+    int push_batch(const T* data, int n);
+    //批量出队，最多取n个，返回实际取出的个数
+    int pop_batch(T* data, int n);
+    //队列中元素个数的近似值
+    size_t size() const;
+
+private:
+    struct cell
+    {
+        //序号等于pos表示槽位空着，等待位置为pos的生产者；等于pos+1表示槽位满了，等待位置为pos的消费者
+        std::atomic<size_t> seq;
+        T data;
+    };
+
+    cell* m_buffer;
+    size_t m_mask;
+    //入队位置和出队位置分别放在不同的缓存行上，避免生产者和消费者之间的伪共享
+    alignas(64) std::atomic<size_t> m_enqueue_pos;
+    alignas(64) std::atomic<size_t> m_dequeue_pos;
+};
+
+template<typename T>
+mpmc_queue<T>::mpmc_queue(size_t capacity): m_buffer(NULL), m_mask(0){
+    size_t size = 2;
+    while(size < capacity){
+        size <<= 1;
+    }
+    m_buffer = new cell[size];
+    if(!m_buffer){
+        throw std::exception();
+    }
+    m_mask = size - 1;
+    for(size_t i = 0; i < size; ++i){
+        m_buffer[i].seq.store(i, std::memory_order_relaxed);
+    }
+    m_enqueue_pos.store(0, std::memory_order_relaxed);
+    m_dequeue_pos.store(0, std::memory_order_relaxed);
+}
+
+template<typename T>
+mpmc_queue<T>::~mpmc_queue(){
+    delete[] m_buffer;
+}
+
+template<typename T>
+bool mpmc_queue<T>::push(const T& data){
+    return push_batch(&data, 1) == 1;
+}
+
+template<typename T>
+bool mpmc_queue<T>::pop(T& data){
+    return pop_batch(&data, 1) == 1;
+}
+
+template<typename T>
+int mpmc_queue<T>::push_batch(const T* data, int n){
+    if(n <= 0){
+        return 0;
+    }
+    size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+    int count;
+    while(true){
+        //从pos开始数连续的空槽位，空槽位只有占下它的生产者才会改动，所以数完以后CAS成功就都归我们
+        count = 0;
+        while(count < n){
+            cell* c = &m_buffer[(pos + count) & m_mask];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            if(seq != pos + count){
+                break;
+            }
+            ++count;
+        }
+        if(count == 0){
+            cell* c = &m_buffer[pos & m_mask];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            if((ptrdiff_t)(seq - pos) < 0){
+                //槽位还没被消费者取走，队列满了
+                return 0;
+            }
+            //其他生产者抢先了，重新读入队位置
+            pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            continue;
+        }
+        if(m_enqueue_pos.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed)){
+            break;
+        }
+    }
+    for(int i = 0; i < count; ++i){
+        cell* c = &m_buffer[(pos + i) & m_mask];
+        c->data = data[i];
+        c->seq.store(pos + i + 1, std::memory_order_release);
+    }
+    return count;
+}
+
+template<typename T>
+int mpmc_queue<T>::pop_batch(T* data, int n){
+    if(n <= 0){
+        return 0;
+    }
+    size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+    int count;
+    while(true){
+        //从pos开始数连续的满槽位
+        count = 0;
+        while(count < n){
+            cell* c = &m_buffer[(pos + count) & m_mask];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            if(seq != pos + count + 1){
+                break;
+            }
+            ++count;
+        }
+        if(count == 0){
+            cell* c = &m_buffer[pos & m_mask];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            if((ptrdiff_t)(seq - (pos + 1)) < 0){
+                //槽位还没被生产者填上，队列空了
+                return 0;
+            }
+            pos = m_dequeue_pos.load(std::memory_order_relaxed);
+            continue;
+        }
+        if(m_dequeue_pos.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed)){
+            break;
+        }
+    }
+    for(int i = 0; i < count; ++i){
+        cell* c = &m_buffer[(pos + i) & m_mask];
+        data[i] = c->data;
+        //槽位交还给下一圈的生产者
+        c->seq.store(pos + i + m_mask + 1, std::memory_order_release);
+    }
+    return count;
+}
+
+template<typename T>
+size_t mpmc_queue<T>::size() const{
+    size_t enqueue = m_enqueue_pos.load(std::memory_order_relaxed);
+    size_t dequeue = m_dequeue_pos.load(std::memory_order_relaxed);
+    return enqueue > dequeue ? enqueue - dequeue : 0;
+}
+
+#endif
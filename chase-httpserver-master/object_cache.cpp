@@ -0,0 +1,179 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "object_cache.h"
+#include "compress_cache.h"
+
+object_cache::object_cache(long budget):
+            m_budget(budget), m_hits(0), m_misses(0), m_bytes(0){
+    for(int i = 0; i < SHARD_NUMBER; ++i){
+        m_shards[i].bytes = 0;
+    }
+}
+
+object_cache::~object_cache(){
+    for(int i = 0; i < SHARD_NUMBER; ++i){
+        shard& s = m_shards[i];
+        s.lock.lock();
+        while(!s.lru.empty()){
+            drop(s, s.lru.begin());
+        }
+        s.lock.unlock();
+    }
+}
+
+object_cache::shard& object_cache::shard_of(const std::string& path){
+    return m_shards[std::hash<std::string>()(path) % SHARD_NUMBER];
+}
+
+bool object_cache::same_file(const cached_object* object, const struct stat& st){
+    return object->ino == st.st_ino && object->dev == st.st_dev
+        && object->size == st.st_size
+        && object->mtim.tv_sec == st.st_mtim.tv_sec && object->mtim.tv_nsec == st.st_mtim.tv_nsec;
+}
+
+bool object_cache::load(cached_object* object, file_entry* entry){
+    object->body = (char*)malloc(entry->st.st_size);
+    if(!object->body){
+        return false;
+    }
+    int len = 0;
+    while(len < entry->st.st_size){
+        int ret = pread(entry->fd, object->body + len, entry->st.st_size - len, len);
+        if(ret <= 0){
+            return false;
+        }
+        len += ret;
+    }
+    object->body_len = len;
+
+    //和add_headers等拼出来的响应头保持一致，状态行和Date由命中时的add_status_line写
+    char buf[512];
+    for(int linger = 0; linger < 2; ++linger){
+        int n = snprintf(buf, sizeof(buf),
+                         "Accept-Ranges: bytes\r\nETag: %s\r\nLast-Modified: %s\r\n%s"
+                         "Content-Type:%s\r\nContent-Length: %d\r\nConnection: %s\r\n\r\n",
+                         entry->etag, entry->last_modified,
+                         compress_cache::compressible(entry->mime) ? "Vary: Accept-Encoding\r\n" : "",
+                         entry->mime, len, linger ? "keep-alive" : "close");
+        if(n >= (int)sizeof(buf)){
+            return false;
+        }
+        object->header[linger].assign(buf, n);
+    }
+    return true;
+}
+
+cached_object* object_cache::acquire(const char* path, file_entry* entry){
+    if(m_budget <= 0 || entry->fd == -1 || entry->st.st_size <= 0 || entry->st.st_size > MAX_OBJECT_SIZE){
+        return NULL;
+    }
+    std::string key(path);
+    shard& s = shard_of(key);
+
+    s.lock.lock();
+    auto found = s.index.find(key);
+    while(found != s.index.end()){
+        cached_object* object = *found->second;
+        if(object->state == cached_object::LOADING){
+            //其他线程正在加载同一个文件，等它加载完成，不重复读盘
+            object->refs++;
+            while(object->state == cached_object::LOADING){
+                s.loaded.wait(s.lock.get());
+            }
+            if(object->state == cached_object::READY && same_file(object, entry->st)){
+                s.lock.unlock();
+                m_hits++;
+                return object;
+            }
+            s.lock.unlock();
+            release(object);
+            return NULL;
+        }
+        if(same_file(object, entry->st)){
+            //命中的对象移到LRU表头
+            s.lru.splice(s.lru.begin(), s.lru, found->second);
+            object->refs++;
+            s.lock.unlock();
+            m_hits++;
+            return object;
+        }
+        //文件已经变了，丢掉旧对象重新加载，正在发送旧对象的连接不受影响
+        drop(s, found->second);
+        found = s.index.end();
+    }
+
+    //占一个LOADING状态的位置，让后来的请求等待而不是重复加载
+    cached_object* object = new cached_object;
+    object->refs = 2;
+    object->state = cached_object::LOADING;
+    object->body = NULL;
+    object->body_len = 0;
+    object->dev = entry->st.st_dev;
+    object->ino = entry->st.st_ino;
+    object->size = entry->st.st_size;
+    object->mtim = entry->st.st_mtim;
+    object->path = key;
+    s.lru.push_front(object);
+    s.index[key] = s.lru.begin();
+    s.lock.unlock();
+    m_misses++;
+
+    bool ok = load(object, entry);
+
+    s.lock.lock();
+    found = s.index.find(key);
+    if(ok){
+        object->state = cached_object::READY;
+        long size = object->body_len + object->header[0].size() + object->header[1].size();
+        s.bytes += size;
+        m_bytes += size;
+        //超出预算时从LRU表尾开始淘汰，正在加载的对象不淘汰
+        long shard_budget = m_budget / SHARD_NUMBER;
+        auto it = s.lru.end();
+        while(s.bytes > shard_budget && it != s.lru.begin()){
+            --it;
+            if((*it)->state == cached_object::READY && *it != object){
+                drop(s, it++);
+            }
+        }
+        //预算连这一个对象都放不下，就不缓存它
+        if(s.bytes > shard_budget && found != s.index.end() && *found->second == object){
+            drop(s, found->second);
+        }
+    }else{
+        object->state = cached_object::FAILED;
+        if(found != s.index.end() && *found->second == object){
+            drop(s, found->second);
+        }
+    }
+    s.loaded.broadcast();
+    s.lock.unlock();
+
+    if(!ok){
+        release(object);
+        return NULL;
+    }
+    return object;
+}
+
+void object_cache::release(cached_object* object){
+    if(--object->refs > 0){
+        return;
+    }
+    free(object->body);
+    delete object;
+}
+
+void object_cache::drop(shard& s, std::list<cached_object*>::iterator it){
+    cached_object* object = *it;
+    if(object->state == cached_object::READY){
+        long size = object->body_len + object->header[0].size() + object->header[1].size();
+        s.bytes -= size;
+        m_bytes -= size;
+    }
+    s.index.erase(object->path);
+    s.lru.erase(it);
+    release(object);
+}
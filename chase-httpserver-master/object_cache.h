@@ -0,0 +1,88 @@
+// 热点对象缓存：把小的静态文件（css、图标、html等）整个读进内存，同时预先拼好状态行和响应头。
+// 命中时响应就是两块不可变的内存：预先拼好的响应头和文件内容，一次writev发完，不再读盘，
+// 也不再调用add_reponse/get_file_type。缓存按LRU淘汰，总内存不超过设定的预算。
+// 同一个文件同时有多个请求未命中时，只有第一个请求去读盘，其余请求等它加载完成后直接使用结果。
+// note：对象是否过期由文件缓存决定，对象记录了加载时文件的inode、大小和修改时间，
+// 和文件缓存中的stat不一致就重新加载
+#ifndef OBJECT_CACHE_H
+#define OBJECT_CACHE_H
+
+#include <sys/stat.h>
+#include <atomic>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+#include "locker.h"
+#include "file_cache.h"
+
+//缓存中的一个对象
+struct cached_object
+{
+    //LOADING   正在被某个线程加载
+    //READY     加载完成，可以使用
+    //FAILED    加载失败，等待的线程自己去读盘
+    enum STATE {LOADING = 0, READY, FAILED};
+
+    std::atomic<int> refs;      //引用计数，缓存本身持有一个
+    STATE state;
+    char* body;                 //文件内容
+    int body_len;
+    //预先拼好的响应头（状态行和Date之后的部分），下标0是Connection: close，下标1是Connection: keep-alive
+    std::string header[2];
+    //加载时文件的身份，用来判断对象是否还有效
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtim;
+    std::string path;
+};
+
+class object_cache
+{
+public:
+    //单个对象的大小上限，更大的文件仍然走sendfile/mmap
+    static const int MAX_OBJECT_SIZE = 256 * 1024;
+
+    //budget是缓存占用内存的上限，单位字节，为0时不缓存
+    object_cache(long budget);
+    ~object_cache();
+
+    //获取entry对应文件的对象，必要时从entry->fd读入内存。调用者用完后必须release。
+    //文件太大、缓存关闭或读盘失败时返回NULL，调用者按普通文件处理
+    cached_object* acquire(const char* path, file_entry* entry);
+    void release(cached_object* object);
+
+    long hits() const { return m_hits; }
+    long misses() const { return m_misses; }
+    long bytes() const { return m_bytes; }
+
+private:
+    static const int SHARD_NUMBER = 16;
+    struct shard
+    {
+        locker lock;
+        //等待LOADING状态的对象加载完成
+        cond loaded;
+        long bytes;
+        //LRU链表，表头是最近使用的
+        std::list<cached_object*> lru;
+        std::unordered_map<std::string, std::list<cached_object*>::iterator> index;
+    };
+
+    shard& shard_of(const std::string& path);
+    //把文件内容读进内存并拼好响应头，不持有任何锁
+    bool load(cached_object* object, file_entry* entry);
+    //把对象从分片中摘下并释放缓存持有的引用，调用者必须持有分片的锁
+    void drop(shard& s, std::list<cached_object*>::iterator it);
+    static bool same_file(const cached_object* object, const struct stat& st);
+
+private:
+    long m_budget;
+    shard m_shards[SHARD_NUMBER];
+    std::atomic<long> m_hits;
+    std::atomic<long> m_misses;
+    std::atomic<long> m_bytes;
+};
+
+#endif
@@ -0,0 +1,78 @@
+// 完美哈希：对一组固定的关键字，在编译期找一个种子，使所有关键字按这个种子哈希到表中互不相同的槽位，
+// 查找时只算一次哈希、比较一次字符串。关键字不区分大小写。
+// 运行时才知道的关键字（比如从mime.types读入的扩展名）用同一个哈希函数按桶分别找位移（hash and displace），
+// 见mime_types.cpp
+#ifndef PERFECT_HASH_H
+#define PERFECT_HASH_H
+
+#include <strings.h>
+
+constexpr char ph_lower(char c){
+    return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+constexpr int ph_length(const char* s){
+    int len = 0;
+    while(s[len]){
+        ++len;
+    }
+    return len;
+}
+
+//带种子的FNV-1a，最后再混合一次，让低位也足够分散
+constexpr unsigned int ph_hash(const char* s, int len, unsigned int seed){
+    unsigned int h = 2166136261u ^ (seed * 0x9e3779b9u);
+    for(int i = 0; i < len; ++i){
+        h ^= (unsigned char)ph_lower(s[i]);
+        h *= 16777619u;
+    }
+    h ^= h >> 15;
+    h *= 0x2c1b3c6du;
+    h ^= h >> 12;
+    return h;
+}
+
+//N个关键字放进SIZE个槽位，SIZE必须是2的幂。对象要声明成constexpr，种子在编译期找好
+template<int N, int SIZE>
+struct static_perfect_hash
+{
+    static_assert((SIZE & (SIZE - 1)) == 0 && SIZE >= N && N < 128, "bad perfect hash size");
+
+    unsigned int seed;
+    signed char slot[SIZE];
+    unsigned char length[N];
+
+    constexpr static_perfect_hash(const char* const (&keys)[N]): seed(0), slot(), length(){
+        for(int k = 0; k < N; ++k){
+            length[k] = ph_length(keys[k]);
+        }
+        for(unsigned int s = 1; seed == 0; ++s){
+            for(int i = 0; i < SIZE; ++i){
+                slot[i] = -1;
+            }
+            bool ok = true;
+            for(int k = 0; k < N && ok; ++k){
+                int i = ph_hash(keys[k], length[k], s) & (SIZE - 1);
+                if(slot[i] >= 0){
+                    ok = false;
+                }else{
+                    slot[i] = k;
+                }
+            }
+            if(ok){
+                seed = s;
+            }
+        }
+    }
+
+    //返回关键字在keys中的下标，不在表中时返回-1
+    int find(const char* const (&keys)[N], const char* name, int len) const{
+        int k = slot[ph_hash(name, len, seed) & (SIZE - 1)];
+        if(k < 0 || length[k] != len || strncasecmp(keys[k], name, len) != 0){
+            return -1;
+        }
+        return k;
+    }
+};
+
+#endif
@@ -0,0 +1,648 @@
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <cassert>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sched.h>
+#include <time.h>
+
+#include "reactor.h"
+#include "logger.h"
+#include "metrics.h"
+
+#define MAX_EVENT_NUMBER 10000
+//io_uring后端的提交队列长度
+#define URING_ENTRIES 4096
+//io_uring后端提供给内核的接收缓冲区个数和大小
+#define URING_BUFFER_NUMBER 1024
+#define URING_BUFFER_SIZE 2048
+//io_uring后端每一轮splice经过管道的最大字节数，等于管道的默认容量
+#define URING_SPLICE_CHUNK 65536
+
+//io_uring请求的类型，和fd一起编码在user_data中
+enum URING_OP {URING_ACCEPT = 1, URING_RECV, URING_SEND, URING_SPLICE_IN, URING_SPLICE_OUT, URING_NOTIFY, URING_TIMER};
+
+static inline unsigned long long uring_data(int fd, int op){
+    return ((unsigned long long)fd << 8) | op;
+}
+
+reactor::BACKEND reactor::m_backend = reactor::BACKEND_EPOLL;
+//默认期限：请求头10秒，消息体30秒，发送停滞30秒，keep-alive空闲15秒
+int reactor::m_timeout_ms[reactor::TIMEOUT_NUMBER] = {10000, 30000, 30000, 15000};
+
+extern void addfd( int epollfd, int fd, bool one_shot );
+extern void removefd( int epollfd, int fd );
+
+static void show_error( int connfd, const char* info )
+{
+    LOG_WARN("%s", info);
+    send( connfd, info, strlen( info ), 0 );
+    close( connfd );
+}
+
+reactor::reactor(int id, int port, http_conn** users, int max_fd, threadpool<http_conn>* pool):
+            m_user_count(0), m_id(id), m_port(port), m_listenfd(-1), m_epollfd(-1),
+            m_max_fd(max_fd), m_users(users), m_pool(pool), m_ring(NULL), m_eventfd(-1),
+            m_eventfd_value(0), m_notify_queue(NULL), m_notify_pending(false), m_ready(NULL), m_ready_number(0),
+            m_timer_armed(false), m_eviction_ns(0){
+    m_wheel = new timer_wheel(TIMER_TICK_MS, now_ms());
+    m_buffers = new buffer_pool(http_conn::BUFFER_BLOCK_SIZE, 64);
+    for(int i = 0; i < TIMEOUT_NUMBER; ++i){
+        m_evictions[i] = 0;
+    }
+    m_timer_ts.tv_sec = 0;
+    m_timer_ts.tv_nsec = TIMER_TICK_MS * 1000000LL;
+}
+
+reactor::~reactor(){
+    delete m_wheel;
+    delete m_buffers;
+    delete m_ring;
+    delete m_notify_queue;
+    delete [] m_ready;
+    if(m_eventfd != -1){
+        close(m_eventfd);
+    }
+    if(m_epollfd != -1){
+        close(m_epollfd);
+    }
+    if(m_listenfd != -1){
+        close(m_listenfd);
+    }
+}
+
+bool reactor::start(){
+    m_listenfd = socket(PF_INET, SOCK_STREAM, 0);
+    if(m_listenfd < 0){
+        return false;
+    }
+    //这样设置的话，当调用close,TCP连接会立即断开，sendbuffer中未被发送的数据被丢弃，并向
+    //对方发送发送一个RST信息.值得注意的是，由于这种方式，是非正常的4中握手方式结束TCP链接，
+    //所以，TCP连接将不会进入TIME_WAIT状态
+    struct linger tmp = {1, 0};
+    /*设置优雅断开
+    #include <arpa/inet.h>
+    struct linger {
+　　    int l_onoff;
+　　    int l_linger;
+    };
+    三种断开方式：
+
+    1. l_onoff = 0; l_linger忽略
+    close()立刻返回，底层会将未发送完的数据发送完成后再释放资源，即优雅退出。
+
+    2. l_onoff != 0; l_linger = 0;
+    close()立刻返回，但不会发送未发送完成的数据，而是通过一个REST包强制的关闭socket描述符，即强制退出。
+
+    3. l_onoff != 0; l_linger > 0;
+    close()不会立刻返回，内核会延迟一段时间，这个时间就由l_linger的值来决定。如果超时时间到达之前，发送
+    完未发送的数据(包括FIN包)并得到另一端的确认，close()会返回正确，socket描述符优雅性退出。否则，close()
+    会直接返回错误值，未发送数据丢失，socket描述符被强制性退出。需要注意的时，如果socket描述符被设置为非堵
+    塞型，则close()会直接返回值。
+    */
+    setsockopt(m_listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
+    //每个反应堆都绑定同一个端口，由内核按四元组哈希把新连接分发到各个监听socket上
+    int reuse = 1;
+    setsockopt(m_listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if(setsockopt(m_listenfd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) != 0){
+        perror("SO_REUSEPORT");
+        return false;
+    }
+
+    struct sockaddr_in address;
+    bzero(&address, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(m_port);
+
+    if(bind(m_listenfd, (struct sockaddr*)&address, sizeof(address)) < 0){
+        perror("bind");
+        return false;
+    }
+    if(listen(m_listenfd, 5) < 0){
+        perror("listen");
+        return false;
+    }
+
+    if(m_backend == BACKEND_URING){
+        if(!start_uring()){
+            LOG_ERROR("io_uring setup failed");
+            return false;
+        }
+    }else{
+        m_epollfd = epoll_create(5);
+        if(m_epollfd == -1){
+            return false;
+        }
+        addfd(m_epollfd, m_listenfd, false);
+    }
+
+    if(pthread_create(&m_thread, NULL, worker, this) != 0){
+        return false;
+    }
+    LOG_INFO("create the %dth reactor", m_id);
+    return true;
+}
+
+//记下连接放进请求队列的时间，一批连接共用一次取时间
+void reactor::stamp_enqueue(http_conn** conns, int n){
+    if(n == 0){
+        return;
+    }
+    long long now = metrics::now_ns();
+    for(int i = 0; i < n; ++i){
+        conns[i]->m_enqueue_ns = now;
+    }
+}
+
+void reactor::join(){
+    pthread_join(m_thread, NULL);
+}
+
+void* reactor::worker(void* arg){
+    reactor* r = (reactor*)arg;
+    r->run();
+    return r;
+}
+
+void reactor::handle_accept(){
+    while(true){
+        struct sockaddr_in client_address;
+        socklen_t client_addrlength = sizeof(client_address);
+        int connfd = accept(m_listenfd, (struct sockaddr*)&client_address, &client_addrlength);
+        if(connfd < 0){
+            if(errno != EAGAIN && errno != EWOULDBLOCK){
+                LOG_ERROR("accept failed, errno is : %d", errno);
+            }
+            break;
+        }
+        if(connfd >= m_max_fd || m_user_count >= m_max_fd){
+            show_error(connfd, "Internal server busy");
+            continue;
+        }
+        //初始化客户连接，这个连接以后的所有事件都注册在本反应堆的epoll上
+        http_conn* conn = get_conn(connfd);
+        conn->init(connfd, client_address, this);
+        set_timer(conn, TIMEOUT_HEADER);
+    }
+}
+
+//连接对象在fd第一次被用到时才创建，之后留在表中给复用这个fd的连接使用。
+//fd被上一个使用者close以后才可能被另一个反应堆accept到，两次系统调用之间的顺序保证了另一个反应堆能看到这里写入的指针
+http_conn* reactor::get_conn(int fd){
+    if(!m_users[fd]){
+        m_users[fd] = new http_conn();
+    }
+    return m_users[fd];
+}
+
+long long reactor::now_ms(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+void reactor::set_timer(http_conn* conn, int kind){
+    conn->m_timer_kind = kind;
+    if(m_timeout_ms[kind] <= 0){
+        m_wheel->remove(&conn->m_timer);
+        return;
+    }
+    m_wheel->add(&conn->m_timer, m_timeout_ms[kind]);
+}
+
+void reactor::remove_timer(http_conn* conn){
+    m_wheel->remove(&conn->m_timer);
+}
+
+//请求头的期限从请求的第一个字节开始算，之后读到的数据不会延长它，慢速发送请求头的客户端最终会被淘汰；
+//请求头读完以后换成消息体的期限。上传的消息体可能很大，期限改成两次进展之间的最长间隔，每次收到数据都重新计时
+void reactor::read_timer(http_conn* conn){
+    if(conn->m_upload){
+        set_timer(conn, TIMEOUT_BODY);
+        return;
+    }
+    int kind = conn->m_check_state == http_conn::CHECK_STATE_CONTENT ? TIMEOUT_BODY : TIMEOUT_HEADER;
+    if(conn->m_timer_kind != kind || !timer_wheel::pending(&conn->m_timer)){
+        set_timer(conn, kind);
+    }
+}
+
+//到期的连接不在这里关闭：它可能正在工作线程中处理，直接关闭会和工作线程冲突。
+//shutdown以后连接上的读写都会失败，由正常的事件处理流程在反应堆线程中关闭它
+void reactor::on_timer(timer_node* node, void* arg){
+    reactor* r = (reactor*)arg;
+    http_conn* conn = (http_conn*)node->data;
+    r->m_evictions[conn->m_timer_kind]++;
+    shutdown(conn->m_sockfd, SHUT_RDWR);
+}
+
+void reactor::expire_timers(){
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    if(m_wheel->advance(now_ms(), on_timer, this) > 0){
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        m_eviction_ns += (end.tv_sec - begin.tv_sec) * 1000000000LL + (end.tv_nsec - begin.tv_nsec);
+    }
+}
+
+void reactor::run(){
+    if(m_backend == BACKEND_URING){
+        run_uring();
+        return;
+    }
+    epoll_event events[MAX_EVENT_NUMBER];
+    //这一轮epoll_wait中读完数据的连接，最后一次性批量加入线程池的请求队列
+    http_conn** ready = new http_conn*[MAX_EVENT_NUMBER];
+    http_conn** users = m_users;
+    while(true){
+        //有定时器时每个tick醒来一次推进时间轮，没有定时器时一直等待
+        int timeout = m_wheel->size() > 0 ? TIMER_TICK_MS : -1;
+        int number = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, timeout);
+        if((number < 0) && (errno != EINTR)){
+            LOG_ERROR("epoll failure, errno is : %d", errno);
+            break;
+        }
+        //先推进时间轮再处理事件：等待期间时间轮可能是空的，没有跟着时间走，
+        //不先推进的话这一轮新设置的定时器会从过时的当前时间算起，马上就到期
+        expire_timers();
+        int ready_number = 0;
+        for(int i = 0; i < number; i++){
+            int sockfd = events[i].data.fd;
+            if(sockfd == m_listenfd){
+                handle_accept();
+            }else if(events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)){
+                //如果有异常直接关闭客户连接
+                users[sockfd]->close_conn();
+            }else if(events[i].events & EPOLLIN){
+                //根据读的结果，决定是将任务添加到线程池还是关闭连接
+                if(users[sockfd]->read()){
+                    read_timer(users[sockfd]);
+                    ready[ready_number++] = users[sockfd];
+                }else{
+                    users[sockfd]->close_conn();
+                }
+            }else if(events[i].events & EPOLLOUT){
+                //根据写的结果，决定是否关闭连接；读缓冲区中还有流水线请求的连接直接再交给线程池
+                //还没发完的连接重新计算发送停滞的期限，发完的keep-alive连接开始计算空闲期限
+                if(!users[sockfd]->write()){
+                    users[sockfd]->close_conn();
+                }else if(users[sockfd]->bytes_to_send > 0){
+                    set_timer(users[sockfd], TIMEOUT_WRITE);
+                }else if(users[sockfd]->has_pipelined()){
+                    set_timer(users[sockfd], TIMEOUT_HEADER);
+                    ready[ready_number++] = users[sockfd];
+                }else{
+                    set_timer(users[sockfd], TIMEOUT_IDLE);
+                }
+            }else{
+
+            }
+        }
+        //批量加入请求队列，队列满了放不下的连接只能关闭
+        stamp_enqueue(ready, ready_number);
+        int appended = m_pool->append_batch(ready, ready_number);
+        for(int i = appended; i < ready_number; ++i){
+            ready[i]->close_conn();
+        }
+    }
+    delete [] ready;
+}
+
+bool reactor::start_uring(){
+    m_ring = new uring();
+    if(!m_ring->init(URING_ENTRIES) || !m_ring->setup_buffers(0, URING_BUFFER_NUMBER, URING_BUFFER_SIZE)){
+        return false;
+    }
+    m_eventfd = eventfd(0, EFD_CLOEXEC);
+    if(m_eventfd < 0){
+        return false;
+    }
+    //每个连接同一时刻最多在通知队列中出现一次
+    m_notify_queue = new mpmc_queue<http_conn*>(m_max_fd);
+    m_ready = new http_conn*[m_max_fd];
+    return true;
+}
+
+void reactor::notify(http_conn* conn, int ev){
+    conn->m_uring_event = ev;
+    while(!m_notify_queue->push(conn)){
+        sched_yield();
+    }
+    //反应堆还没处理上一次通知的时候不用再写eventfd
+    if(!m_notify_pending.exchange(true)){
+        unsigned long long one = 1;
+        ::write(m_eventfd, &one, sizeof(one));
+    }
+}
+
+struct io_uring_sqe* reactor::uring_sqe(){
+    struct io_uring_sqe* sqe;
+    while((sqe = m_ring->get_sqe()) == NULL){
+        //提交队列满了，先把已经填好的提交出去
+        m_ring->submit(0);
+    }
+    return sqe;
+}
+
+//多次触发的accept：提交一次，每来一个新连接产生一个完成事件
+void reactor::uring_accept(){
+    struct io_uring_sqe* sqe = uring_sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = m_listenfd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = uring_data(m_listenfd, URING_ACCEPT);
+}
+
+//接收时不指定缓冲区，由内核从提供缓冲区环中挑一个，空闲连接不占用接收缓冲区
+void reactor::uring_recv(http_conn* conn){
+    struct io_uring_sqe* sqe = uring_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->m_sockfd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->user_data = uring_data(conn->m_sockfd, URING_RECV);
+    conn->m_uring_inflight++;
+}
+
+void reactor::uring_wait_notify(){
+    struct io_uring_sqe* sqe = uring_sqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = m_eventfd;
+    sqe->addr = (unsigned long)&m_eventfd_value;
+    sqe->len = sizeof(m_eventfd_value);
+    sqe->user_data = uring_data(m_eventfd, URING_NOTIFY);
+}
+
+//时间轮不为空时每个tick产生一个完成事件，让io_uring_enter按时返回
+void reactor::uring_wait_timer(){
+    struct io_uring_sqe* sqe = uring_sqe();
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (unsigned long)&m_timer_ts;
+    sqe->len = 1;
+    sqe->user_data = uring_data(0, URING_TIMER);
+    m_timer_armed = true;
+}
+
+void reactor::uring_send(http_conn* conn){
+    //sendfile模式下m_iv中只有响应头，文件内容用splice发送
+    bool has_file = conn->m_file_fd != -1;
+    int mem_count = conn->m_iv_count;
+    long mem_left = 0;
+    for(int i = 0; i < mem_count; ++i){
+        mem_left += conn->m_iv[i].iov_len;
+    }
+    off_t file_left = has_file ? conn->m_file_end - conn->m_file_offset : 0;
+    //每提交一轮发送重新计算发送停滞的期限
+    set_timer(conn, TIMEOUT_WRITE);
+
+    if(file_left > 0 && conn->m_pipe[0] == -1){
+        if(pipe2(conn->m_pipe, O_CLOEXEC) < 0){
+            conn->m_pipe[0] = conn->m_pipe[1] = -1;
+            conn->m_uring_error = true;
+            uring_send_done(conn);
+            return;
+        }
+    }
+
+    if(mem_left > 0){
+        //MSG_WAITALL保证要么全部发完要么失败，发送不完整时后面链接的splice会被取消，不会乱序
+        struct io_uring_sqe* sqe = uring_sqe();
+        memset(&conn->m_msg, 0, sizeof(conn->m_msg));
+        conn->m_msg.msg_iov = conn->m_iv;
+        conn->m_msg.msg_iovlen = mem_count;
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = conn->m_sockfd;
+        sqe->addr = (unsigned long)&conn->m_msg;
+        sqe->len = 1;
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL | (file_left > 0 ? MSG_MORE : 0);
+        if(file_left > 0){
+            sqe->flags = IOSQE_IO_LINK;
+        }
+        sqe->user_data = uring_data(conn->m_sockfd, URING_SEND);
+        conn->m_uring_inflight++;
+    }else if(conn->m_pipe_bytes > 0){
+        //上一轮splice到socket没有发完，先把管道里剩下的发出去
+        struct io_uring_sqe* sqe = uring_sqe();
+        sqe->opcode = IORING_OP_SPLICE;
+        sqe->fd = conn->m_sockfd;
+        sqe->off = (unsigned long long)-1;
+        sqe->splice_fd_in = conn->m_pipe[0];
+        sqe->splice_off_in = (unsigned long long)-1;
+        sqe->len = conn->m_pipe_bytes;
+        sqe->splice_flags = SPLICE_F_MOVE;
+        sqe->user_data = uring_data(conn->m_sockfd, URING_SPLICE_OUT);
+        conn->m_uring_inflight++;
+        return;
+    }
+    if(file_left <= 0){
+        return;
+    }
+
+    //文件到管道、管道到socket两次splice链接在一起，数据不经过用户态
+    unsigned int chunk = file_left < URING_SPLICE_CHUNK ? file_left : URING_SPLICE_CHUNK;
+    struct io_uring_sqe* sqe = uring_sqe();
+    sqe->opcode = IORING_OP_SPLICE;
+    sqe->fd = conn->m_pipe[1];
+    sqe->off = (unsigned long long)-1;
+    sqe->splice_fd_in = conn->m_file_fd;
+    sqe->splice_off_in = conn->m_file_offset;
+    sqe->len = chunk;
+    sqe->splice_flags = SPLICE_F_MOVE;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->user_data = uring_data(conn->m_sockfd, URING_SPLICE_IN);
+
+    sqe = uring_sqe();
+    sqe->opcode = IORING_OP_SPLICE;
+    sqe->fd = conn->m_sockfd;
+    sqe->off = (unsigned long long)-1;
+    sqe->splice_fd_in = conn->m_pipe[0];
+    sqe->splice_off_in = (unsigned long long)-1;
+    sqe->len = chunk;
+    sqe->splice_flags = SPLICE_F_MOVE;
+    sqe->user_data = uring_data(conn->m_sockfd, URING_SPLICE_OUT);
+    conn->m_uring_inflight += 2;
+}
+
+void reactor::uring_send_done(http_conn* conn){
+    if(conn->m_uring_error){
+        conn->close_conn();
+        return;
+    }
+    //多区间响应中还有下一个区间、流式目录列表还有下一块时继续发送
+    if(conn->bytes_to_send > 0 || conn->next_part()){
+        uring_send(conn);
+        return;
+    }
+    //发送完毕，根据HTTP请求中的Connection字段决定是继续接收下一个请求还是关闭连接
+    conn->request_done();
+    conn->unmap();
+    if(conn->m_linger){
+        conn->init();
+        if(conn->has_pipelined()){
+            set_timer(conn, TIMEOUT_HEADER);
+            m_ready[m_ready_number++] = conn;
+        }else{
+            set_timer(conn, TIMEOUT_IDLE);
+            uring_recv(conn);
+        }
+        return;
+    }
+    struct linger tmp = {0, 0};
+    setsockopt(conn->m_sockfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
+    conn->close_conn();
+}
+
+void reactor::uring_complete(struct io_uring_cqe* cqe){
+    int fd = cqe->user_data >> 8;
+    int op = cqe->user_data & 0xff;
+    int res = cqe->res;
+
+    if(op == URING_ACCEPT){
+        if(res >= 0){
+            if(res >= m_max_fd || m_user_count >= m_max_fd){
+                show_error(res, "Internal server busy");
+            }else{
+                struct sockaddr_in client_address;
+                socklen_t client_addrlength = sizeof(client_address);
+                getpeername(res, (struct sockaddr*)&client_address, &client_addrlength);
+                http_conn* conn = get_conn(res);
+                conn->init(res, client_address, this);
+                set_timer(conn, TIMEOUT_HEADER);
+                uring_recv(conn);
+            }
+        }
+        //内核不再继续产生accept事件时重新提交
+        if(!(cqe->flags & IORING_CQE_F_MORE)){
+            uring_accept();
+        }
+        return;
+    }
+    if(op == URING_NOTIFY){
+        //先清除标志再取队列，之后到来的通知一定会再写一次eventfd
+        m_notify_pending.exchange(false);
+        http_conn* conn;
+        while(m_notify_queue->pop(conn)){
+            if(conn->m_uring_event == EPOLLIN){
+                uring_recv(conn);
+            }else{
+                uring_send_done(conn);
+            }
+        }
+        uring_wait_notify();
+        return;
+    }
+    if(op == URING_TIMER){
+        m_timer_armed = false;
+        return;
+    }
+
+    if(op == 0){
+        //归还接收缓冲区失败产生的完成事件，没有对应的连接
+        return;
+    }
+    http_conn* conn = m_users[fd];
+    conn->m_uring_inflight--;
+    switch(op){
+        case URING_RECV:{
+            if(res == -ENOBUFS){
+                //提供缓冲区暂时用光了，重新排队等待
+                uring_recv(conn);
+                return;
+            }
+            if(res <= 0){
+                conn->close_conn();
+                return;
+            }
+            int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+            bool ok = conn->feed(m_ring->buffer(bid), res);
+            m_ring->recycle(bid);
+            if(ok){
+                read_timer(conn);
+                m_ready[m_ready_number++] = conn;
+            }else{
+                conn->close_conn();
+            }
+            return;
+        }
+        case URING_SEND:{
+            if(res < 0){
+                if(res != -ECANCELED){
+                    conn->m_uring_error = true;
+                }
+                break;
+            }
+            conn->bytes_have_send += res;
+            conn->bytes_to_send -= res;
+            //按发出去的字节数推进各个内存块
+            conn->consume_iov(res);
+            break;
+        }
+        case URING_SPLICE_IN:{
+            //读到0字节说明文件在发送过程中被截断了
+            if(res <= 0){
+                if(res != -ECANCELED){
+                    conn->m_uring_error = true;
+                }
+                break;
+            }
+            conn->m_file_offset += res;
+            conn->m_pipe_bytes += res;
+            break;
+        }
+        case URING_SPLICE_OUT:{
+            if(res < 0){
+                if(res != -ECANCELED){
+                    conn->m_uring_error = true;
+                }
+                break;
+            }
+            conn->m_pipe_bytes -= res;
+            conn->bytes_have_send += res;
+            conn->bytes_to_send -= res;
+            break;
+        }
+        default:
+            break;
+    }
+    //这一批链接起来的操作都完成了才决定下一步
+    if(conn->m_uring_inflight == 0){
+        uring_send_done(conn);
+    }
+}
+
+void reactor::run_uring(){
+    uring_accept();
+    uring_wait_notify();
+    while(true){
+        m_ready_number = 0;
+        if(m_wheel->size() > 0 && !m_timer_armed){
+            uring_wait_timer();
+        }
+        //一次系统调用提交上一轮产生的所有请求并等待新的完成事件
+        int ret = m_ring->submit(1);
+        if(ret < 0 && errno != EINTR && errno != EBUSY){
+            LOG_ERROR("io_uring failure, errno is : %d", errno);
+            break;
+        }
+        expire_timers();
+        struct io_uring_cqe* cqe;
+        while((cqe = m_ring->peek()) != NULL){
+            struct io_uring_cqe event = *cqe;
+            m_ring->seen();
+            uring_complete(&event);
+        }
+        //批量加入请求队列，队列满了放不下的连接只能关闭
+        stamp_enqueue(m_ready, m_ready_number);
+        int appended = m_pool->append_batch(m_ready, m_ready_number);
+        for(int i = appended; i < m_ready_number; ++i){
+            m_ready[i]->close_conn();
+        }
+    }
+}
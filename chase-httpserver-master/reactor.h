@@ -0,0 +1,136 @@
+// 多反应堆（multi-reactor）：每个反应堆线程拥有自己的epoll内核事件表和自己的SO_REUSEPORT监听socket，
+// 由内核在多个监听socket之间分发新连接。一个连接从accept开始到关闭都只由接受它的那个反应堆负责读写，
+// 解析仍然交给共享的线程池。
+// note：所有反应堆共用一张按fd下标索引的http_conn指针表，由于fd在进程内唯一，每个反应堆实际上只会访问
+// 自己accept到的那一部分http_conn对象，彼此不相交。连接对象在fd第一次出现时才创建，
+// 读写缓冲区从反应堆自己的缓冲区池中按需取得，空闲连接只占用一个很小的对象
+// 反应堆有两种I/O后端：默认的epoll，以及io_uring。io_uring后端用多次触发的accept接收新连接，
+// 用内核提供缓冲区的recv读请求，用链接起来的send/splice发送响应，一次io_uring_enter同时提交和收割一批事件。
+// 工作线程处理完请求后通过通知队列和eventfd把连接交回反应堆。
+// 每个反应堆用一个时间轮管理自己连接的超时：读请求头、读消息体、发送停滞和keep-alive空闲各有各的期限，
+// epoll后端靠epoll_wait的超时推进时间轮，io_uring后端靠IORING_OP_TIMEOUT。
+// note：连接只在所属的反应堆线程中关闭，所以时间轮不需要加锁
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <pthread.h>
+#include <atomic>
+
+#include "threadpool.h"
+#include "http_conn.h"
+#include "mpmc_queue.h"
+#include "uring.h"
+#include "timer_wheel.h"
+#include "buffer_pool.h"
+
+class reactor
+{
+public:
+    //I/O后端
+    //BACKEND_EPOLL  epoll边沿触发加非阻塞读写
+    //BACKEND_URING  io_uring异步提交和批量收割
+    enum BACKEND {BACKEND_EPOLL = 0, BACKEND_URING};
+    //连接的超时类型
+    //TIMEOUT_HEADER  从请求开始到请求头读完的期限
+    //TIMEOUT_BODY    从请求头读完到消息体读完的期限
+    //TIMEOUT_WRITE   发送响应时两次进展之间的最长间隔
+    //TIMEOUT_IDLE    keep-alive连接两个请求之间的最长空闲时间
+    enum TIMEOUT_KIND {TIMEOUT_HEADER = 0, TIMEOUT_BODY, TIMEOUT_WRITE, TIMEOUT_IDLE, TIMEOUT_NUMBER};
+    //时间轮一个tick的长度，也是超时的精度
+    static const int TIMER_TICK_MS = 100;
+
+    //id是反应堆编号，port是监听端口，users是按fd下标索引的连接表，max_fd是连接表的大小
+    reactor(int id, int port, http_conn** users, int max_fd, threadpool<http_conn>* pool);
+    ~reactor();
+    //创建监听socket和epoll内核事件表，并启动反应堆线程
+    bool start();
+    //等待反应堆线程退出
+    void join();
+
+    int epollfd() const { return m_epollfd; }
+    BACKEND backend() const { return m_backend; }
+    //连接读写缓冲区的池，只能在反应堆线程中使用
+    buffer_pool* buffers() const { return m_buffers; }
+    //io_uring后端下工作线程通知反应堆：连接需要继续读（EPOLLIN）或者开始发送响应（EPOLLOUT）
+    void notify(http_conn* conn, int ev);
+    //连接关闭时取消它的定时器，只能在反应堆线程中调用
+    void remove_timer(http_conn* conn);
+
+    //各类超时淘汰的连接数，以及处理淘汰花费的时间（纳秒）
+    long evictions(int kind) const { return m_evictions[kind]; }
+    long long eviction_ns() const { return m_eviction_ns; }
+
+public:
+    //该反应堆上当前的连接数，连接可能在工作线程中被关闭，所以需要原子操作
+    std::atomic<int> m_user_count;
+    //所有反应堆使用的I/O后端，启动时根据命令行参数设置
+    static BACKEND m_backend;
+    //各类超时的期限，单位毫秒，0表示不限制，启动时根据命令行参数设置
+    static int m_timeout_ms[TIMEOUT_NUMBER];
+
+private:
+    //反应堆线程运行的函数
+    static void* worker(void* arg);
+    void run();
+    //边沿触发模式下需要一直accept直到没有新连接
+    void handle_accept();
+    //取fd对应的连接对象，第一次用到时创建
+    http_conn* get_conn(int fd);
+    //记录连接放进请求队列的时间，用于统计排队延迟
+    void stamp_enqueue(http_conn** conns, int n);
+
+    //下面这一组函数维护连接的超时
+    static long long now_ms();
+    void set_timer(http_conn* conn, int kind);
+    //读到数据以后根据请求所处的阶段调整期限
+    void read_timer(http_conn* conn);
+    //推进时间轮，淘汰到期的连接
+    void expire_timers();
+    static void on_timer(timer_node* node, void* arg);
+
+    //下面这一组函数实现io_uring后端
+    bool start_uring();
+    void run_uring();
+    struct io_uring_sqe* uring_sqe();
+    void uring_accept();
+    void uring_recv(http_conn* conn);
+    void uring_wait_notify();
+    void uring_wait_timer();
+    //提交连接的下一段发送：剩余的响应头和内存中的消息体用sendmsg，文件内容用splice经管道发到socket
+    void uring_send(http_conn* conn);
+    //连接上所有在途的操作都完成以后，决定继续发送、等待下一个请求还是关闭连接
+    void uring_send_done(http_conn* conn);
+    void uring_complete(struct io_uring_cqe* cqe);
+
+private:
+    int m_id;
+    int m_port;
+    int m_listenfd;
+    int m_epollfd;
+    int m_max_fd;
+    http_conn** m_users;
+    threadpool<http_conn>* m_pool;
+    pthread_t m_thread;
+
+    //io_uring后端使用
+    uring* m_ring;
+    int m_eventfd;
+    unsigned long long m_eventfd_value;
+    //工作线程交回来的连接
+    mpmc_queue<http_conn*>* m_notify_queue;
+    //eventfd已经被写过、反应堆还没处理时为true，避免每次通知都写eventfd
+    std::atomic<bool> m_notify_pending;
+    //这一批完成事件中读到数据的连接，最后一次性交给线程池
+    http_conn** m_ready;
+    int m_ready_number;
+    //IORING_OP_TIMEOUT的时长和是否已经提交
+    struct __kernel_timespec m_timer_ts;
+    bool m_timer_armed;
+
+    timer_wheel* m_wheel;
+    buffer_pool* m_buffers;
+    std::atomic<long> m_evictions[TIMEOUT_NUMBER];
+    std::atomic<long long> m_eviction_ns;
+};
+
+#endif
@@ -0,0 +1,131 @@
+#include <string.h>
+#include <time.h>
+
+#include "response_header.h"
+
+//一个预先拼好的片段
+struct fragment
+{
+    int status;
+    const char* text;
+    int len;
+};
+
+#define FRAGMENT(status, text) {status, text, sizeof(text) - 1}
+
+//和http_conn中各个状态的标题保持一致
+static const fragment s_status_lines[] = {
+    FRAGMENT(200, "HTTP/1.1 200 OK\r\n"),
+    FRAGMENT(201, "HTTP/1.1 201 Created\r\n"),
+    FRAGMENT(204, "HTTP/1.1 204 No Content\r\n"),
+    FRAGMENT(206, "HTTP/1.1 206 Partial Content\r\n"),
+    FRAGMENT(304, "HTTP/1.1 304 Not Modified\r\n"),
+    FRAGMENT(400, "HTTP/1.1 400 Bad Request\r\n"),
+    FRAGMENT(403, "HTTP/1.1 403 Forbidden\r\n"),
+    FRAGMENT(404, "HTTP/1.1 404 Not Found\r\n"),
+    FRAGMENT(405, "HTTP/1.1 405 Method Not Allowed\r\n"),
+    FRAGMENT(411, "HTTP/1.1 411 Length Required\r\n"),
+    FRAGMENT(413, "HTTP/1.1 413 Payload Too Large\r\n"),
+    FRAGMENT(416, "HTTP/1.1 416 Requested Range Not Satisfiable\r\n"),
+    FRAGMENT(500, "HTTP/1.1 500 INternal Error\r\n"),
+};
+
+static const fragment s_connection[2] = {
+    FRAGMENT(0, "Connection: close\r\n"),
+    FRAGMENT(1, "Connection: keep-alive\r\n"),
+};
+
+//00到99的两位数字，数字转十进制时一次出两位
+static const char s_digits[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static const char* s_weekdays[7] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+static const char* s_months[12] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+//每个线程一份的Date头部和它对应的秒数
+struct date_cache
+{
+    time_t second;
+    char text[response_header::DATE_LEN + 1];
+};
+static thread_local date_cache t_date = {-1, ""};
+
+const char* response_header::status_line(int status, int* len){
+    for(size_t i = 0; i < sizeof(s_status_lines) / sizeof(s_status_lines[0]); ++i){
+        if(s_status_lines[i].status == status){
+            *len = s_status_lines[i].len;
+            return s_status_lines[i].text;
+        }
+    }
+    return NULL;
+}
+
+const char* response_header::connection(bool keep_alive, int* len){
+    const fragment& f = s_connection[keep_alive ? 1 : 0];
+    *len = f.len;
+    return f.text;
+}
+
+static inline char* put_two(char* out, int value){
+    memcpy(out, s_digits + value * 2, 2);
+    return out + 2;
+}
+
+const char* response_header::date(int* len){
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME_COARSE, &now);
+    if(now.tv_sec != t_date.second){
+        struct tm tm;
+        gmtime_r(&now.tv_sec, &tm);
+        //Date: Thu, 16 Oct 2026 08:12:31 GMT\r\n
+        char* p = t_date.text;
+        memcpy(p, "Date: ", 6);
+        p += 6;
+        memcpy(p, s_weekdays[tm.tm_wday], 3);
+        p += 3;
+        memcpy(p, ", ", 2);
+        p = put_two(p + 2, tm.tm_mday);
+        *p++ = ' ';
+        memcpy(p, s_months[tm.tm_mon], 3);
+        p += 3;
+        *p++ = ' ';
+        int year = tm.tm_year + 1900;
+        p = put_two(p, year / 100 % 100);
+        p = put_two(p, year % 100);
+        *p++ = ' ';
+        p = put_two(p, tm.tm_hour);
+        *p++ = ':';
+        p = put_two(p, tm.tm_min);
+        *p++ = ':';
+        p = put_two(p, tm.tm_sec);
+        memcpy(p, " GMT\r\n", 6);
+        p += 6;
+        *p = '\0';
+        t_date.second = now.tv_sec;
+    }
+    *len = DATE_LEN;
+    return t_date.text;
+}
+
+int response_header::format_number(char* out, unsigned long long value){
+    //从低位往高位写到临时缓冲区的末尾，再整体复制出去
+    char buf[NUMBER_LEN];
+    char* p = buf + NUMBER_LEN;
+    while(value >= 100){
+        int two = value % 100;
+        value /= 100;
+        p -= 2;
+        memcpy(p, s_digits + two * 2, 2);
+    }
+    if(value >= 10){
+        p -= 2;
+        memcpy(p, s_digits + value * 2, 2);
+    }else{
+        *--p = '0' + value;
+    }
+    int len = buf + NUMBER_LEN - p;
+    memcpy(out, p, len);
+    return len;
+}
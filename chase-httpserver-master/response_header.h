@@ -0,0 +1,26 @@
+// 响应头的常量片段：常用状态码的整条状态行、两种Connection头部预先拼好，拼响应头时直接memcpy；
+// 数字用两位一查的表转成十进制，不走printf；Date头部每个线程缓存一份，每秒才重新格式化一次。
+// note：Date取的是CLOCK_REALTIME_COARSE，精度是一个时钟节拍，对秒级的Date足够了
+#ifndef RESPONSE_HEADER_H
+#define RESPONSE_HEADER_H
+
+class response_header
+{
+public:
+    //"Date: Thu, 16 Oct 2026 08:12:31 GMT\r\n"的长度
+    static const int DATE_LEN = 37;
+    //format_number最多写的字节数
+    static const int NUMBER_LEN = 20;
+
+    //status对应的整条状态行（带\r\n），不是预先拼好的状态码时返回NULL
+    static const char* status_line(int status, int* len);
+    //"Connection: keep-alive\r\n"或者"Connection: close\r\n"
+    static const char* connection(bool keep_alive, int* len);
+    //当前线程缓存的Date头部（带\r\n），秒数变了才重新格式化。返回的内存属于当前线程，
+    //下一秒会被改写，要发送的话先复制到写缓冲区
+    static const char* date(int* len);
+    //把非负整数写成十进制，不写结尾的'\0'，返回写入的字节数
+    static int format_number(char* out, unsigned long long value);
+};
+
+#endif
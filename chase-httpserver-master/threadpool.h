@@ -2,48 +2,106 @@
 // 关系：主线程往工作队列中插入任务，工作线程通过竞争来去的任务并执行它。
 // note：需要保证所有客户的请求都是无状态的，因为同一个连接上的不同请求可能会由不
 // 不同的线程处理
+// 工作窃取模式下每个工作线程有自己的队列，任务类T需要提供last_worker()/set_last_worker(int)，
+// 记录上一次处理它的工作线程，下一次优先交给同一个线程，它的缓冲区还在那个核的缓存里。
+// 每个线程的队列是和无锁模式相同的有界MPMC环形队列，主人和窃取者都从队头按FIFO取，不是主人LIFO、窃取者FIFO的双端队列：
+// 这里的任务是各自独立的连接，先来先服务对延迟更公平，而且可以直接复用已有的队列
 #ifndef THREADPOOL_H
 #define THREADPOOL_H
 
 #include <list>
 #include <cstdio>
 #include <exception>
+#include <atomic>
 #include <pthread.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include "locker.h"
+#include "mpmc_queue.h"
+#include "logger.h"
 
 //线程池类，将它定义为模板类是为了代码复用。模板参数T是任务类
 template<typename T>
 class threadpool
 {
+public:
+    //请求队列的类型
+    //QUEUE_LOCKED    互斥锁保护的链表加信号量，每个任务一次内存分配和一对post/wait
+    //QUEUE_LOCKFREE  无锁的有界环形队列，支持批量存取，只有在有工作线程睡眠时才用futex唤醒
+    //QUEUE_STEALING  每个工作线程一个无锁队列，任务优先交给上次处理它的线程，空闲线程从别的线程的队列中窃取
+    enum QUEUE_MODE {QUEUE_LOCKED = 0, QUEUE_LOCKFREE, QUEUE_STEALING};
 private:
     /* data */
+    //工作线程一次最多从无锁队列中批量取出的任务数
+    static const int BATCH_SIZE = 8;
     //工作线程运行的函数，它不断从工作队列中取出任务并执行
     static void* worker(void* arg);
     void run();
+    void run_lockfree();
+    void run_stealing(int id);
+    //无锁队列模式下唤醒睡眠的工作线程
+    void wake(int n);
+    //工作窃取模式下把任务放进id号工作线程的队列
+    bool append_to(T* request, int id);
+    //工作窃取模式下任意一个队列中还有没有任务
+    bool has_work();
+
+    //工作窃取模式下每个工作线程的队列和睡眠状态
+    struct worker_slot
+    {
+        mpmc_queue<T*>* queue;
+        alignas(64) std::atomic<int> futex;  //每次唤醒这个线程时加1
+        std::atomic<int> sleeping;  //这个线程是否正在睡眠
+    };
 private:
     int m_thread_number; // 线程池汇总的线程数
     int m_max_requests;  //请求队列中允许的最大请求数
     pthread_t* m_threads; //描述线程池的数组，大小为m_thread_number
+    QUEUE_MODE m_mode;   //请求队列的类型
     std::list<T*> m_workqueue; //请求队列
     locker m_queuelocker;  //保护请求队列的互斥锁
     sem m_queuestat;  //是否有任务需要被处理
+    mpmc_queue<T*>* m_lockfree_queue; //无锁模式下的请求队列
+    std::atomic<int> m_sleepers;  //无锁模式下正在睡眠的工作线程数
+    std::atomic<int> m_futex;  //无锁模式下的futex字，每次唤醒时加1
+    worker_slot* m_slots;  //工作窃取模式下每个工作线程一个
+    std::atomic<int> m_next_id;  //工作窃取模式下给工作线程分配编号
+    std::atomic<unsigned int> m_round_robin;  //工作窃取模式下没有亲和线程的任务轮流分配
     bool m_stop;   // 是否结束线程
 public:
     //参数thread_number是线程池中线程的数量，max_requests是请求队列中最多允许的、等待处理的请求的数量
-    threadpool(int thread_number = 0, int max_requests = 10000);
+    threadpool(int thread_number = 0, int max_requests = 10000, QUEUE_MODE mode = QUEUE_LOCKED);
     ~threadpool();
     //往请求队列中添加数据
     bool append(T* request);
+    //往请求队列中批量添加数据，返回实际添加的个数
+    int append_batch(T** requests, int n);
+    //请求队列中等待处理的请求数，用于统计，是一个近似值
+    int queue_depth();
 };
 
 //参数thread_number是线程池中线程的数量，max_requests是请求队列中最多允许的、等待处理的请求的数量
 template<typename T>
-threadpool<T>::threadpool(int thread_number, int max_requests):
+threadpool<T>::threadpool(int thread_number, int max_requests, QUEUE_MODE mode):
             m_thread_number(thread_number), m_max_requests(max_requests),
-            m_stop(false), m_threads(NULL){
+            m_threads(NULL), m_mode(mode), m_lockfree_queue(NULL),
+            m_sleepers(0), m_futex(0), m_slots(NULL), m_next_id(0), m_round_robin(0), m_stop(false){
     if((thread_number <= 0) || (max_requests <= 0)){
         throw std::exception();
     }                          
+    if(m_mode == QUEUE_LOCKFREE){
+        m_lockfree_queue = new mpmc_queue<T*>(max_requests);
+    }else if(m_mode == QUEUE_STEALING){
+        //请求总数的上限平均分给每个工作线程
+        m_slots = new worker_slot[m_thread_number];
+        for(int i = 0; i < m_thread_number; ++i){
+            m_slots[i].queue = new mpmc_queue<T*>(max_requests / m_thread_number + 1);
+            m_slots[i].futex = 0;
+            m_slots[i].sleeping = 0;
+        }
+    }
     m_threads = new pthread_t[m_thread_number];
     if(!m_threads){
         throw std::exception();
@@ -51,7 +109,7 @@ threadpool<T>::threadpool(int thread_number, int max_requests):
 
     //创建thread_num个线程，并将它们都设置为脱离线程
     for(int i = 0; i < thread_number; ++i){
-        printf("create the %dth thread\n", i);
+        LOG_INFO("create the %dth thread", i);
         if(pthread_create(m_threads + i, NULL, worker, this) != 0){
             delete[] m_threads;
             throw std::exception();
@@ -68,9 +126,77 @@ threadpool<T>::~threadpool(){
     m_stop = true;
 }
 
+//无锁队列模式下唤醒睡眠的工作线程。入队和读取睡眠线程数之间有一道全屏障，与工作线程睡眠前
+//“先登记睡眠、再检查队列”的顺序配合，保证不会出现任务在队列里而所有线程都睡着的情况
+template<typename T>
+void threadpool<T>::wake(int n){
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(m_sleepers.load(std::memory_order_relaxed) == 0){
+        //没有线程在睡眠，不需要任何系统调用
+        return;
+    }
+    m_futex.fetch_add(1, std::memory_order_seq_cst);
+    syscall(SYS_futex, (int*)&m_futex, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
+//往请求队列中批量添加数据
+template<typename T>
+int threadpool<T>::append_batch(T** requests, int n){
+    if(m_mode == QUEUE_STEALING){
+        for(int i = 0; i < n; ++i){
+            if(!append(requests[i])){
+                return i;
+            }
+        }
+        return n;
+    }
+    if(m_mode == QUEUE_LOCKFREE){
+        int count = m_lockfree_queue->push_batch(requests, n);
+        if(count > 0){
+            wake(count);
+        }
+        return count;
+    }
+    for(int i = 0; i < n; ++i){
+        if(!append(requests[i])){
+            return i;
+        }
+    }
+    return n;
+}
+
+template<typename T>
+int threadpool<T>::queue_depth(){
+    if(m_mode == QUEUE_LOCKFREE){
+        return m_lockfree_queue->size();
+    }
+    if(m_mode == QUEUE_STEALING){
+        int depth = 0;
+        for(int i = 0; i < m_thread_number; ++i){
+            depth += m_slots[i].queue->size();
+        }
+        return depth;
+    }
+    m_queuelocker.lock();
+    int depth = m_workqueue.size();
+    m_queuelocker.unlock();
+    return depth;
+}
+
 //往请求队列中添加数据
 template<typename T>
 bool threadpool<T>::append(T* request){
+    if(m_mode == QUEUE_LOCKFREE){
+        return append_batch(&request, 1) == 1;
+    }
+    if(m_mode == QUEUE_STEALING){
+        //优先交给上次处理这个任务的线程，没有处理过的任务轮流分配
+        int id = request->last_worker();
+        if(id < 0 || id >= m_thread_number){
+            id = m_round_robin++ % m_thread_number;
+        }
+        return append_to(request, id);
+    }
     //操作工作队列一定要加锁，因为他被所有线程共享
     m_queuelocker.lock();
     if(m_workqueue.size() > m_max_requests){
@@ -93,6 +219,14 @@ void* threadpool<T>::worker(void* arg){
 
 template<typename T>
 void threadpool<T>::run(){
+    if(m_mode == QUEUE_LOCKFREE){
+        run_lockfree();
+        return;
+    }
+    if(m_mode == QUEUE_STEALING){
+        run_stealing(m_next_id++);
+        return;
+    }
     while(!m_stop){
         m_queuestat.wait();
         m_queuelocker.lock();
@@ -101,7 +235,7 @@ void threadpool<T>::run(){
             continue;
         }
         T* request = m_workqueue.front();
-        m_workqueue.pop_back();
+        m_workqueue.pop_front();
         m_queuelocker.unlock();
         if(!request){
             continue;
@@ -109,4 +243,105 @@ void threadpool<T>::run(){
         request->process();
     }
 }
+//无锁队列模式下的工作线程：批量取任务，队列空时先登记睡眠再确认一次队列，仍然为空才在futex上睡眠
+template<typename T>
+void threadpool<T>::run_lockfree(){
+    T* requests[BATCH_SIZE];
+    while(!m_stop){
+        int n = m_lockfree_queue->pop_batch(requests, BATCH_SIZE);
+        if(n == 0){
+            int seq = m_futex.load(std::memory_order_seq_cst);
+            m_sleepers.fetch_add(1, std::memory_order_seq_cst);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            n = m_lockfree_queue->pop_batch(requests, BATCH_SIZE);
+            if(n == 0){
+                //如果在读seq之后有任务入队并唤醒，futex字已经变了，FUTEX_WAIT会立即返回
+                syscall(SYS_futex, (int*)&m_futex, FUTEX_WAIT_PRIVATE, seq, NULL, NULL, 0);
+            }
+            m_sleepers.fetch_sub(1, std::memory_order_relaxed);
+        }
+        for(int i = 0; i < n; ++i){
+            if(requests[i]){
+                requests[i]->process();
+            }
+        }
+    }
+}
+
+template<typename T>
+bool threadpool<T>::append_to(T* request, int id){
+    worker_slot& slot = m_slots[id];
+    if(!slot.queue->push(request)){
+        //亲和线程的队列满了，换一个线程，亲和性让位于不丢请求
+        bool pushed = false;
+        for(int i = 1; i < m_thread_number && !pushed; ++i){
+            int other = (id + i) % m_thread_number;
+            if(m_slots[other].queue->push(request)){
+                id = other;
+                pushed = true;
+            }
+        }
+        if(!pushed){
+            return false;
+        }
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(m_slots[id].sleeping.load(std::memory_order_relaxed)){
+        //目标线程在睡眠，只唤醒它
+        m_slots[id].futex.fetch_add(1, std::memory_order_seq_cst);
+        syscall(SYS_futex, (int*)&m_slots[id].futex, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }else{
+        //目标线程正忙（比如在处理一轮上传或者压缩一个大文件），这个任务不能干等它，叫醒一个空闲线程来窃取。
+        //目标线程如果只是刚好要回去取任务，被叫醒的线程找不到任务就再睡下，代价只是一次多余的唤醒
+        for(int i = 1; i < m_thread_number; ++i){
+            worker_slot& idle = m_slots[(id + i) % m_thread_number];
+            if(idle.sleeping.load(std::memory_order_relaxed)){
+                idle.futex.fetch_add(1, std::memory_order_seq_cst);
+                syscall(SYS_futex, (int*)&idle.futex, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+template<typename T>
+bool threadpool<T>::has_work(){
+    for(int i = 0; i < m_thread_number; ++i){
+        if(m_slots[i].queue->size() > 0){
+            return true;
+        }
+    }
+    return false;
+}
+
+//工作窃取模式下的工作线程：先处理自己队列里的任务，自己的队列空了就依次从其他线程的队列中窃取，
+//所有队列都空了才在自己的futex上睡眠
+template<typename T>
+void threadpool<T>::run_stealing(int id){
+    worker_slot& self = m_slots[id];
+    while(!m_stop){
+        T* request = NULL;
+        if(!self.queue->pop(request)){
+            for(int i = 1; i < m_thread_number; ++i){
+                if(m_slots[(id + i) % m_thread_number].queue->pop(request)){
+                    break;
+                }
+            }
+        }
+        if(!request){
+            int seq = self.futex.load(std::memory_order_seq_cst);
+            self.sleeping.store(1, std::memory_order_seq_cst);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if(!has_work()){
+                syscall(SYS_futex, (int*)&self.futex, FUTEX_WAIT_PRIVATE, seq, NULL, NULL, 0);
+            }
+            self.sleeping.store(0, std::memory_order_relaxed);
+            continue;
+        }
+        //记下处理这个任务的线程，它下一次的请求优先交给这个线程
+        request->set_last_worker(id);
+        request->process();
+    }
+}
 #endif
@@ -0,0 +1,116 @@
+#include "timer_wheel.h"
+
+timer_wheel::timer_wheel(int tick_ms, long long now_ms):
+            m_tick_ms(tick_ms > 0 ? tick_ms : 1), m_start_ms(now_ms), m_current(0), m_size(0){
+    for(int level = 0; level < LEVEL_NUMBER; ++level){
+        for(int i = 0; i < SLOT_NUMBER; ++i){
+            timer_node* head = &m_slots[level][i];
+            head->prev = head->next = head;
+            head->data = 0;
+        }
+    }
+}
+
+timer_wheel::~timer_wheel(){
+    //节点属于使用者，这里只把它们摘下来
+    for(int level = 0; level < LEVEL_NUMBER; ++level){
+        for(int i = 0; i < SLOT_NUMBER; ++i){
+            timer_node* head = &m_slots[level][i];
+            while(head->next != head){
+                remove(head->next);
+            }
+        }
+    }
+}
+
+void timer_wheel::init_node(timer_node* node, void* data){
+    node->prev = node->next = 0;
+    node->expire = 0;
+    node->data = data;
+}
+
+void timer_wheel::place(timer_node* node){
+    unsigned long long delta = node->expire > m_current ? node->expire - m_current : 0;
+    int level = 0;
+    while(level < LEVEL_NUMBER - 1 && delta >= (1ULL << (SLOT_BITS * (level + 1)))){
+        ++level;
+    }
+    //超出最高层范围的定时器按最远的时间算
+    unsigned long long max_delta = (1ULL << (SLOT_BITS * LEVEL_NUMBER)) - 1;
+    if(delta > max_delta){
+        node->expire = m_current + max_delta;
+    }
+    int index = (node->expire >> (SLOT_BITS * level)) & SLOT_MASK;
+    timer_node* head = &m_slots[level][index];
+    node->prev = head->prev;
+    node->next = head;
+    head->prev->next = node;
+    head->prev = node;
+}
+
+void timer_wheel::add(timer_node* node, int timeout_ms){
+    if(pending(node)){
+        remove(node);
+    }
+    //至少在下一个tick到期，当前tick的槽已经处理过了
+    unsigned long long ticks = (timeout_ms + m_tick_ms - 1) / m_tick_ms;
+    node->expire = m_current + (ticks > 0 ? ticks : 1);
+    place(node);
+    m_size++;
+}
+
+void timer_wheel::remove(timer_node* node){
+    if(!pending(node)){
+        return;
+    }
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->prev = node->next = 0;
+    m_size--;
+}
+
+void timer_wheel::cascade(int level, int index){
+    timer_node* head = &m_slots[level][index];
+    timer_node* node = head->next;
+    head->prev = head->next = head;
+    while(node != head){
+        timer_node* next = node->next;
+        place(node);
+        node = next;
+    }
+}
+
+int timer_wheel::advance(long long now_ms, void (*expired)(timer_node*, void*), void* arg){
+    if(now_ms < m_start_ms){
+        return 0;
+    }
+    unsigned long long target = (now_ms - m_start_ms) / m_tick_ms;
+    if(m_size == 0){
+        //时间轮是空的，直接跳到当前时间
+        m_current = target > m_current ? target : m_current;
+        return 0;
+    }
+    int count = 0;
+    while(m_current < target){
+        ++m_current;
+        //低层转完一圈，从上一层取下一批节点
+        for(int level = 1; level < LEVEL_NUMBER; ++level){
+            if((m_current & ((1ULL << (SLOT_BITS * level)) - 1)) != 0){
+                break;
+            }
+            cascade(level, (m_current >> (SLOT_BITS * level)) & SLOT_MASK);
+        }
+        timer_node* head = &m_slots[0][m_current & SLOT_MASK];
+        while(head->next != head){
+            timer_node* node = head->next;
+            remove(node);
+            ++count;
+            //回调中可以重新添加这个节点
+            expired(node, arg);
+        }
+        if(m_size == 0){
+            m_current = target;
+        }
+    }
+    return count;
+}
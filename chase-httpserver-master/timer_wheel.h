@@ -0,0 +1,56 @@
+// 分层时间轮：4层，每层64个槽，最底层一个槽是一个tick。定时器节点直接嵌在使用者的对象里，
+// 挂在双向链表上，添加、删除、重新设置都是O(1)；推进时间时只处理当前tick对应的槽，
+// 低层转完一圈时把上一层对应槽里的节点重新分配到低层。
+// note：时间轮不加锁，只能在一个线程中使用
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+//嵌在使用者对象中的定时器节点
+struct timer_node
+{
+    timer_node* prev;
+    timer_node* next;
+    unsigned long long expire;  //到期的tick
+    void* data;                 //使用者的对象
+};
+
+class timer_wheel
+{
+public:
+    //tick_ms是一个tick的长度，now_ms是当前时间
+    timer_wheel(int tick_ms, long long now_ms);
+    ~timer_wheel();
+
+    //设置节点在timeout_ms之后到期，已经在时间轮中的节点先摘下再重新放入
+    void add(timer_node* node, int timeout_ms);
+    void remove(timer_node* node);
+    //把时间推进到now_ms，对每个到期的节点调用expired(node, arg)，返回到期的节点数
+    int advance(long long now_ms, void (*expired)(timer_node*, void*), void* arg);
+
+    static void init_node(timer_node* node, void* data);
+    static bool pending(const timer_node* node) { return node->prev != 0; }
+    int size() const { return m_size; }
+    int tick_ms() const { return m_tick_ms; }
+
+private:
+    static const int LEVEL_NUMBER = 4;
+    static const int SLOT_BITS = 6;
+    static const int SLOT_NUMBER = 1 << SLOT_BITS;
+    static const int SLOT_MASK = SLOT_NUMBER - 1;
+
+    //按到期时间和当前tick的距离把节点放进合适的层和槽
+    void place(timer_node* node);
+    //把第level层第index个槽中的节点重新分配到低层
+    void cascade(int level, int index);
+
+private:
+    int m_tick_ms;
+    long long m_start_ms;
+    //已经处理过的最后一个tick
+    unsigned long long m_current;
+    int m_size;
+    //每个槽是一个带哨兵的双向循环链表
+    timer_node m_slots[LEVEL_NUMBER][SLOT_NUMBER];
+};
+
+#endif
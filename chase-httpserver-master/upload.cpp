@@ -0,0 +1,323 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <atomic>
+
+#include "upload.h"
+
+//临时文件名中的序号，同一个进程中的多个上传不会撞名
+static std::atomic<unsigned long> s_sequence(0);
+
+int upload::m_root_fd = -1;
+
+static int hex_value(char c){
+    if(c >= '0' && c <= '9'){
+        return c - '0';
+    }
+    if(c >= 'a' && c <= 'f'){
+        return c - 'a' + 10;
+    }
+    if(c >= 'A' && c <= 'F'){
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+upload::upload(): m_state(IDENTITY), m_error(ERROR_NONE), m_fd(-1), m_dirfd(-1), m_left(0), m_has_digit(false),
+            m_line_has_text(false), m_received(0), m_max_bytes(0), m_can_splice(true){
+    m_pipe[0] = m_pipe[1] = -1;
+}
+
+upload::~upload(){
+    if(m_fd != -1){
+        close(m_fd);
+        unlinkat(m_dirfd, m_temp.c_str(), 0);
+    }
+    if(m_dirfd != -1){
+        close(m_dirfd);
+    }
+    if(m_pipe[0] != -1){
+        close(m_pipe[0]);
+        close(m_pipe[1]);
+    }
+}
+
+bool upload::valid_target(const char* target){
+    //空路径、开头的/、结尾的/和//都会产生空的路径段
+    const char* p = target;
+    while(true){
+        size_t segment = strcspn(p, "/");
+        if(segment == 0 || (segment == 1 && p[0] == '.') || (segment == 2 && p[0] == '.' && p[1] == '.')){
+            return false;
+        }
+        p += segment;
+        if(*p == '\0'){
+            return true;
+        }
+        ++p;
+    }
+}
+
+int upload::open_dir(const std::string& dir){
+    int fd = dup(m_root_fd);
+    if(fd < 0){
+        return -1;
+    }
+    size_t pos = 0;
+    while(pos < dir.size()){
+        size_t slash = dir.find('/', pos);
+        std::string segment = dir.substr(pos, slash - pos);
+        int next = openat(fd, segment.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        int err = errno;
+        //O_DIRECTORY和O_NOFOLLOW一起用时符号链接报ENOTDIR，改成ELOOP和真正不是目录的情况区分开
+        struct stat st;
+        if(next < 0 && err == ENOTDIR && fstatat(fd, segment.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISLNK(st.st_mode)){
+            err = ELOOP;
+        }
+        close(fd);
+        if(next < 0){
+            errno = err;
+            return -1;
+        }
+        fd = next;
+        pos = slash == std::string::npos ? dir.size() : slash + 1;
+    }
+    return fd;
+}
+
+bool upload::open(const char* target, long long content_length, long long max_bytes){
+    m_max_bytes = max_bytes;
+    if(content_length < 0){
+        m_state = CHUNK_SIZE;
+    }else{
+        if(max_bytes > 0 && content_length > max_bytes){
+            fail(ERROR_TOO_LARGE);
+            errno = EFBIG;
+            return false;
+        }
+        m_left = content_length;
+        m_state = content_length == 0 ? DONE : IDENTITY;
+    }
+    std::string path(target);
+    size_t slash = path.rfind('/');
+    std::string dir = slash == std::string::npos ? "" : path.substr(0, slash);
+    m_name = slash == std::string::npos ? path : path.substr(slash + 1);
+    m_dirfd = open_dir(dir);
+    if(m_dirfd < 0){
+        return false;
+    }
+    //临时文件放在目标文件同一个目录下，rename才是原子的；以.开头，目录页面里看得到但不容易和正常文件混淆
+    char suffix[64];
+    snprintf(suffix, sizeof(suffix), ".upload.%d.%lu", (int)getpid(), s_sequence++);
+    m_temp = "." + m_name + suffix;
+    m_fd = openat(m_dirfd, m_temp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0644);
+    return m_fd != -1;
+}
+
+void upload::fail(ERROR error){
+    if(m_error == ERROR_NONE){
+        m_error = error;
+    }
+}
+
+bool upload::write_data(const char* data, int len){
+    if(m_max_bytes > 0 && m_received + len > m_max_bytes){
+        fail(ERROR_TOO_LARGE);
+        return false;
+    }
+    int done = 0;
+    while(done < len){
+        int ret = ::write(m_fd, data + done, len - done);
+        if(ret < 0 && errno == EINTR){
+            continue;
+        }
+        if(ret <= 0){
+            fail(ERROR_IO);
+            return false;
+        }
+        done += ret;
+    }
+    m_received += len;
+    return true;
+}
+
+void upload::data_done(){
+    m_state = m_state == IDENTITY ? DONE : CHUNK_DATA_CR;
+}
+
+long long upload::direct_bytes() const{
+    if(m_error != ERROR_NONE || (m_state != IDENTITY && m_state != CHUNK_DATA)){
+        return 0;
+    }
+    return m_left;
+}
+
+int upload::consume(const char* data, int len){
+    int pos = 0;
+    while(pos < len && m_state != DONE && m_error == ERROR_NONE){
+        char c = data[pos];
+        switch(m_state){
+            case IDENTITY:
+            case CHUNK_DATA:{
+                int n = m_left < len - pos ? (int)m_left : len - pos;
+                if(!write_data(data + pos, n)){
+                    return pos;
+                }
+                pos += n;
+                m_left -= n;
+                if(m_left == 0){
+                    data_done();
+                }
+                continue;
+            }
+            case CHUNK_SIZE:{
+                int value = hex_value(c);
+                if(value >= 0){
+                    if(m_left > (LLONG_MAX >> 4)){
+                        fail(ERROR_FRAMING);
+                        return pos;
+                    }
+                    m_left = m_left * 16 + value;
+                    m_has_digit = true;
+                }else if(m_has_digit && (c == ';' || c == ' ' || c == '\t' || c == '\r' || c == '\n')){
+                    m_state = CHUNK_EXT;
+                    //行尾的\n不能被当作扩展吃掉，留给CHUNK_EXT处理
+                    continue;
+                }else{
+                    fail(ERROR_FRAMING);
+                    return pos;
+                }
+                break;
+            }
+            case CHUNK_EXT:{
+                if(c == '\n'){
+                    m_has_digit = false;
+                    if(m_left == 0){
+                        m_state = TRAILER;
+                        m_line_has_text = false;
+                    }else{
+                        m_state = CHUNK_DATA;
+                    }
+                }
+                break;
+            }
+            case CHUNK_DATA_CR:{
+                if(c == '\r'){
+                    m_state = CHUNK_DATA_LF;
+                }else if(c == '\n'){
+                    m_state = CHUNK_SIZE;
+                }else{
+                    fail(ERROR_FRAMING);
+                    return pos;
+                }
+                break;
+            }
+            case CHUNK_DATA_LF:{
+                if(c != '\n'){
+                    fail(ERROR_FRAMING);
+                    return pos;
+                }
+                m_state = CHUNK_SIZE;
+                break;
+            }
+            case TRAILER:{
+                //trailer中的字段都忽略，空行表示消息体结束
+                if(c == '\n'){
+                    if(!m_line_has_text){
+                        m_state = DONE;
+                    }
+                    m_line_has_text = false;
+                }else if(c != '\r'){
+                    m_line_has_text = true;
+                }
+                break;
+            }
+            default:
+                break;
+        }
+        ++pos;
+    }
+    return pos;
+}
+
+int upload::splice_from(int sockfd){
+    long long want = direct_bytes();
+    if(want > SPLICE_CHUNK){
+        want = SPLICE_CHUNK;
+    }
+    if(m_max_bytes > 0 && m_received + want > m_max_bytes){
+        //超过上限的那部分不用再搬，直接失败
+        fail(ERROR_TOO_LARGE);
+        return -1;
+    }
+    if(m_pipe[0] == -1 && pipe2(m_pipe, O_CLOEXEC) < 0){
+        m_pipe[0] = m_pipe[1] = -1;
+        m_can_splice = false;
+        errno = EINVAL;
+        return -1;
+    }
+    //管道在每次搬完以后都是空的，socket没有数据时SPLICE_F_NONBLOCK让调用马上返回
+    int n = splice(sockfd, NULL, m_pipe[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if(n < 0){
+        if(errno == EINVAL){
+            m_can_splice = false;
+        }else if(errno != EAGAIN){
+            fail(ERROR_CLOSED);
+        }
+        return -1;
+    }
+    if(n == 0){
+        fail(ERROR_CLOSED);
+        return 0;
+    }
+    //管道中的数据全部写进文件，文件系统不支持splice时读出来再写
+    int moved = 0;
+    while(moved < n){
+        int ret = m_can_splice ? splice(m_pipe[0], NULL, m_fd, NULL, n - moved, SPLICE_F_MOVE) : -1;
+        if(ret < 0 && m_can_splice && errno == EINVAL){
+            m_can_splice = false;
+        }
+        if(ret < 0 && !m_can_splice){
+            char buf[4096];
+            ret = read(m_pipe[0], buf, (n - moved) < (int)sizeof(buf) ? (n - moved) : (int)sizeof(buf));
+            if(ret > 0 && ::write(m_fd, buf, ret) != ret){
+                ret = -1;
+            }
+        }
+        if(ret <= 0){
+            if(ret < 0 && errno == EINTR){
+                continue;
+            }
+            fail(ERROR_IO);
+            return -1;
+        }
+        moved += ret;
+    }
+    m_received += n;
+    m_left -= n;
+    if(m_left == 0){
+        data_done();
+    }
+    return n;
+}
+
+bool upload::commit(bool* created){
+    struct stat st;
+    *created = fstatat(m_dirfd, m_name.c_str(), &st, AT_SYMLINK_NOFOLLOW) != 0;
+    if(close(m_fd) != 0){
+        m_fd = -1;
+        unlinkat(m_dirfd, m_temp.c_str(), 0);
+        return false;
+    }
+    m_fd = -1;
+    //目标是符号链接时替换的是链接本身，不会写到链接指向的地方
+    if(renameat(m_dirfd, m_temp.c_str(), m_dirfd, m_name.c_str()) != 0){
+        unlinkat(m_dirfd, m_temp.c_str(), 0);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,95 @@
+// 上传：PUT/POST的消息体流式写到网站根目录下的目标文件，消息体多大都只占固定的内存。
+// 消息体先写到目标文件同目录下的临时文件，收完以后rename成目标文件，写到一半断开的上传不会留下半截文件，
+// 正在下载旧文件的连接也不受影响。
+// 支持Content-Length和Transfer-Encoding: chunked两种消息体：分块编码的块长度行、块后面的\r\n和结尾的trailer
+// 由这里的状态机解析，块数据和Content-Length的消息体一样直接写进文件。
+// 读缓冲区中已经收到的消息体用write写进文件；还没收到的数据部分可以用splice从socket经过管道直接搬到文件，
+// 不经过用户态，一次最多搬一个管道的容量。
+// 目标文件所在的目录从网站根目录的fd开始逐段用openat(O_NOFOLLOW)打开，临时文件的创建和改名都相对这个目录的fd进行，
+// 路径中的符号链接一律拒绝，上传的文件不会落到网站根目录外面。
+// note：不支持splice的文件系统自动退回到read/write；消息体不做fsync，落盘由页缓存回写决定
+#ifndef UPLOAD_H
+#define UPLOAD_H
+
+#include <string>
+
+class upload
+{
+public:
+    //失败的原因
+    //ERROR_NONE      没有失败
+    //ERROR_FRAMING   分块编码格式错误
+    //ERROR_TOO_LARGE 消息体超过上限
+    //ERROR_IO        写文件失败（比如磁盘满了）
+    //ERROR_CLOSED    消息体没收完客户端就关闭了连接
+    enum ERROR {ERROR_NONE = 0, ERROR_FRAMING, ERROR_TOO_LARGE, ERROR_IO, ERROR_CLOSED};
+    //一次splice最多搬的字节数，不超过管道的默认容量
+    static const int SPLICE_CHUNK = 64 * 1024;
+
+    upload();
+    //没有commit的上传删掉临时文件
+    ~upload();
+
+    //target是相对网站根目录的目标路径，必须先经过valid_target检查。content_length小于0表示分块编码，
+    //max_bytes是消息体的上限，0表示不限制。失败返回false，errno说明原因，路径中有符号链接时为ELOOP
+    bool open(const char* target, long long content_length, long long max_bytes);
+    //把data中的消息体写进文件，返回用掉的字节数：消息体结束或者失败时停下，后面的字节属于下一个请求
+    int consume(const char* data, int len);
+    //消息体中接下来可以不经过解析直接搬进文件的字节数（Content-Length的剩余部分或者当前块剩下的数据）
+    long long direct_bytes() const;
+    //用splice从socket搬最多direct_bytes()个字节到文件，返回搬的字节数；
+    //socket暂时没有数据时返回-1，errno为EAGAIN；文件或socket不支持splice时返回-1，errno为EINVAL，
+    //以后can_splice()返回false；其他失败时返回-1并设置error()
+    int splice_from(int sockfd);
+    bool can_splice() const { return m_can_splice; }
+    //临时文件改名成目标文件，created说明目标文件原来是否不存在。失败返回false
+    bool commit(bool* created);
+
+    bool done() const { return m_state == DONE; }
+    ERROR error() const { return m_error; }
+    long long received() const { return m_received; }
+
+    //目标路径是否可以写：每个路径段都不能为空（不能以/开头或结尾，不能有//），也不能是.或..
+    static bool valid_target(const char* target);
+
+    //网站根目录的fd，打开上传时要在chdir到网站根目录以后设置
+    static int m_root_fd;
+
+private:
+    //把len字节的消息体数据写进文件，超过上限或者写失败时返回false
+    bool write_data(const char* data, int len);
+    //一段数据（Content-Length的剩余部分或者一个块的数据）收完以后转到下一个状态
+    void data_done();
+    void fail(ERROR error);
+    //从网站根目录开始逐段打开dir，不跟随符号链接，返回目录的fd，失败返回-1
+    static int open_dir(const std::string& dir);
+
+private:
+    //IDENTITY      Content-Length的消息体
+    //CHUNK_SIZE    块长度行中的十六进制数字
+    //CHUNK_EXT     块长度后面的扩展，忽略到行尾
+    //CHUNK_DATA    块数据
+    //CHUNK_DATA_CR 块数据后面的\r
+    //CHUNK_DATA_LF 块数据后面的\n
+    //TRAILER       最后一个块后面的trailer，到空行为止
+    //DONE          消息体结束
+    enum STATE {IDENTITY = 0, CHUNK_SIZE, CHUNK_EXT, CHUNK_DATA, CHUNK_DATA_CR, CHUNK_DATA_LF, TRAILER, DONE};
+    STATE m_state;
+    ERROR m_error;
+    int m_fd;
+    //目标文件所在目录的fd，目标文件名和临时文件名都相对它
+    int m_dirfd;
+    std::string m_name;
+    std::string m_temp;
+    //当前这段数据还剩多少字节
+    long long m_left;
+    //块长度行中是否已经有数字，trailer中当前行是否有内容
+    bool m_has_digit;
+    bool m_line_has_text;
+    long long m_received;
+    long long m_max_bytes;
+    int m_pipe[2];
+    bool m_can_splice;
+};
+
+#endif
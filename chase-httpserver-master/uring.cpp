@@ -0,0 +1,169 @@
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "uring.h"
+
+uring::uring(): m_fd(-1), m_sq_ptr(MAP_FAILED), m_sq_size(0), m_sqes(NULL), m_sqes_size(0),
+            m_sqe_head(0), m_sqe_tail(0), m_cq_ptr(MAP_FAILED), m_cq_size(0),
+            m_buf_group(0), m_buf_entries(0), m_buf_size(0), m_bufs(NULL){
+}
+
+uring::~uring(){
+    free(m_bufs);
+    if(m_sqes){
+        munmap(m_sqes, m_sqes_size);
+    }
+    if(m_cq_ptr != MAP_FAILED && m_cq_ptr != m_sq_ptr){
+        munmap(m_cq_ptr, m_cq_size);
+    }
+    if(m_sq_ptr != MAP_FAILED){
+        munmap(m_sq_ptr, m_sq_size);
+    }
+    if(m_fd != -1){
+        close(m_fd);
+    }
+}
+
+bool uring::init(unsigned int entries){
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    //完成队列开大一些，突发的完成事件不至于溢出
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = entries * 4;
+    m_fd = syscall(__NR_io_uring_setup, entries, &params);
+    if(m_fd < 0){
+        return false;
+    }
+
+    m_sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    m_cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    //新内核上提交队列和完成队列共用一次映射
+    if(params.features & IORING_FEAT_SINGLE_MMAP){
+        if(m_cq_size > m_sq_size){
+            m_sq_size = m_cq_size;
+        }
+        m_cq_size = m_sq_size;
+    }
+    m_sq_ptr = mmap(0, m_sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    if(m_sq_ptr == MAP_FAILED){
+        return false;
+    }
+    if(params.features & IORING_FEAT_SINGLE_MMAP){
+        m_cq_ptr = m_sq_ptr;
+    }else{
+        m_cq_ptr = mmap(0, m_cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+        if(m_cq_ptr == MAP_FAILED){
+            return false;
+        }
+    }
+    m_sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    m_sqes = (struct io_uring_sqe*)mmap(0, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+    if(m_sqes == MAP_FAILED){
+        m_sqes = NULL;
+        return false;
+    }
+
+    char* sq = (char*)m_sq_ptr;
+    m_sq_head = (unsigned int*)(sq + params.sq_off.head);
+    m_sq_tail = (unsigned int*)(sq + params.sq_off.tail);
+    m_sq_array = (unsigned int*)(sq + params.sq_off.array);
+    m_sq_mask = *(unsigned int*)(sq + params.sq_off.ring_mask);
+    m_sq_entries = *(unsigned int*)(sq + params.sq_off.ring_entries);
+
+    char* cq = (char*)m_cq_ptr;
+    m_cq_head = (unsigned int*)(cq + params.cq_off.head);
+    m_cq_tail = (unsigned int*)(cq + params.cq_off.tail);
+    m_cq_mask = *(unsigned int*)(cq + params.cq_off.ring_mask);
+    m_cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    return true;
+}
+
+struct io_uring_sqe* uring::get_sqe(){
+    unsigned int head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+    if(m_sqe_tail - head >= m_sq_entries){
+        return NULL;
+    }
+    struct io_uring_sqe* sqe = &m_sqes[m_sqe_tail & m_sq_mask];
+    m_sqe_tail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int uring::submit(unsigned int wait_nr){
+    unsigned int tail = *m_sq_tail;
+    unsigned int to_submit = m_sqe_tail - m_sqe_head;
+    while(m_sqe_head != m_sqe_tail){
+        m_sq_array[tail & m_sq_mask] = m_sqe_head & m_sq_mask;
+        tail++;
+        m_sqe_head++;
+    }
+    //内核看到新的tail之前，SQE和索引数组必须已经写好
+    __atomic_store_n(m_sq_tail, tail, __ATOMIC_RELEASE);
+    if(to_submit == 0 && wait_nr == 0){
+        return 0;
+    }
+    return syscall(__NR_io_uring_enter, m_fd, to_submit, wait_nr,
+                   wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+struct io_uring_cqe* uring::peek(){
+    unsigned int head = *m_cq_head;
+    if(head == __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE)){
+        return NULL;
+    }
+    return &m_cqes[head & m_cq_mask];
+}
+
+void uring::seen(){
+    __atomic_store_n(m_cq_head, *m_cq_head + 1, __ATOMIC_RELEASE);
+}
+
+bool uring::setup_buffers(int bgid, unsigned int entries, unsigned int buf_size){
+    m_buf_group = bgid;
+    m_buf_entries = entries;
+    m_buf_size = buf_size;
+    m_bufs = (char*)malloc((size_t)entries * buf_size);
+    if(!m_bufs){
+        return false;
+    }
+    //一次把所有缓冲区交给内核，同步等待结果
+    struct io_uring_sqe* sqe = get_sqe();
+    if(!sqe){
+        return false;
+    }
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = entries;
+    sqe->addr = (unsigned long)m_bufs;
+    sqe->len = buf_size;
+    sqe->off = 0;
+    sqe->buf_group = bgid;
+    if(submit(1) < 0){
+        return false;
+    }
+    struct io_uring_cqe* cqe = peek();
+    if(!cqe){
+        return false;
+    }
+    int res = cqe->res;
+    seen();
+    return res >= 0;
+}
+
+void uring::recycle(int bid){
+    struct io_uring_sqe* sqe;
+    while((sqe = get_sqe()) == NULL){
+        submit(0);
+    }
+    //归还缓冲区成功时不产生完成事件，随下一次submit一起提交
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = 1;
+    sqe->addr = (unsigned long)buffer(bid);
+    sqe->len = m_buf_size;
+    sqe->off = bid;
+    sqe->buf_group = m_buf_group;
+    sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+}
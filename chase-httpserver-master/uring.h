@@ -0,0 +1,64 @@
+// 对io_uring系统调用的简单封装，不依赖liburing：建立提交队列和完成队列的共享内存映射，
+// 提供取SQE、批量提交并等待、遍历CQE，以及向内核提供接收缓冲区（provided buffers）的接口。
+// note：一个uring只能由一个线程使用，这里没有任何加锁
+#ifndef URING_H
+#define URING_H
+
+#include <cstddef>
+#include <linux/io_uring.h>
+
+class uring
+{
+public:
+    uring();
+    ~uring();
+
+    //建立一个有entries个提交槽位的io_uring，失败返回false
+    bool init(unsigned int entries);
+    //取一个空的SQE，提交队列满时返回NULL，调用者应先submit
+    struct io_uring_sqe* get_sqe();
+    //提交所有已经填好的SQE，并等待至少wait_nr个完成事件，一次系统调用同时完成两件事
+    int submit(unsigned int wait_nr);
+    //取下一个完成事件，没有时返回NULL
+    struct io_uring_cqe* peek();
+    //标记已经处理完一个完成事件
+    void seen();
+
+    //向内核提供一组编号为bgid的缓冲区，共entries个，每个大小为buf_size，带IOSQE_BUFFER_SELECT的读操作从中挑选
+    //note：没有使用IORING_REGISTER_PBUF_RING，部分内核上缓冲区环不可用，IORING_OP_PROVIDE_BUFFERS从5.7起都支持
+    bool setup_buffers(int bgid, unsigned int entries, unsigned int buf_size);
+    //编号为bid的缓冲区的地址
+    char* buffer(int bid) const { return m_bufs + (long)bid * m_buf_size; }
+    //把用完的缓冲区还给内核，随下一次submit提交
+    void recycle(int bid);
+
+private:
+    int m_fd;
+    //提交队列
+    void* m_sq_ptr;
+    size_t m_sq_size;
+    unsigned int* m_sq_head;
+    unsigned int* m_sq_tail;
+    unsigned int* m_sq_array;
+    unsigned int m_sq_mask;
+    unsigned int m_sq_entries;
+    struct io_uring_sqe* m_sqes;
+    size_t m_sqes_size;
+    //已经取出但还没有提交的SQE的范围
+    unsigned int m_sqe_head;
+    unsigned int m_sqe_tail;
+    //完成队列
+    void* m_cq_ptr;
+    size_t m_cq_size;
+    unsigned int* m_cq_head;
+    unsigned int* m_cq_tail;
+    unsigned int m_cq_mask;
+    struct io_uring_cqe* m_cqes;
+    //提供给内核的缓冲区
+    int m_buf_group;
+    unsigned int m_buf_entries;
+    unsigned int m_buf_size;
+    char* m_bufs;
+};
+
+#endif